@@ -0,0 +1,265 @@
+//
+// BafLrr.cpp
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include "BafLrr.h"
+#include "Gtc.h"
+
+using namespace std;
+
+BafLrrWriter::BafLrrWriter(bool fastMath, int threads, long memory)
+  : fcrWriter(fastMath) {
+  this->threads = threads < 1 ? 1 : threads;
+  this->memory = memory < 1 ? 1 : memory;
+}
+
+void BafLrrWriter::computeSamples(ClusterTable *clusters,
+                                  Manifest *manifest, vector<string> &infiles,
+                                  vector<long> &order, int scratch,
+                                  int first, string &errorMsg, bool verbose) {
+  // compute BAF and LRR for every threads'th sample, starting at first,
+  // and store in the scratch file in order of position
+  static mutex errorLock;
+  long numSnps = manifest->snps.size();
+  long numSamples = infiles.size();
+  vector<double> x_norm(numSnps), y_norm(numSnps), theta(numSnps),
+    r(numSnps), baf(numSnps), logR(numSnps);
+  vector<float> values(numSnps);
+  Gtc *gtc = new Gtc();
+  try {
+    for (long s = first; s < numSamples; s += threads) {
+      gtc->open(infiles[s], Gtc::XFORM | Gtc::INTENSITY);
+      if (gtc->errorMsg.length()) throw gtc->errorMsg;
+      fcrWriter.compareNumberOfSNPs(manifest, gtc);
+      if (numSnps == 0) continue;
+      if (verbose) cerr << "Reading " << infiles[s] << endl;
+      fcrWriter.normalize(manifest, gtc, &x_norm[0], &y_norm[0]);
+      fcrWriter.illuminaCoordinates(numSnps, &x_norm[0], &y_norm[0],
+                                     &theta[0], &r[0]);
+      fcrWriter.bafLogR(clusters, numSnps, &theta[0], &r[0], &baf[0], &logR[0]);
+      for (int content = BAF; content <= LRR; content++) {
+        double *metric = content == BAF ? &baf[0] : &logR[0];
+        for (long k = 0; k < numSnps; k++) {
+          long j = order[k];
+          // zero intensity is NaN, as in an FCR
+          if (gtc->xRawIntensity[j] == 0 || gtc->yRawIntensity[j] == 0) {
+            values[k] = NAN;
+          } else {
+            values[k] = metric[j];
+          }
+        }
+        size_t bytes = numSnps * sizeof(float);
+        off_t offset = (off_t(content) * numSamples + s) * bytes;
+        if (pwrite(scratch, &values[0], bytes, offset) != (ssize_t)bytes) {
+          throw string("Error writing BAF/LRR scratch file: ")
+            + strerror(errno);
+        }
+      }
+    }
+  } catch (string msg) {
+    lock_guard<mutex> lock(errorLock);
+    if (errorMsg.empty()) errorMsg = msg;
+  }
+  delete gtc;
+}
+
+void BafLrrWriter::writeChromosome(Manifest *manifest, vector<long> &order,
+                                   vector<string> &sampleNames, int scratch,
+                                   long begin, long end, int content,
+                                   string path, int format) {
+  // transpose rows [begin, end) of the scratch file into one output file
+  long numSnps = manifest->snps.size();
+  long numSamples = sampleNames.size();
+  string chromosome = manifest->snps[order[begin]].chromosome;
+  FILE *outFile = fopen(path.c_str(), format == BINARY ? "wb" : "w");
+  if (outFile == NULL) {
+    throw "Cannot open " + path + " for writing: " + strerror(errno);
+  }
+  if (format == BINARY) {
+    uint8_t version = VERSION;
+    uint8_t content8 = content;
+    uint32_t snps32 = end - begin;
+    uint32_t samples32 = numSamples;
+    fwrite("blr", 1, 3, outFile);
+    fwrite(&version, 1, 1, outFile);
+    fwrite(&content8, 1, 1, outFile);
+    fwrite(&snps32, 4, 1, outFile);
+    fwrite(&samples32, 4, 1, outFile);
+    fwrite(chromosome.c_str(), 1, chromosome.size()+1, outFile);
+    for (long s = 0; s < numSamples; s++) {
+      fwrite(sampleNames[s].c_str(), 1, sampleNames[s].size()+1, outFile);
+    }
+    for (long k = begin; k < end; k++) {
+      string &name = manifest->snps[order[k]].name;
+      fwrite(name.c_str(), 1, name.size()+1, outFile);
+    }
+    for (long k = begin; k < end; k++) {
+      uint32_t position = manifest->snps[order[k]].position;
+      fwrite(&position, 4, 1, outFile);
+    }
+  } else {
+    fprintf(outFile, "Name\tChr\tPosition");
+    for (long s = 0; s < numSamples; s++) {
+      fprintf(outFile, "\t%s", sampleNames[s].c_str());
+    }
+    fprintf(outFile, "\n");
+  }
+
+  // a tile holds the same rows for every sample, as read from the scratch
+  // file, and again transposed; memory is split between the two buffers
+  long tileRows = (memory << 20) / (2 * sizeof(float) * numSamples);
+  if (tileRows < 1) tileRows = 1;
+  if (tileRows > end - begin) tileRows = end - begin;
+  vector<float> tile(tileRows * numSamples);
+  vector<float> rows(tileRows * numSamples);
+  const long block = 64; // transpose in cache-sized square blocks
+  for (long start = begin; start < end; start += tileRows) {
+    long n = min(tileRows, end - start);
+    size_t bytes = n * sizeof(float);
+    for (long s = 0; s < numSamples; s++) {
+      off_t offset = ((off_t(content) * numSamples + s) * numSnps + start)
+        * sizeof(float);
+      if (pread(scratch, &tile[s*n], bytes, offset) != (ssize_t)bytes) {
+        fclose(outFile);
+        throw string("Error reading BAF/LRR scratch file: ")
+          + strerror(errno);
+      }
+    }
+    for (long s0 = 0; s0 < numSamples; s0 += block) {
+      for (long k0 = 0; k0 < n; k0 += block) {
+        long sEnd = min(s0 + block, numSamples);
+        long kEnd = min(k0 + block, n);
+        for (long s = s0; s < sEnd; s++) {
+          for (long k = k0; k < kEnd; k++) {
+            rows[k*numSamples + s] = tile[s*n + k];
+          }
+        }
+      }
+    }
+    if (format == BINARY) {
+      fwrite(&rows[0], sizeof(float), n * numSamples, outFile);
+    } else {
+      for (long k = 0; k < n; k++) {
+        snpClass &snp = manifest->snps[order[start+k]];
+        fprintf(outFile, "%s\t%s\t%ld", snp.name.c_str(),
+                snp.chromosome.c_str(), snp.position);
+        for (long s = 0; s < numSamples; s++) {
+          float value = rows[k*numSamples + s];
+          if (std::isnan(value)) fprintf(outFile, "\tNaN");
+          else fprintf(outFile, "\t%.4f", value);
+        }
+        fprintf(outFile, "\n");
+      }
+    }
+  }
+  if (ferror(outFile)) {
+    fclose(outFile);
+    throw "Error writing " + path;
+  }
+  fclose(outFile);
+}
+
+void BafLrrWriter::write(ClusterTable *clusters, Manifest *manifest,
+                         string prefix, vector<string> infiles, vector<string> sampleNames,
+                         int format, bool verbose) {
+  // 'main' method to generate BAF and LRR matrices for all chromosomes
+  long numSnps = manifest->snps.size();
+  long numSamples = infiles.size();
+  if (prefix == "" || prefix == "-") {
+    throw "BAF/LRR output needs a file name prefix, not standard output";
+  }
+  if (numSamples == 0) {
+    throw "BAF/LRR output needs at least one GTC file";
+  }
+  // sample names default to those in the GTC files
+  Gtc *gtc = new Gtc();
+  for (long s = sampleNames.size(); s < numSamples; s++) {
+    gtc->open(infiles[s], 0);
+    sampleNames.push_back(gtc->sampleName);
+  }
+  delete gtc;
+  sampleNames.resize(numSamples);
+
+  // SNPs in order of chromosome and position, without moving the manifest
+  // entries, which must stay in the order of the GTC and EGT arrays
+  vector<snpClass> &snps = manifest->snps;
+  vector<long> order;
+  ManifestColumns columns(manifest);
+  bool byName = false;
+  columns.sort(order, byName);
+
+  // the scratch file is unlinked at once, so it is removed on any exit
+  string scratchPath = prefix + ".XXXXXX";
+  vector<char> pathBuffer(scratchPath.begin(), scratchPath.end());
+  pathBuffer.push_back('\0');
+  int scratch = mkstemp(&pathBuffer[0]);
+  if (scratch < 0) {
+    throw "Cannot create scratch file " + scratchPath + ": " + strerror(errno);
+  }
+  unlink(&pathBuffer[0]);
+
+  try {
+    string errorMsg;
+    vector<thread> workers;
+    int n = min((long) threads, max(numSamples, 1L));
+    for (int t = 0; t < n; t++) {
+      workers.push_back(thread(&BafLrrWriter::computeSamples, this, clusters,
+                               manifest, ref(infiles), ref(order), scratch, t,
+                               ref(errorMsg), verbose));
+    }
+    for (int t = 0; t < n; t++) workers[t].join();
+    if (!errorMsg.empty()) throw errorMsg;
+
+    const char *suffix = format == BINARY ? ".bin" : ".txt";
+    for (long begin = 0, end; begin < numSnps; begin = end) {
+      string chromosome = snps[order[begin]].chromosome;
+      for (end = begin; end < numSnps; end++) {
+        if (snps[order[end]].chromosome != chromosome) break;
+      }
+      if (verbose) cerr << "Writing chromosome " << chromosome << endl;
+      string stem = prefix + "." + chromosome;
+      writeChromosome(manifest, order, sampleNames, scratch, begin, end,
+                      BAF, stem + ".baf" + suffix, format);
+      writeChromosome(manifest, order, sampleNames, scratch, begin, end,
+                      LRR, stem + ".lrr" + suffix, format);
+    }
+  } catch (...) {
+    close(scratch);
+    throw;
+  }
+  close(scratch);
+}
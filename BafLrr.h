@@ -0,0 +1,90 @@
+//
+// BafLrr.h
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _BAFLRR_H
+#define _BAFLRR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ClusterTable.h"
+#include "Fcr.h"
+#include "Manifest.h"
+
+using namespace std;
+
+class BafLrrWriter {
+ // Writes B allele frequency and log R ratio as wide SNP x sample matrices,
+ // one pair of files per chromosome, as wanted by PennCNV-style CNV callers.
+ // Values are found with the FcrWriter formulas, so agree with an FCR.
+ //
+ // Samples are processed in parallel into a sample-major scratch file. Each
+ // chromosome is then transposed in tiles of SNP rows, sized so the tile
+ // buffers stay within the given memory budget.
+ //
+ // Output for chromosome <chr> is <prefix>.<chr>.baf.txt and
+ // <prefix>.<chr>.lrr.txt, or .bin in binary format. Text files have a
+ // header line "Name Chr Position <sample>..." and one tab-separated row per
+ // SNP, in order of position. Binary files hold, in native byte order:
+ //   char[3]  magic "blr"
+ //   uint8    version (1)
+ //   uint8    content (0 = BAF, 1 = LRR)
+ //   uint32   number of SNPs
+ //   uint32   number of samples
+ //   chromosome name, sample names, SNP names: each terminated by '\0'
+ //   uint32   SNP positions, one per SNP
+ //   float32  values, SNP-major: all samples for the first SNP, then the next
+
+ public:
+  static const int TEXT = 0;
+  static const int BINARY = 1;
+  static const int BAF = 0;
+  static const int LRR = 1;
+  static const uint8_t VERSION = 1;
+  static const long DEFAULT_MEMORY = 512; // megabytes
+
+  BafLrrWriter(bool fastMath=false, int threads=1, long memory=DEFAULT_MEMORY);
+  void write(ClusterTable *clusters, Manifest *manifest, string prefix,
+             vector<string> infiles, vector<string> sampleNames,
+             int format=TEXT, bool verbose=false);
+
+ private:
+  FcrWriter fcrWriter;
+  int threads;
+  long memory; // megabytes
+
+  void computeSamples(ClusterTable *clusters, Manifest *manifest,
+                      vector<string> &infiles, vector<long> &order, int scratch, int first,
+                      string &errorMsg, bool verbose);
+  void writeChromosome(Manifest *manifest, vector<long> &order,
+                       vector<string> &sampleNames, int scratch,
+                       long begin, long end, int content, string path,
+                       int format);
+};
+
+#endif	// _BAFLRR_H
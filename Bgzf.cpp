@@ -0,0 +1,170 @@
+//
+// Bgzf.cpp
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "Bgzf.h"
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <zlib.h>
+
+using namespace std;
+
+// The empty member which marks the end of a BGZF file
+static const unsigned char BGZF_EOF[28] = {
+  0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+  0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00
+};
+
+BgzfWriter::BgzfWriter(string path, int threads) {
+  this->path = path;
+  this->threads = threads < 1 ? 1 : threads;
+  file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    throw "Cannot open " + path + " for writing: " + strerror(errno);
+  }
+  block.reserve(BLOCK_SIZE);
+  blocks = 0;
+  compressed = 0;
+}
+
+BgzfWriter::~BgzfWriter() {
+  if (file != NULL) fclose(file);
+}
+
+void BgzfWriter::write(const char *data, size_t length) {
+  while (length > 0) {
+    size_t n = min(length, BLOCK_SIZE - block.size());
+    block.append(data, n);
+    data += n;
+    length -= n;
+    if (block.size() == BLOCK_SIZE) {
+      full.push_back(block);
+      block.clear();
+      blocks++;
+      if (full.size() >= (size_t) threads * 4) flush();
+    }
+  }
+}
+
+uint64_t BgzfWriter::virtual_offset(uint64_t position) const {
+  uint64_t b = position >> 16;
+  if (b >= offsets.size()) {
+    throw string("BGZF position is beyond the blocks written to ") + path;
+  }
+  return (offsets[b] << 16) | (position & 0xffff);
+}
+
+void BgzfWriter::close() {
+  if (file == NULL) return;
+  if (block.size() > 0) {
+    full.push_back(block);
+    block.clear();
+    blocks++;
+  }
+  flush();
+  offsets.push_back(compressed);  // the position at the end of the data
+  if (fwrite(BGZF_EOF, 1, sizeof(BGZF_EOF), file) != sizeof(BGZF_EOF) ||
+      fclose(file) != 0) {
+    file = NULL;
+    throw "Error writing " + path + ": " + strerror(errno);
+  }
+  file = NULL;
+}
+
+// Compress the full blocks, a share of them in each thread, and write them
+void BgzfWriter::flush() {
+  vector<string> members(full.size());
+  if (threads == 1 || full.size() == 1) {
+    for (size_t i = 0; i < full.size(); i++) compress(full[i], members[i]);
+  } else {
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+      workers.push_back(thread([this, &members, t]() {
+        for (size_t i = t; i < full.size(); i += threads) {
+          compress(full[i], members[i]);
+        }
+      }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+  }
+  for (size_t i = 0; i < members.size(); i++) writeMember(members[i]);
+  full.clear();
+}
+
+// A gzip member with the BGZF extra field, giving its size
+void BgzfWriter::compress(const string &data, string &member) {
+  static const size_t HEADER = 18, FOOTER = 8;
+  // If deflate expands the data so much that the member would not fit
+  // in 64KiB, store it uncompressed, as htslib does
+  static const int levels[2] = { Z_DEFAULT_COMPRESSION, Z_NO_COMPRESSION };
+  size_t size = 0;
+  for (int l = 0; l < 2; l++) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, levels[l], Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      throw string("Cannot initialise BGZF compression");
+    }
+    member.resize(HEADER + deflateBound(&zs, data.size()) + FOOTER);
+    zs.next_in = (Bytef *) data.data();
+    zs.avail_in = data.size();
+    zs.next_out = (Bytef *) &member[HEADER];
+    zs.avail_out = member.size() - HEADER - FOOTER;
+    int status = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (status != Z_STREAM_END) throw string("BGZF compression failed");
+    size = HEADER + zs.total_out + FOOTER;
+    if (size <= 0x10000) break;
+  }
+  if (size > 0x10000) throw string("BGZF block does not fit in 64KiB");
+  member.resize(size);
+
+  static const unsigned char header[16] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+    0x42, 0x43, 0x02, 0x00
+  };
+  memcpy(&member[0], header, sizeof(header));
+  member[16] = (size - 1) & 0xff;
+  member[17] = (size - 1) >> 8;
+  uint32_t crc = crc32(crc32(0, NULL, 0), (const Bytef *) data.data(), data.size());
+  uint32_t length = data.size();
+  for (int i = 0; i < 4; i++) {
+    member[size - 8 + i] = (crc >> (8 * i)) & 0xff;
+    member[size - 4 + i] = (length >> (8 * i)) & 0xff;
+  }
+}
+
+void BgzfWriter::writeMember(const string &member) {
+  offsets.push_back(compressed);
+  if (fwrite(member.data(), 1, member.size(), file) != member.size()) {
+    throw "Error writing " + path + ": " + strerror(errno);
+  }
+  compressed += member.size();
+}
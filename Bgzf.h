@@ -0,0 +1,83 @@
+//
+// Bgzf.h
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _BGZF_H
+#define _BGZF_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Writes a BGZF file, as read by bgzip, tabix and htslib: a series of
+// gzip members, each holding up to BLOCK_SIZE bytes of data and its own
+// compressed size, followed by an empty EOF member. Full blocks are
+// compressed a batch at a time, by 'threads' threads, and written in
+// order.
+//
+// A position in the data, from tell(), is the ordinal of its block,
+// shifted left 16 bits, plus its offset in the block. The compressed
+// offset of a block is only known when it is written, so the BGZF
+// virtual offset of a position is found by virtual_offset() after
+// close(). Errors are thrown as strings.
+
+class BgzfWriter {
+
+ public:
+  BgzfWriter(std::string path, int threads = 1);
+  ~BgzfWriter();
+
+  void write(const char *data, size_t length);
+  void write(const std::string &data) { write(data.data(), data.size()); }
+
+  // position of the next byte to be written
+  uint64_t tell() const { return (blocks << 16) | block.size(); }
+
+  // virtual offset of a position from tell(), once closed
+  uint64_t virtual_offset(uint64_t position) const;
+
+  void close();
+
+  static const size_t BLOCK_SIZE = 0xff00;
+
+ private:
+  std::string path;
+  FILE *file;
+  int threads;
+  std::string block;              // data of the block being filled
+  uint64_t blocks;                // blocks before it
+  std::vector<std::string> full;  // full blocks waiting to be compressed
+  std::vector<uint64_t> offsets;  // compressed offset of each block written
+  uint64_t compressed;            // bytes written
+
+  void flush();
+  static void compress(const std::string &data, std::string &member);
+  void writeMember(const std::string &member);
+};
+
+#endif // _BGZF_H
@@ -0,0 +1,327 @@
+//
+// Caller.cpp
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include "Caller.h"
+#include "Fcr.h"
+#include "plink_binary.h"
+
+using namespace std;
+
+Caller::Caller(ClusterTable *clusters, Manifest *manifest, double threshold) {
+  this->threshold = threshold;
+  numProbes = manifest->snps.size();
+  model.resize(3 * TERMS * numProbes);
+  float params[ClusterTable::PARAMS_PER_SNP];
+  for (long i = 0; i < numProbes; i++) {
+    // order of params is devR, meanR, devTheta, meanTheta for AA, AB, BB
+    long index = manifest->snps[i].index - 1;
+    if (index < 0 || index >= clusters->snpTotal) {
+      ostringstream msg;
+      msg << "Manifest index " << index + 1 << " of SNP "
+          << manifest->snps[i].name << " is outside the cluster table";
+      throw msg.str();
+    }
+    clusters->getClusters(index, params);
+    for (int k = 0; k < 3; k++) {
+      double devR = params[k];
+      double meanR = params[3 + k];
+      double devTheta = params[6 + k];
+      double meanTheta = params[9 + k];
+      double *terms = &model[k * TERMS * numProbes + i];
+      if (devR > 0 && devTheta > 0 && isfinite(devR) && isfinite(devTheta)
+          && isfinite(meanR) && isfinite(meanTheta)) {
+        terms[0] = meanTheta;
+        terms[numProbes] = 1.0 / devTheta;
+        terms[2 * numProbes] = meanR;
+        terms[3 * numProbes] = 1.0 / devR;
+        terms[4 * numProbes] = 0.0;
+      } else {
+        terms[0] = 0.0;
+        terms[numProbes] = 0.0;
+        terms[2 * numProbes] = 0.0;
+        terms[3 * numProbes] = 0.0;
+        terms[4 * numProbes] = INFINITY;
+      }
+    }
+  }
+}
+
+void Caller::call(int n, const double x[], const double y[], uint8_t calls[],
+                  double scores[]) {
+  // call genotypes for n probes of one sample, from normalized intensities;
+  // safe to call concurrently for different samples
+  if (n == 0) return;
+  vector<double> theta(n);
+  vector<double> r(n);
+  vector<double> best(n);
+  FcrWriter fcrWriter(true);
+  fcrWriter.illuminaCoordinates(n, x, y, &theta[0], &r[0]);
+  nearest(n, &theta[0], &r[0], &model[0], numProbes, &best[0], scores);
+  for (int i = 0; i < n; i++) {
+    calls[i] = scores[i] >= threshold ? (uint8_t) best[i] : 0;
+  }
+}
+
+void Caller::nearest(long n, const double *__restrict theta,
+                     const double *__restrict r,
+                     const double *__restrict model, long stride,
+                     double *__restrict best, double *__restrict score) {
+  // nearest cluster, as a call code, and score for each probe
+  // straight-line loop body with selects only, so it can be vectorized;
+  // NaN intensities give a NaN score, which is never above the threshold,
+  // and zero intensity gives a call of 0
+  const double *aa = model;
+  const double *ab = model + TERMS * stride;
+  const double *bb = model + 2 * TERMS * stride;
+  for (long i = 0; i < n; i++) {
+    double t = theta[i];
+    double ri = r[i];
+    double a0 = (t - aa[i]) * aa[stride + i];
+    double b0 = (ri - aa[2*stride + i]) * aa[3*stride + i];
+    double a1 = (t - ab[i]) * ab[stride + i];
+    double b1 = (ri - ab[2*stride + i]) * ab[3*stride + i];
+    double a2 = (t - bb[i]) * bb[stride + i];
+    double b2 = (ri - bb[2*stride + i]) * bb[3*stride + i];
+    double d0 = a0*a0 + b0*b0 + aa[4*stride + i];
+    double d1 = a1*a1 + b1*b1 + ab[4*stride + i];
+    double d2 = a2*a2 + b2*b2 + bb[4*stride + i];
+    double lo = d0 <= d1 ? d0 : d1;
+    double hi = d0 <= d1 ? d1 : d0;
+    double code = d0 <= d1 ? 1.0 : 2.0;
+    double first = lo <= d2 ? lo : d2;
+    double second = lo <= d2 ? (hi <= d2 ? hi : d2) : lo;
+    code = lo <= d2 ? code : 3.0;
+    score[i] = 1.0 - sqrt(first / second);
+    best[i] = ri > 0.0 ? code : 0.0;
+  }
+}
+
+void Caller::write(Sim *sim, Manifest *manifest, string outfile, int format,
+                   int threads, bool verbose, long memory) {
+  // call every sample in the SIM file, and write to outfile
+  if (sim->numChannels != 2) {
+    throw("simtools can only handle SIM files with exactly 2 channels at present");
+  }
+  if (sim->numProbes != manifest->snps.size() || sim->numProbes != numProbes) {
+    ostringstream msg;
+    msg << "Size mismatch: SIM file contains " << sim->numProbes
+        << " probes, but manifest contains " << manifest->snps.size()
+        << " probes.";
+    throw msg.str();
+  }
+  if (outfile == "" || outfile == "-") {
+    throw("Genotype calls need an output file name, not standard output");
+  }
+  if (threads < 1) threads = 1;
+
+  // BED output is SNP-major; the calls of each group of four samples are
+  // packed individual-major and transposed into a block of samples, which
+  // is written at once if it holds every sample, or else to a scratch file
+  // from which the rows are put together at the end
+  size_t numSamples = sim->numSamples;
+  size_t sampleBytes = (numProbes + 3) / 4;	// calls of a sample
+  size_t snpBytes = (numSamples + 3) / 4;	// calls of a SNP
+  size_t blockBytes = numProbes ? ((size_t) memory << 20) / numProbes : snpBytes;
+  if (blockBytes < 1) blockBytes = 1;
+  if (blockBytes > snpBytes) blockBytes = snpBytes;
+  vector<char> block;
+  vector<char> samples;
+  int scratch = -1;
+
+  plink_binary *pb = NULL;
+  FILE *outFile = NULL;
+  if (format == BED) {
+    pb = new plink_binary();
+    pb->bed_mode = 1; // SNP major
+    pb->open(outfile, 1);
+    for (long i = 0; i < numProbes; i++) {
+      snpClass &snp = manifest->snps[i];
+      gftools::snp gfsnp;
+      gfsnp.name = snp.name;
+      gfsnp.chromosome = snp.chromosome;
+      if (snp.chromosome == "X") gfsnp.chromosome = "23";
+      if (snp.chromosome == "Y") gfsnp.chromosome = "24";
+      if (snp.chromosome == "XY") gfsnp.chromosome = "25";
+      if (snp.chromosome == "MT") gfsnp.chromosome = "26";
+      gfsnp.physical_position = snp.position;
+      if (snp.snp[0] == 'N') {
+        gfsnp.allele_a = '?';
+        gfsnp.allele_b = '?';
+      } else {
+        gfsnp.allele_a = snp.snp[0];
+        gfsnp.allele_b = snp.snp[1];
+      }
+      pb->snps.push_back(gfsnp);
+    }
+    block.resize(numProbes * blockBytes);
+    samples.resize(4 * sampleBytes);
+    if (blockBytes < snpBytes) {
+      // the scratch file is unlinked at once, so it is removed on any exit
+      string scratchPath = outfile + ".XXXXXX";
+      vector<char> pathBuffer(scratchPath.begin(), scratchPath.end());
+      pathBuffer.push_back('\0');
+      scratch = mkstemp(&pathBuffer[0]);
+      if (scratch < 0) {
+        throw "Cannot create scratch file " + scratchPath + ": " + strerror(errno);
+      }
+      unlink(&pathBuffer[0]);
+    }
+  } else {
+    outFile = fopen(outfile.c_str(), "wb");
+    if (outFile == NULL) {
+      throw "Cannot open " + outfile + " for writing: " + strerror(errno);
+    }
+    uint8_t version = VERSION;
+    uint32_t samples32 = sim->numSamples;
+    uint32_t probes32 = numProbes;
+    fwrite("gt2", 1, 3, outFile);
+    fwrite(&version, 1, 1, outFile);
+    fwrite(&samples32, 4, 1, outFile);
+    fwrite(&probes32, 4, 1, outFile);
+  }
+
+  // samples are read in batches of one per thread, called in parallel,
+  // and written in the order of the SIM file
+  vector<vector<double> > x(threads, vector<double>(numProbes));
+  vector<vector<double> > y(threads, vector<double>(numProbes));
+  vector<vector<uint8_t> > calls(threads, vector<uint8_t>(numProbes));
+  vector<vector<double> > scores(threads, vector<double>(numProbes));
+  vector<string> names(threads);
+  char *sampleName = new char[sim->sampleNameSize + 1];
+  vector<float> intensity_float(sim->sampleIntensityTotal);
+  vector<uint16_t> intensity_int(sim->sampleIntensityTotal);
+  vector<char> packed((numProbes + 3) / 4);
+  for (unsigned long first = 0; first < sim->numSamples; first += threads) {
+    int batch = min((unsigned long) threads, sim->numSamples - first);
+    for (int b = 0; b < batch; b++) {
+      if (sim->numberFormat == Sim::FLOAT) {
+        sim->getNextRecord(sampleName, &intensity_float[0], true);
+        for (long i = 0; i < numProbes; i++) {
+          x[b][i] = intensity_float[2*i];
+          y[b][i] = intensity_float[2*i + 1];
+        }
+      } else {
+        sim->getNextRecord(sampleName, &intensity_int[0]);
+        for (long i = 0; i < numProbes; i++) {
+          x[b][i] = intensity_int[2*i];
+          y[b][i] = intensity_int[2*i + 1];
+        }
+      }
+      names[b] = sampleName;
+    }
+    vector<thread> workers;
+    for (int b = 0; b < batch; b++) {
+      workers.push_back(thread(&Caller::call, this, (int) numProbes,
+                               &x[b][0], &y[b][0], &calls[b][0],
+                               &scores[b][0]));
+    }
+    for (int b = 0; b < batch; b++) workers[b].join();
+    for (int b = 0; b < batch; b++) {
+      if (verbose) {
+        cerr << "Called sample " << first + b + 1 << " of "
+             << sim->numSamples << ": " << names[b] << endl;
+      }
+      if (format == BED) {
+        gftools::individual ind;
+        ind.name = names[b];
+        pb->individuals.push_back(ind);
+        // PLINK codes for GTC calls 0 (no call), 1 (AA), 2 (AB), 3 (BB)
+        static const char PLINK_CODE[4] = { 1, 0, 2, 3 };
+        size_t n = first + b;
+        char *packedCalls = &samples[(n % 4) * sampleBytes];
+        for (long i = 0; i < numProbes; i++) {
+          packedCalls[i/4] |= PLINK_CODE[calls[b][i]] << (2 * (i % 4));
+        }
+        if (n % 4 < 3 && n + 1 < numSamples) continue;
+        size_t group = n - n % 4;
+        size_t blockFirst = group - group % (4 * blockBytes);
+        size_t blockLast = min(blockFirst + 4 * blockBytes, numSamples);
+        size_t width = (blockLast - blockFirst + 3) / 4;
+        plink_binary::transpose_calls(&samples[0], n % 4 + 1, numProbes,
+                                      &block[(group - blockFirst) / 4], width);
+        fill(samples.begin(), samples.end(), 0);
+        if (n + 1 < blockLast) continue;
+        if (scratch < 0) {
+          pb->write_packed_snps(&block[0], numProbes);
+        } else if (::write(scratch, &block[0], numProbes * width) !=
+                   (ssize_t) (numProbes * width)) {
+          throw string("Error writing BED scratch file: ") + strerror(errno);
+        }
+      } else {
+        vector<char> name(sim->sampleNameSize, '\0');
+        strncpy(&name[0], names[b].c_str(), sim->sampleNameSize);
+        fwrite(&name[0], 1, name.size(), outFile);
+        fill(packed.begin(), packed.end(), 0);
+        for (long i = 0; i < numProbes; i++) {
+          packed[i/4] |= calls[b][i] << (2 * (i % 4));
+        }
+        fwrite(&packed[0], 1, packed.size(), outFile);
+      }
+    }
+  }
+  delete [] sampleName;
+  if (scratch >= 0) {
+    // each row of the BED file has a slice of every block in the scratch file
+    size_t rows = ((size_t) memory << 20) / snpBytes;
+    if (rows < 1) rows = 1;
+    if (rows > (size_t) numProbes) rows = numProbes;
+    vector<char> snpCalls(rows * snpBytes);
+    for (size_t j = 0; j < (size_t) numProbes; j += rows) {
+      size_t count = min(rows, numProbes - j);
+      off_t offset = 0;
+      for (size_t first = 0; first < numSamples; first += 4 * blockBytes) {
+        size_t width = (min(first + 4 * blockBytes, numSamples) - first + 3) / 4;
+        size_t bytes = count * width;
+        if (pread(scratch, &block[0], bytes, offset + j * width) != (ssize_t) bytes) {
+          throw string("Error reading BED scratch file: ") + strerror(errno);
+        }
+        for (size_t k = 0; k < count; k++) {
+          memcpy(&snpCalls[k * snpBytes + first / 4], &block[k * width], width);
+        }
+        offset += numProbes * width;
+      }
+      pb->write_packed_snps(&snpCalls[0], count);
+    }
+    close(scratch);
+  }
+  if (format == BED) {
+    pb->close();
+    delete pb;
+  } else {
+    bool error = ferror(outFile);
+    if (fclose(outFile) != 0 || error) throw "Error writing " + outfile;
+  }
+}
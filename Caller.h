@@ -0,0 +1,99 @@
+//
+// Caller.h
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _CALLER_H
+#define _CALLER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ClusterTable.h"
+#include "Manifest.h"
+#include "Sim.h"
+
+using namespace std;
+
+class Caller {
+ // Genotype calling from normalized intensities in a SIM file, using the
+ // cluster positions of an EGT file, without going back to GenomeStudio.
+ //
+ // Each probe is converted to Illumina (theta, R) coordinates, as for an
+ // FCR. Its distance to each of the AA, AB and BB clusters is measured in
+ // units of the cluster standard deviations, and the nearest cluster is the
+ // call. The score is 1 - sqrt(d1/d2), for the nearest and second nearest
+ // squared distances d1 and d2: 1 at a cluster mean, 0 halfway between two
+ // clusters. A score below the threshold is a no-call. Clusters with a
+ // missing or non-positive standard deviation are never called.
+ //
+ // Calls use the GTC codes: 0 = no call, 1 = AA, 2 = AB, 3 = BB.
+ //
+ // Probes are in the order of the manifest SNPs passed to the constructor,
+ // which must be that of the SIM file, i.e. sorted by position as in
+ // "simtools create"; each is looked up in the cluster table by its index.
+ //
+ // Output is a PLINK BED/BIM/FAM fileset in SNP-major mode, or a
+ // packed matrix with, in native byte order:
+ //   char[3]  magic "gt2"
+ //   uint8    version (1)
+ //   uint32   number of samples
+ //   uint32   number of probes
+ //   then for each sample, a name of Sim::SAMPLE_NAME_SIZE bytes, padded
+ //   with '\0', and (probes+3)/4 bytes holding four calls per byte, with
+ //   the first probe in the lowest two bits
+
+ public:
+  static const int BED = 0;
+  static const int MATRIX = 1;
+  static const uint8_t VERSION = 1;
+  static const long DEFAULT_MEMORY = 512; // megabytes, for BED output
+
+  Caller(ClusterTable *clusters, Manifest *manifest, double threshold);
+  void call(int n, const double x[], const double y[], uint8_t calls[],
+            double scores[]);
+  void write(Sim *sim, Manifest *manifest, string outfile, int format=BED,
+             int threads=1, bool verbose=false,
+             long memory=DEFAULT_MEMORY);
+
+ private:
+  // for each of AA, AB, BB: mean theta, 1/sd theta, mean R, 1/sd R, and 0,
+  // or infinity if the cluster is not to be called
+  static const int TERMS = 5;
+
+  double threshold;
+  long numProbes;
+  // TERMS values for each of the three clusters, each as an array over
+  // probes, so the calling loop reads every array with unit stride
+  vector<double> model;
+
+  static void nearest(long n, const double *__restrict theta,
+                      const double *__restrict r,
+                      const double *__restrict model, long stride,
+                      double *__restrict best, double *__restrict score);
+};
+
+#endif	// _CALLER_H
@@ -0,0 +1,219 @@
+//
+// ClusterEstimator.cpp
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "ClusterEstimator.h"
+#include "Fcr.h"
+#include "Gtc.h"
+
+using namespace std;
+
+ClusterEstimator::ClusterEstimator(Manifest *manifest, int threads) {
+  // manifest SNPs must be in the order of the SIM file
+  this->threads = threads < 1 ? 1 : threads;
+  samples = 0;
+  numProbes = manifest->snps.size();
+  gtcIndex.resize(numProbes);
+  for (long i = 0; i < numProbes; i++) {
+    gtcIndex[i] = manifest->snps[i].index - 1;
+  }
+  accumulators.resize(this->threads);
+  long entries = ClusterTable::GENOTYPES_PER_SNP * numProbes;
+  for (int t = 0; t < this->threads; t++) {
+    accumulators[t].count.assign(entries, 0);
+    accumulators[t].meanTheta.assign(entries, 0.0);
+    accumulators[t].m2Theta.assign(entries, 0.0);
+    accumulators[t].meanR.assign(entries, 0.0);
+    accumulators[t].m2R.assign(entries, 0.0);
+  }
+}
+
+void ClusterEstimator::add(Sim *sim, vector<string> gtcfiles, bool verbose) {
+  // accumulate every sample of the SIM file, with calls from gtcfiles
+  if (sim->numChannels != 2) {
+    throw("simtools can only handle SIM files with exactly 2 channels at present");
+  }
+  if (sim->numProbes != (unsigned long) numProbes) {
+    ostringstream msg;
+    msg << "Size mismatch: SIM file contains " << sim->numProbes
+        << " probes, but manifest contains " << numProbes << " probes.";
+    throw msg.str();
+  }
+  if (gtcfiles.size() != sim->numSamples) {
+    ostringstream msg;
+    msg << "Size mismatch: SIM file contains " << sim->numSamples
+        << " samples, but " << gtcfiles.size() << " GTC files were given.";
+    throw msg.str();
+  }
+
+  // samples are read in batches of one per thread, and each thread adds
+  // its sample to its own accumulator
+  vector<vector<double> > x(threads, vector<double>(numProbes));
+  vector<vector<double> > y(threads, vector<double>(numProbes));
+  vector<string> errors(threads);
+  char *sampleName = new char[sim->sampleNameSize + 1];
+  vector<float> intensity_float(sim->sampleIntensityTotal);
+  vector<uint16_t> intensity_int(sim->sampleIntensityTotal);
+  for (unsigned long first = 0; first < sim->numSamples; first += threads) {
+    int batch = min((unsigned long) threads, sim->numSamples - first);
+    for (int b = 0; b < batch; b++) {
+      if (sim->numberFormat == Sim::FLOAT) {
+        sim->getNextRecord(sampleName, &intensity_float[0], true);
+        for (long i = 0; i < numProbes; i++) {
+          x[b][i] = intensity_float[2*i];
+          y[b][i] = intensity_float[2*i + 1];
+        }
+      } else {
+        sim->getNextRecord(sampleName, &intensity_int[0]);
+        for (long i = 0; i < numProbes; i++) {
+          x[b][i] = intensity_int[2*i];
+          y[b][i] = intensity_int[2*i + 1];
+        }
+      }
+      if (verbose) {
+        cerr << "Adding sample " << first + b + 1 << " of "
+             << sim->numSamples << ": " << sampleName << endl;
+      }
+    }
+    vector<thread> workers;
+    for (int b = 0; b < batch; b++) {
+      workers.push_back(thread(&ClusterEstimator::addSample, this, b,
+                               &x[b][0], &y[b][0], gtcfiles[first + b],
+                               &errors[b]));
+    }
+    for (int b = 0; b < batch; b++) workers[b].join();
+    for (int b = 0; b < batch; b++) {
+      if (!errors[b].empty()) {
+        delete [] sampleName;
+        throw errors[b];
+      }
+    }
+    samples += batch;
+  }
+  delete [] sampleName;
+}
+
+void ClusterEstimator::addSample(int slot, const double x[], const double y[],
+                                 string gtcfile, string *error) {
+  // Welford update of the accumulator in the given slot, for one sample;
+  // runs in a worker thread, so errors are returned and not thrown
+  Gtc gtc;
+  gtc.open(gtcfile, Gtc::GENOTYPES);
+  if (!gtc.errorMsg.empty()) {
+    *error = gtc.errorMsg;
+    return;
+  }
+  long gtcTotal = gtc.genotypes.size();
+  vector<double> theta(numProbes);
+  vector<double> r(numProbes);
+  FcrWriter fcrWriter;
+  fcrWriter.illuminaCoordinates(numProbes, x, y, &theta[0], &r[0]);
+  Accumulator &acc = accumulators[slot];
+  for (long i = 0; i < numProbes; i++) {
+    long index = gtcIndex[i];
+    if (index < 0 || index >= gtcTotal) {
+      ostringstream msg;
+      msg << "Manifest index " << index + 1 << " is outside the "
+          << gtcTotal << " genotypes of GTC file " << gtcfile;
+      *error = msg.str();
+      return;
+    }
+    int genotype = gtc.genotypes[index];
+    if (genotype < 1 || genotype > 3) continue; // no call
+    if (!isfinite(theta[i]) || !isfinite(r[i])) continue;
+    long k = (genotype - 1) * numProbes + i;
+    uint32_t n = ++acc.count[k];
+    double delta = theta[i] - acc.meanTheta[k];
+    acc.meanTheta[k] += delta / n;
+    acc.m2Theta[k] += delta * (theta[i] - acc.meanTheta[k]);
+    delta = r[i] - acc.meanR[k];
+    acc.meanR[k] += delta / n;
+    acc.m2R[k] += delta * (r[i] - acc.meanR[k]);
+  }
+}
+
+void ClusterEstimator::merge(Accumulator &into, const Accumulator &from) {
+  // combine the statistics of two disjoint sets of samples
+  long entries = ClusterTable::GENOTYPES_PER_SNP * numProbes;
+  for (long k = 0; k < entries; k++) {
+    double na = into.count[k];
+    double nb = from.count[k];
+    if (nb == 0) continue;
+    double n = na + nb;
+    double delta = from.meanTheta[k] - into.meanTheta[k];
+    into.meanTheta[k] += delta * nb / n;
+    into.m2Theta[k] += from.m2Theta[k] + delta * delta * na * nb / n;
+    delta = from.meanR[k] - into.meanR[k];
+    into.meanR[k] += delta * nb / n;
+    into.m2R[k] += from.m2R[k] + delta * delta * na * nb / n;
+    into.count[k] += from.count[k];
+  }
+}
+
+long ClusterEstimator::update(ClusterTable *clusters) {
+  // write the new estimates into the cluster table; returns the number of
+  // clusters changed
+  for (int t = 1; t < threads; t++) {
+    merge(accumulators[0], accumulators[t]);
+    fill(accumulators[t].count.begin(), accumulators[t].count.end(), 0);
+    fill(accumulators[t].meanTheta.begin(), accumulators[t].meanTheta.end(), 0);
+    fill(accumulators[t].m2Theta.begin(), accumulators[t].m2Theta.end(), 0);
+    fill(accumulators[t].meanR.begin(), accumulators[t].meanR.end(), 0);
+    fill(accumulators[t].m2R.begin(), accumulators[t].m2R.end(), 0);
+  }
+  Accumulator &acc = accumulators[0];
+  long changed = 0;
+  float params[ClusterTable::PARAMS_PER_SNP];
+  for (long i = 0; i < numProbes; i++) {
+    long index = gtcIndex[i];
+    if (index < 0 || index >= clusters->snpTotal) {
+      ostringstream msg;
+      msg << "Manifest index " << index + 1
+          << " is outside the cluster table";
+      throw msg.str();
+    }
+    // order of params is devR, meanR, devTheta, meanTheta for AA, AB, BB
+    clusters->getClusters(index, params);
+    for (int g = 0; g < ClusterTable::GENOTYPES_PER_SNP; g++) {
+      long k = g * numProbes + i;
+      uint32_t n = acc.count[k];
+      if (n < (uint32_t) MIN_SAMPLES) continue;
+      params[g] = sqrt(acc.m2R[k] / (n - 1));
+      params[3 + g] = acc.meanR[k];
+      params[6 + g] = sqrt(acc.m2Theta[k] / (n - 1));
+      params[9 + g] = acc.meanTheta[k];
+      changed++;
+    }
+    clusters->setClusters(index, params);
+  }
+  return changed;
+}
@@ -0,0 +1,86 @@
+//
+// ClusterEstimator.h
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _CLUSTERESTIMATOR_H
+#define _CLUSTERESTIMATOR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ClusterTable.h"
+#include "Manifest.h"
+#include "Sim.h"
+
+using namespace std;
+
+class ClusterEstimator {
+ // Re-estimation of cluster positions from a batch of samples: the
+ // normalized intensities of a SIM file, with the genotype calls of the
+ // GTC files it was created from, in the same sample order.
+ //
+ // Samples are streamed once. For each genotype of each SNP, a count and
+ // the running mean and sum of squared deviations of theta and R are kept
+ // by Welford's method. Each thread has its own accumulators, held as
+ // separate arrays over SNPs, and these are combined at the end by the
+ // pairwise formula of Chan, Golub and LeVeque. Memory is proportional to
+ // SNPs times threads, whatever the number of samples.
+ //
+ // update() replaces the means and standard deviations of a ClusterTable
+ // for every cluster with at least MIN_SAMPLES calls; other clusters keep
+ // their previous values.
+
+ public:
+  static const int MIN_SAMPLES = 3;
+
+  ClusterEstimator(Manifest *manifest, int threads=1);
+  void add(Sim *sim, vector<string> gtcfiles, bool verbose=false);
+  long update(ClusterTable *clusters);
+
+  long samples;
+
+ private:
+  // one accumulator per thread; entry (genotype-1)*numProbes + probe
+  struct Accumulator {
+    vector<uint32_t> count;
+    vector<double> meanTheta;
+    vector<double> m2Theta;
+    vector<double> meanR;
+    vector<double> m2R;
+  };
+
+  int threads;
+  long numProbes;
+  vector<long> gtcIndex; // index in GTC and cluster table of each SIM probe
+  vector<Accumulator> accumulators;
+
+  void addSample(int slot, const double x[], const double y[],
+                 string gtcfile, string *error);
+  void merge(Accumulator &into, const Accumulator &from);
+};
+
+#endif	// _CLUSTERESTIMATOR_H
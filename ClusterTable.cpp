@@ -0,0 +1,303 @@
+//
+// ClusterTable.cpp
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ClusterTable.h"
+
+using namespace std;
+
+ClusterTable::ClusterTable(bool verbose) {
+  this->verbose = verbose;
+  snpTotal = 0;
+  missing = 0;
+  unmatched = 0;
+  params = NULL;
+  mapped = NULL;
+  mappedSize = 0;
+}
+
+void ClusterTable::build(Egt *egt, Manifest *manifest) {
+  // hash join of EGT records to manifest SNPs on SNP name, probing the
+  // name index built by Manifest::open()
+  close();
+  snpTotal = manifest->snps.size();
+  owned.assign(snpTotal * PARAMS_PER_SNP, NAN);
+  vector<bool> found(snpTotal, false);
+  for (long i = 0; i < egt->snpTotal; i++) {
+    string name = egt->getSnpName(i);
+    int j = manifest->snp2idx((char *) name.c_str());
+    if (j < 0) {
+      unmatched++;
+    } else if (!found[j]) { // for a duplicate EGT name, first record is used
+      egt->getClusters(i, &owned[j * PARAMS_PER_SNP]);
+      found[j] = true;
+    }
+  }
+  string example;
+  for (long j = 0; j < snpTotal; j++) {
+    if (found[j]) continue;
+    // a duplicate manifest name is indexed only once; copy that entry
+    int k = manifest->snp2idx((char *) manifest->snps[j].name.c_str());
+    if (k >= 0 && found[k]) {
+      copy(&owned[k * PARAMS_PER_SNP], &owned[(k+1) * PARAMS_PER_SNP],
+           &owned[j * PARAMS_PER_SNP]);
+      continue;
+    }
+    missing++;
+    if (example.empty()) example = manifest->snps[j].name;
+    if (j < egt->snpTotal) egt->getClusters(j, &owned[j * PARAMS_PER_SNP]);
+  }
+  params = snpTotal > 0 ? &owned[0] : NULL;
+  if (missing > 0) {
+    cerr << "Warning: " << missing << " of " << snpTotal << " manifest SNPs, "
+         << "such as '" << example << "', not found by name in EGT file "
+         << egt->filename << "; using EGT record at same index" << endl;
+  }
+  if (verbose) {
+    cerr << unmatched << " of " << egt->snpTotal << " EGT SNPs not found "
+         << "in manifest" << endl;
+  }
+}
+
+void ClusterTable::close() {
+  // release the table, and the cache file mapping if any
+  owned.clear();
+  if (mapped) munmap(mapped, mappedSize);
+  mapped = NULL;
+  mappedSize = 0;
+  params = NULL;
+  snpTotal = 0;
+  missing = 0;
+  unmatched = 0;
+}
+
+void ClusterTable::getClusters(long index, float snp_params[]) {
+  // same order of params as Egt::getClusters()
+  const float *source = params + index*PARAMS_PER_SNP;
+  for (int j = 0; j < PARAMS_PER_SNP; j++) {
+    snp_params[j] = source[j];
+  }
+}
+
+void ClusterTable::getMeanR(long index, float means[]) {
+  const float *source = params + index*PARAMS_PER_SNP + GENOTYPES_PER_SNP;
+  for (int j = 0; j < GENOTYPES_PER_SNP; j++) {
+    means[j] = source[j];
+  }
+}
+
+void ClusterTable::getMeanTheta(long index, float means[]) {
+  const float *source = params + index*PARAMS_PER_SNP + 3*GENOTYPES_PER_SNP;
+  for (int j = 0; j < GENOTYPES_PER_SNP; j++) {
+    means[j] = source[j];
+  }
+}
+
+void ClusterTable::open(string egtfile, string manfile, Manifest *manifest,
+                        string cachefile) {
+  // load the table from cache, if given and up to date, or else build it
+  // from the EGT file and save it to the cache
+  close();
+  uint64_t egtSum = 0;
+  uint64_t manifestSum = 0;
+  char magic[3] = { };
+  FILE *in = fopen(egtfile.c_str(), "rb");
+  if (in) {
+    if (fread(magic, 1, 3, in) != 3) magic[0] = '\0';
+    fclose(in);
+  }
+  if (memcmp(magic, "clt", 3) == 0) {
+    // a saved table, not an EGT file
+    if (!readCache(egtfile, 0, checksum(manfile), manifest->snps.size())) {
+      throw "Cluster table " + egtfile + " is not for manifest " + manfile;
+    }
+    if (verbose) cerr << "Read cluster table from " << egtfile << endl;
+    return;
+  }
+  if (cachefile != "") {
+    egtSum = checksum(egtfile);
+    manifestSum = checksum(manfile);
+    if (readCache(cachefile, egtSum, manifestSum, manifest->snps.size())) {
+      if (verbose) cerr << "Read cluster table from " << cachefile << endl;
+      if (missing > 0) {
+        cerr << "Warning: " << missing << " of " << snpTotal << " manifest "
+             << "SNPs not found by name in EGT file " << egtfile
+             << "; using EGT record at same index" << endl;
+      }
+      return;
+    }
+  }
+  Egt *egt = new Egt();
+  egt->openMapped(egtfile);
+  build(egt, manifest);
+  egt->close();
+  delete egt;
+  if (cachefile != "") writeCache(cachefile, egtSum, manifestSum);
+}
+
+void ClusterTable::save(string filename, string manfile) {
+  // save the table on its own, to be given in place of an EGT file
+  if (!writeTable(filename, 0, checksum(manfile))) {
+    throw "Cannot write cluster table " + filename + ": " + strerror(errno);
+  }
+  if (verbose) cerr << "Wrote cluster table to " << filename << endl;
+}
+
+void ClusterTable::setClusters(long index, const float snp_params[]) {
+  // same order of params as Egt::getClusters(); a table mapped from a
+  // cache is first copied, so the cache file is never changed
+  if (mapped) {
+    owned.assign(params, params + snpTotal * PARAMS_PER_SNP);
+    munmap(mapped, mappedSize);
+    mapped = NULL;
+    mappedSize = 0;
+    params = &owned[0];
+  }
+  float *dest = &owned[index*PARAMS_PER_SNP];
+  for (int j = 0; j < PARAMS_PER_SNP; j++) {
+    dest[j] = snp_params[j];
+  }
+}
+
+uint64_t ClusterTable::checksum(string filename) {
+  // 64-bit FNV-1a hash of the file contents
+  uint64_t hash = 14695981039346656037ULL;
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  struct stat status;
+  if (fd < 0 || fstat(fd, &status) != 0) {
+    if (fd >= 0) ::close(fd);
+    throw "Cannot open " + filename + " for checksum: " + strerror(errno);
+  }
+  size_t size = status.st_size;
+  if (size > 0) {
+    void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      ::close(fd);
+      throw "Cannot map " + filename + " for checksum: " + strerror(errno);
+    }
+    madvise(addr, size, MADV_SEQUENTIAL);
+    const unsigned char *data = (const unsigned char *) addr;
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    munmap(addr, size);
+  }
+  ::close(fd);
+  return hash;
+}
+
+bool ClusterTable::readCache(string cachefile, uint64_t egtSum,
+                             uint64_t manifestSum, long numSnps) {
+  // map the cache file, if it exists and matches the given inputs
+  int fd = ::open(cachefile.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat status;
+  size_t expected = HEADER_BYTES + numSnps * PARAMS_PER_SNP * sizeof(float);
+  if (fstat(fd, &status) != 0 || (size_t) status.st_size != expected) {
+    ::close(fd);
+    return false;
+  }
+  void *addr = mmap(NULL, expected, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) return false;
+  const char *header = (const char *) addr;
+  uint32_t snps32, missing32, unmatched32;
+  uint64_t egtSum64, manifestSum64;
+  memcpy(&snps32, header + 4, 4);
+  memcpy(&egtSum64, header + 8, 8);
+  memcpy(&manifestSum64, header + 16, 8);
+  memcpy(&missing32, header + 24, 4);
+  memcpy(&unmatched32, header + 28, 4);
+  if (memcmp(header, "clt", 3) != 0 || (uint8_t) header[3] != VERSION ||
+      snps32 != numSnps || egtSum64 != egtSum ||
+      manifestSum64 != manifestSum) {
+    munmap(addr, expected);
+    return false;
+  }
+  mapped = (char *) addr;
+  mappedSize = expected;
+  params = (const float *) (mapped + HEADER_BYTES);
+  snpTotal = numSnps;
+  missing = missing32;
+  unmatched = unmatched32;
+  return true;
+}
+
+void ClusterTable::writeCache(string cachefile, uint64_t egtSum,
+                              uint64_t manifestSum) {
+  // failure only means the next run has to build again
+  if (!writeTable(cachefile, egtSum, manifestSum)) {
+    cerr << "Warning: cannot write cluster cache " << cachefile << ": "
+         << strerror(errno) << endl;
+  } else if (verbose) {
+    cerr << "Wrote cluster table to " << cachefile << endl;
+  }
+}
+
+bool ClusterTable::writeTable(string filename, uint64_t egtSum,
+                              uint64_t manifestSum) {
+  // write to a temporary file and rename, so a reader never sees a
+  // partial table; on failure, errno is set and false returned
+  string tempfile = filename + ".XXXXXX";
+  vector<char> path(tempfile.begin(), tempfile.end());
+  path.push_back('\0');
+  int fd = mkstemp(&path[0]);
+  if (fd < 0) return false;
+  fchmod(fd, 0644);
+  char header[HEADER_BYTES] = { };
+  uint32_t snps32 = snpTotal;
+  uint32_t missing32 = missing;
+  uint32_t unmatched32 = unmatched;
+  memcpy(header, "clt", 3);
+  header[3] = VERSION;
+  memcpy(header + 4, &snps32, 4);
+  memcpy(header + 8, &egtSum, 8);
+  memcpy(header + 16, &manifestSum, 8);
+  memcpy(header + 24, &missing32, 4);
+  memcpy(header + 28, &unmatched32, 4);
+  size_t bytes = snpTotal * PARAMS_PER_SNP * sizeof(float);
+  bool ok = write(fd, header, HEADER_BYTES) == HEADER_BYTES &&
+    (bytes == 0 || write(fd, params, bytes) == (ssize_t) bytes);
+  ok = (::close(fd) == 0) && ok;
+  if (ok) ok = rename(&path[0], filename.c_str()) == 0;
+  if (!ok) {
+    int error = errno;
+    unlink(&path[0]);
+    errno = error;
+  }
+  return ok;
+}
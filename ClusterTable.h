@@ -0,0 +1,99 @@
+//
+// ClusterTable.h
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _CLUSTERTABLE_H
+#define _CLUSTERTABLE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Egt.h"
+#include "Manifest.h"
+
+using namespace std;
+
+class ClusterTable {
+ // EGT cluster parameters rearranged into manifest order, so that entry j
+ // is for manifest SNP j.
+ //
+ // EGT records are matched to manifest SNPs by name. A manifest SNP whose
+ // name is not in the EGT falls back to the record at the same index, as
+ // was always assumed before, and is counted in 'missing'.
+ //
+ // The table may be saved to a cache file, keyed by checksums of the EGT
+ // and manifest, and mapped into memory by later runs with the same
+ // inputs. Cache format, in native byte order:
+ //   char[3]  magic "clt"
+ //   uint8    version (1)
+ //   uint32   number of SNPs
+ //   uint64   checksum of EGT file
+ //   uint64   checksum of manifest file
+ //   uint32   number of missing SNPs
+ //   uint32   number of unmatched SNPs
+ //   float32  Egt::getClusters() params for each SNP, in manifest order
+ //
+ // A table may also be saved on its own, as by "simtools recluster", with
+ // an EGT checksum of 0. Such a table can be given in place of the EGT
+ // file, and is used as it stands if its manifest checksum matches.
+
+ public:
+  static const int PARAMS_PER_SNP = 12;
+  static const int GENOTYPES_PER_SNP = 3;
+  static const uint8_t VERSION = 1;
+  static const int HEADER_BYTES = 32;
+
+  ClusterTable(bool verbose=false);
+  void build(Egt *egt, Manifest *manifest);
+  void close();
+  void getClusters(long index, float snp_params[]);
+  void getMeanR(long index, float means[]);
+  void getMeanTheta(long index, float means[]);
+  void open(string egtfile, string manfile, Manifest *manifest,
+            string cachefile="");
+  void save(string filename, string manfile);
+  void setClusters(long index, const float snp_params[]);
+  static uint64_t checksum(string filename);
+
+  bool verbose;
+  long snpTotal;
+  long missing;   // manifest SNPs not found by name in the EGT
+  long unmatched; // EGT SNPs not found by name in the manifest
+
+ private:
+  const float *params; // table, either in 'owned' or in a mapped cache
+  vector<float> owned;
+  char *mapped;
+  size_t mappedSize;
+
+  bool readCache(string cachefile, uint64_t egtSum, uint64_t manifestSum,
+                 long numSnps);
+  void writeCache(string cachefile, uint64_t egtSum, uint64_t manifestSum);
+  bool writeTable(string filename, uint64_t egtSum, uint64_t manifestSum);
+};
+
+#endif	// _CLUSTERTABLE_H
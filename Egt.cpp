@@ -49,9 +49,15 @@ needed for FCR output)
  * - R is a "Manhattan distance", not Euclidean distance
  */
 
+#include <cerrno>
+#include <cstring>
 #include <string> 
 #include <iostream>
 #include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "Egt.h"
 
 using namespace std;
@@ -65,6 +71,28 @@ Egt::Egt(bool verbose)
   ENTRIES_IN_RECORD = 30;
   BYTES_IN_RECORD = NUMERIC_BYTES * ENTRIES_IN_RECORD;
   ENTRIES_TO_USE = 15;
+  counts = NULL;
+  params = NULL;
+  mapped = NULL;
+  mappedSize = 0;
+  records = NULL;
+  nameTable = NULL;
+}
+
+void Egt::close()
+{
+  // release cluster data, and the file mapping if any
+  delete [] counts;
+  delete [] params;
+  snpNames.clear();
+  counts = NULL;
+  params = NULL;
+  if (mapped) munmap(mapped, mappedSize);
+  mapped = NULL;
+  mappedSize = 0;
+  records = NULL;
+  nameTable = NULL;
+  nameOffsets.clear();
 }
 
 void Egt::open(string filename)
@@ -108,7 +136,6 @@ void Egt::open(string filename)
 
   delete [] block;
 
-  snpNames = new string[snpTotal];
   readSNPNames(file, snpNames);
   file.close();
 }
@@ -119,6 +146,73 @@ void Egt::open(char *filename)
   open(f);
 }
 
+void Egt::openMapped(string filename)
+{
+  // alternative to open(), which maps the file into memory instead of
+  // reading it; cluster records are used in place if they are 4-byte
+  // aligned, or else copied in bulk to the counts and params arrays, and
+  // SNP names are not decoded until getSnpName() is called
+  close();
+  this->filename = filename;
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  struct stat status;
+  if (fd < 0 || fstat(fd, &status) != 0) {
+    cerr << "Can't open file: " << filename << endl << flush;
+    exit(1);
+  }
+  mappedSize = status.st_size;
+  if (mappedSize > 0) {
+    void *addr = mmap(NULL, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      ::close(fd);
+      throw("Cannot map EGT file " + filename + ": " + strerror(errno));
+    }
+    mapped = (char *) addr;
+  }
+  ::close(fd);
+
+  // read header and preface data, as in readHeader() and readPreface()
+  const char *pos = mapped;
+  fileVersion = scanInteger(pos);
+  gcVersion = scanString(pos, "GC version");
+  clusterVersion = scanString(pos, "Cluster version");
+  callVersion = scanString(pos, "Call version");
+  normalizationVersion = scanString(pos, "Normalization version");
+  dateCreated = scanString(pos, "Date created");
+  if (pos + 1 > mapped + mappedSize) {
+    throw("Cannot read mode from EGT file, unexpected end of file");
+  }
+  mode = *pos++;
+  manifest = scanString(pos, "Manifest name");
+  dataVersion = scanInteger(pos);
+  opa = scanString(pos, "OPA");
+  snpTotal = scanInteger(pos);
+  if (verbose) {
+    printHeader();
+    printPreface();
+  }
+
+  // cluster data; see open() for the record layout
+  size_t recordBytes = (size_t) BYTES_IN_RECORD * snpTotal;
+  if (snpTotal < 0 || recordBytes > (size_t) (mapped + mappedSize - pos)) {
+    throw("Cannot read cluster records from EGT file, unexpected end of file");
+  }
+  if ((pos - mapped) % NUMERIC_BYTES == 0) {
+    records = pos;
+  } else {
+    counts = new int[GENOTYPES_PER_SNP*snpTotal];
+    params = new float[PARAMS_PER_SNP*snpTotal];
+    for (long i=0; i<snpTotal; i++) {
+      const char *record = pos + i*BYTES_IN_RECORD;
+      memcpy(&counts[i*GENOTYPES_PER_SNP], record,
+             GENOTYPES_PER_SNP*NUMERIC_BYTES);
+      memcpy(&params[i*PARAMS_PER_SNP], record + GENOTYPES_PER_SNP*NUMERIC_BYTES,
+             PARAMS_PER_SNP*NUMERIC_BYTES);
+    }
+  }
+  nameTable = pos + recordBytes;
+}
+
 
 int* Egt::bytesToInts(char block[], int start, int end) {
   // convert a section of a byte array into ints
@@ -151,39 +245,75 @@ float* Egt::bytesToFloats(char block[], int start, int end) {
 void Egt::getClusters(long index, float snp_params[]) {
   // return all (theta, R) params for given position in the SNP manifest
   // includes s.d. and mean of (r, theta) for AA, AB, BB
-  int start = index*PARAMS_PER_SNP;
+  const float *source;
+  if (records) {
+    source = (const float *) (records + index*BYTES_IN_RECORD)
+      + GENOTYPES_PER_SNP;
+  } else {
+    source = this->params + index*PARAMS_PER_SNP;
+  }
   for (int j=0; j < PARAMS_PER_SNP; j++) {
-    snp_params[j] = this->params[start + j];
+    snp_params[j] = source[j];
+  }
+}
+
+void Egt::getCounts(long index, int snp_counts[]) {
+  // return the number of AA, AB, BB samples in the cluster for given index
+  const int *source;
+  if (records) {
+    source = (const int *) (records + index*BYTES_IN_RECORD);
+  } else {
+    source = this->counts + index*GENOTYPES_PER_SNP;
+  }
+  for (int j=0; j < GENOTYPES_PER_SNP; j++) {
+    snp_counts[j] = source[j];
   }
 }
 
 void Egt::getMeanR(long index, float means[]) {
   // find mean polar radius for AA, AB, BB at given index
-  int start = index*PARAMS_PER_SNP + GENOTYPES_PER_SNP;
+  const float *source;
+  if (records) {
+    source = (const float *) (records + index*BYTES_IN_RECORD)
+      + 2*GENOTYPES_PER_SNP;
+  } else {
+    source = this->params + index*PARAMS_PER_SNP + GENOTYPES_PER_SNP;
+  }
   for (int j=0; j < GENOTYPES_PER_SNP; j++) {
-    means[j] = this->params[start + j];
+    means[j] = source[j];
   }
 }
 
 void Egt::getMeanTheta(long index, float means[]) {
   // find mean polar angle for AA, AB, BB at given index
-  int start = index*PARAMS_PER_SNP + 3*GENOTYPES_PER_SNP;
+  const float *source;
+  if (records) {
+    source = (const float *) (records + index*BYTES_IN_RECORD)
+      + 4*GENOTYPES_PER_SNP;
+  } else {
+    source = this->params + index*PARAMS_PER_SNP + 3*GENOTYPES_PER_SNP;
+  }
   for (int j=0; j < GENOTYPES_PER_SNP; j++) {
-    means[j] = this->params[start + j];
+    means[j] = source[j];
+  }
+}
+
+string Egt::getSnpName(long index) {
+  // SNP name at given index; decoded on demand if opened with openMapped()
+  if (!snpNames.empty()) return snpNames[index];
+  if (nameOffsets.empty()) scanSNPNames();
+  if (index < 0 || index >= (long) nameOffsets.size()) {
+    throw("SNP index out of range for EGT file " + filename);
   }
+  const char *pos = mapped + nameOffsets[index];
+  return scanString(pos, "SNP name");
 }
 
 numericConverter Egt::getNextConverter(ifstream &file) {
   // convenience method to read the next few bytes into a union
   // can then use the union for numeric conversion
-  char * buffer;
-  buffer = new char[NUMERIC_BYTES];
-  file.read(buffer, NUMERIC_BYTES);
   numericConverter converter;
-  for (int i=0; i<NUMERIC_BYTES; i++) {
-    converter.ncChar[i] = buffer[i];
-  }
-  delete [] buffer;
+  file.read(converter.ncChar, NUMERIC_BYTES);
 
   return converter;
 }
@@ -224,7 +354,7 @@ void Egt::readPreface(ifstream &file) {
   snpTotal = readInteger(file);
 }
 
-void Egt::readSNPNames(ifstream &file, string names[]) {
+void Egt::readSNPNames(ifstream &file, NameArena &names) {
   // read SNP names from an EGT file
   // assumes file is positioned at end of cluster (mean, sd) data
   int pos = file.tellg();
@@ -234,10 +364,12 @@ void Egt::readSNPNames(ifstream &file, string names[]) {
     // length of strings is unknown, so must read each one and discard it
     readString(file, "genotype score");
   }
+  names.clear();
+  names.reserve(snpTotal, 16 * snpTotal);
   for (int i=0;i<snpTotal;i++) {
     stringstream sstream;
     sstream << "SNP name at index " << i;
-    names[i] = readString(file, sstream.str());
+    names.add(readString(file, sstream.str()));
   }
 }
 
@@ -272,6 +404,67 @@ string Egt::readString(ifstream &file, string name) {
   return result;
 }
 
+int Egt::scanInteger(const char *&pos) {
+  // read an integer from the mapped file, and advance past it
+  if (pos + NUMERIC_BYTES > mapped + mappedSize) {
+    throw("Cannot read integer from EGT file, unexpected end of file");
+  }
+  numericConverter converter;
+  memcpy(converter.ncChar, pos, NUMERIC_BYTES);
+  pos += NUMERIC_BYTES;
+  return converter.ncInt;
+}
+
+string Egt::scanString(const char *&pos, string name) {
+  // read a string from the mapped file, and advance past it
+  // same format and warnings as readString()
+  if (pos + 1 > mapped + mappedSize) {
+    throw("Cannot read length from EGT file, unexpected end of file");
+  }
+  int length = (unsigned char) *pos++;
+  if (length == 0) {
+    cerr << "Warning: String '" << name << "' has zero length." << endl;
+    return "";
+  }
+  if (pos + length > mapped + mappedSize) {
+    stringstream sstream;
+    sstream << "Cannot read string '" << name << \
+      "' from EGT file, unexpected end of file";
+    throw(sstream.str());
+  }
+  string result(pos, strnlen(pos, length));
+  pos += length;
+  return result;
+}
+
+void Egt::scanSNPNames() {
+  // find the offset of each SNP name in the mapped file
+  // as in readSNPNames(), skip SNP quality scores and genotype scores
+  const char *end = mapped + mappedSize;
+  const char *pos = nameTable;
+  if (13 * snpTotal > end - pos) {
+    throw("Cannot read SNP names from EGT file, unexpected end of file");
+  }
+  pos += 13 * snpTotal;
+  for (long i=0; i<snpTotal; i++) {
+    if (pos >= end) {
+      throw("Cannot read genotype score from EGT file, unexpected end of file");
+    }
+    pos += 1 + (unsigned char) *pos;
+  }
+  nameOffsets.resize(snpTotal);
+  for (long i=0; i<snpTotal; i++) {
+    if (pos >= end) {
+      throw("Cannot read SNP name from EGT file, unexpected end of file");
+    }
+    nameOffsets[i] = pos - mapped;
+    pos += 1 + (unsigned char) *pos;
+  }
+  if (pos > end) {
+    throw("Cannot read SNP name from EGT file, unexpected end of file");
+  }
+}
+
 void Egt::printHeader() {
   // convenience method to print file header
   cout << "FILE_VERSION " << fileVersion << endl;
@@ -34,6 +34,8 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include "NameIndex.h"
 
 using namespace std;
 
@@ -48,11 +50,15 @@ class Egt {
  public:
   Egt(bool verbose=false);
   //~Egt();
+  void close();
   void getClusters(long index, float params[]);
+  void getCounts(long index, int snp_counts[]);
   void getMeanR(long index, float means[]);
   void getMeanTheta(long index, float means[]);
+  string getSnpName(long index);
   void open(char *filename);
   void open(string filename);
+  void openMapped(string filename);
   void printHeader();
   void printPreface();
   string filename;
@@ -78,12 +84,22 @@ class Egt {
   string opa;
   long snpTotal;
   // arrays for numerical data
+  // openMapped() leaves these NULL if the records can be read in place;
+  // use getCounts() and getClusters() for access in either mode
   int *counts;
   float *params;
-  // array for SNP names
-  string *snpNames;
+  // SNP names, packed in one buffer; snpNames[i] is the i'th name
+  // empty after openMapped(); names are then decoded by getSnpName()
+  NameArena snpNames;
 
 private:
+  // file contents, if opened with openMapped()
+  char *mapped;
+  size_t mappedSize;
+  const char *records;   // cluster records, if 4-byte aligned in the file
+  const char *nameTable; // quality scores and string tables after records
+  vector<size_t> nameOffsets; // found on the first call to getSnpName()
+
   int* bytesToInts(char block[], int start, int end);
   float* bytesToFloats(char block[], int start, int end);
   numericConverter getNextConverter(ifstream &file);
@@ -91,8 +107,11 @@ private:
   int readInteger(ifstream &file);
   float readFloat(ifstream &file);
   void readPreface(ifstream &file);
-  void readSNPNames(ifstream &file, string names[]);
+  void readSNPNames(ifstream &file, NameArena &names);
   string readString(ifstream &file, string name="UNKNOWN_NAME");
+  int scanInteger(const char *&pos);
+  string scanString(const char *&pos, string name="UNKNOWN_NAME");
+  void scanSNPNames();
 
 };
 
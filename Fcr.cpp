@@ -44,20 +44,26 @@
 #include <string>
 #include "Egt.h"
 #include "Fcr.h"
+#include "FcrMath.h"
 #include "Gtc.h"
 
 using namespace std;
 
 const static double pi = 3.141593;
 
-FcrWriter::FcrWriter() {
-  // empty constructor
+FcrWriter::FcrWriter(bool fastMath) {
+  this->fastMath = fastMath;
 }
 
-double FcrWriter::BAF(double theta, Egt egt, long snpIndex) {
-  // estimate the B allele frequency by interpolating between known clusters
-  float *meanTheta = new float[egt.GENOTYPES_PER_SNP];
+double FcrWriter::BAF(double theta, Egt &egt, long snpIndex) {
+  // estimate the B allele frequency, for the cluster at an EGT index
+  float meanTheta[ClusterTable::GENOTYPES_PER_SNP];
   egt.getMeanTheta(snpIndex, meanTheta);
+  return BAF(theta, meanTheta);
+}
+
+double FcrWriter::BAF(double theta, const float meanTheta[]) {
+  // estimate the B allele frequency by interpolating between known clusters
   double baf;
   if (theta < meanTheta[0]) {
     baf = 0.0;
@@ -68,10 +74,27 @@ double FcrWriter::BAF(double theta, Egt egt, long snpIndex) {
   } else {
     baf = 0.5 + ((theta - meanTheta[1])/(meanTheta[2] - meanTheta[1]))*0.5;
   }
-  delete [] meanTheta;
   return baf;
 }
 
+void FcrWriter::bafLogR(ClusterTable *clusters, int n, const double theta[],
+                        const double r[], double baf[], double logR[]) {
+  // BAF and logR for all probes of a sample, given theta and R in manifest
+  // order; does not depend on any member state apart from fastMath, so may
+  // be called concurrently for different samples
+  if (n == 0) return;
+  vector<double> ratio(n);
+  float meanR[ClusterTable::GENOTYPES_PER_SNP];
+  float meanTheta[ClusterTable::GENOTYPES_PER_SNP];
+  for (int j=0; j<n; j++) {
+    clusters->getMeanR(j, meanR);
+    clusters->getMeanTheta(j, meanTheta);
+    baf[j] = BAF(theta[j], meanTheta);
+    ratio[j] = r[j]/expectedR(theta[j], meanR, meanTheta);
+  }
+  log2(n, &ratio[0], logR);
+}
+
 // sanity check on manifest and gtc file
 void FcrWriter::compareNumberOfSNPs(Manifest *manifest, Gtc *gtc) {
   if (manifest->snps.size() != gtc->xRawIntensity.size()) {
@@ -94,6 +117,22 @@ void FcrWriter::illuminaCoordinates(double x, double y, double &theta, double &r
 
 }
 
+void FcrWriter::illuminaCoordinates(int n, const double x[], const double y[],
+                                    double theta[], double r[]) {
+  // array version of the above, for all probes of a sample at once
+  if (fastMath) {
+    FcrMath::atan2(n, y, x, theta);
+    for (int i=0; i<n; i++) {
+      theta[i] = theta[i]/(pi/2);
+      r[i] = x[i] + y[i];
+    }
+  } else {
+    for (int i=0; i<n; i++) {
+      illuminaCoordinates(x[i], y[i], theta[i], r[i]);
+    }
+  }
+}
+
 string FcrWriter::createHeader(string content, int samples, int snps) {
   // generate standard FCR header
   // content argument is typically the manifest name
@@ -135,30 +174,63 @@ string FcrWriter::createHeader(string content, int samples, int snps) {
   return header;
 }
 
-double FcrWriter::logR(double theta, double r, Egt egt, long snpIndex) {
-  // calculate the LogR metric for given (theta, r) of sample
-  // snpIndex is position in the manifest (starting from 0)
-  // get (theta, R) for AA, AB, BB from EGT and interpolate
-  // find intersection with (theta, R) of sample to get R_expected
-  float *meanR = new float[egt.GENOTYPES_PER_SNP];
-  float *meanTheta = new float[egt.GENOTYPES_PER_SNP];
+double FcrWriter::expectedR(double theta, Egt &egt, long snpIndex) {
+  // snpIndex is position in the EGT (starting from 0)
+  float meanR[ClusterTable::GENOTYPES_PER_SNP];
+  float meanTheta[ClusterTable::GENOTYPES_PER_SNP];
   egt.getMeanR(snpIndex, meanR);
   egt.getMeanTheta(snpIndex, meanTheta);
+  return expectedR(theta, meanR, meanTheta);
+}
+
+double FcrWriter::expectedR(double theta, const float meanR[],
+                            const float meanTheta[]) {
+  // get (theta, R) for AA, AB, BB from EGT and interpolate
+  // find intersection with (theta, R) of sample to get R_expected
+  int genotypes = ClusterTable::GENOTYPES_PER_SNP;
   double rExpected = 0.0;
-  for (int i=1; i<egt.GENOTYPES_PER_SNP; i++) {
-    if (theta < meanTheta[i] or i+1 == egt.GENOTYPES_PER_SNP) {
+  for (int i=1; i<genotypes; i++) {
+    if (theta < meanTheta[i] or i+1 == genotypes) {
       // m = gradient of interpolated line
       double m = (meanR[i] - meanR[i-1])/(meanTheta[i] - meanTheta[i-1]);
       rExpected = m * (theta - meanTheta[i-1]) + meanR[i-1];
       break;
     }
   }
-  delete [] meanR;
-  delete [] meanTheta;
-  return log2(r/rExpected);
+  return rExpected;
 }
 
-void FcrWriter::write(Egt *egt, Manifest *manifest, ostream *outStream,
+double FcrWriter::logR(double theta, double r, Egt &egt, long snpIndex) {
+  // calculate the LogR metric for given (theta, r) of sample
+  return std::log2(r/expectedR(theta, egt, snpIndex));
+}
+
+void FcrWriter::log2(int n, const double in[], double out[]) {
+  // base 2 logarithm of an array, with libm or FcrMath
+  if (fastMath) {
+    FcrMath::log2(n, in, out);
+  } else {
+    for (int i=0; i<n; i++) out[i] = std::log2(in[i]);
+  }
+}
+
+void FcrWriter::normalize(Manifest *manifest, Gtc *gtc,
+                          double x_norm[], double y_norm[]) {
+  // normalized intensities for all probes of a sample, in manifest order
+  double epsilon = 1e-6;
+  for (unsigned int j = 0; j < manifest->snps.size(); j++) {
+    // normIdMap already holds every normId, so this lookup never inserts
+    unsigned int norm_id = manifest->normIdMap[manifest->snps[j].normId];
+    XFormClass xf = gtc->XForm[norm_id];
+    xf.normalize(gtc->xRawIntensity[j], gtc->yRawIntensity[j],
+                 x_norm[j], y_norm[j]);
+    // correction of negative intensities, for consistency with GenomeStudio
+    if (x_norm[j] < epsilon) { x_norm[j] = 0.0; }
+    if (y_norm[j] < epsilon) { y_norm[j] = 0.0; }
+  }
+}
+
+void FcrWriter::write(ClusterTable *clusters, Manifest *manifest, ostream *outStream,
               vector<string> infiles, vector<string> sampleNames) {
   // 'main' method to generate FCR and write to given output stream
  Gtc *gtc = new Gtc();
@@ -168,25 +240,26 @@ void FcrWriter::write(Egt *egt, Manifest *manifest, ostream *outStream,
  double epsilon = 1e-6;
  // control determines which fields are read from GTC binary
  int control =  Gtc::XFORM | Gtc::INTENSITY | Gtc::SCORES | Gtc::BASECALLS;
+ // per-sample work arrays, so theta, R and logR are found in bulk
+ unsigned int numSnps = manifest->snps.size();
+ vector<double> x_norm(numSnps), y_norm(numSnps), theta(numSnps),
+   r(numSnps), baf(numSnps), logR(numSnps);
  for (unsigned int i = 0; i < infiles.size(); i++) {
     gtc->open(infiles[i], control);
     compareNumberOfSNPs(manifest, gtc);
     string sampleName;
     if (i < sampleNames.size()) sampleName = sampleNames[i];
     else sampleName = gtc->sampleName;
-    for (unsigned int j = 0; j < manifest->snps.size(); j++) {
+    if (numSnps > 0) {
+      normalize(manifest, gtc, &x_norm[0], &y_norm[0]);
+      illuminaCoordinates(numSnps, &x_norm[0], &y_norm[0], &theta[0], &r[0]);
+      bafLogR(clusters, numSnps, &theta[0], &r[0], &baf[0], &logR[0]);
+    }
+    for (unsigned int j = 0; j < numSnps; j++) {
       string snpName = manifest->snps[j].name;
       unsigned short x_raw = gtc->xRawIntensity[j];
       unsigned short y_raw = gtc->yRawIntensity[j];
       float score = gtc->scores[j];
-      double x_norm;
-      double y_norm;
-      unsigned int norm_id = manifest->normIdMap[manifest->snps[j].normId];
-      XFormClass xf = gtc->XForm[norm_id];
-      xf.normalize(x_raw, y_raw, x_norm, y_norm);
-      // correction of negative intensities, for consistency with GenomeStudio
-      if (x_norm < epsilon) { x_norm = 0.0; }
-      if (y_norm < epsilon) { y_norm = 0.0; }
       char buffer[500] = { }; // initialize to null values
       if (abs(x_raw) < epsilon || abs(y_raw) < epsilon ){
         // (effectively) zero intensity; set other fields to NaN
@@ -196,17 +269,12 @@ void FcrWriter::write(Egt *egt, Manifest *manifest, ostream *outStream,
                 int(x_raw), int(y_raw));
       } else {
         // output metrics to correct precision
-        double theta;
-        double r;
-        this->illuminaCoordinates(x_norm, y_norm, theta, r);
-        double logR = this->logR(theta, r, *egt, j);
-        double baf = this->BAF(theta, *egt, j);
         string format = string("%s\t%s\t%c\t%c\t%.4f\t%.3f\t%.3f\t%.3f\t%.3f")+
           string("\t%d\t%d\t%.4f\t%.4f\n");
         sprintf(buffer, format.c_str(), snpName.c_str(), 
                 sampleName.c_str(), gtc->baseCalls[j].a, gtc->baseCalls[j].b,
-                score, theta, r, x_norm, y_norm,
-                int(x_raw), int(y_raw), baf, logR);
+                score, theta[j], r[j], x_norm[j], y_norm[j],
+                int(x_raw), int(y_raw), baf[j], logR[j]);
       }
       *outStream << string(buffer);
     }
@@ -36,6 +36,7 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include "ClusterTable.h"
 #include "Egt.h"
 #include "Gtc.h"
 #include "Manifest.h"
@@ -45,13 +46,25 @@ using namespace std;
 class FcrWriter {
 
  public:
-  FcrWriter();
-  double BAF(double theta, Egt egt, long snpIndex);
+  FcrWriter(bool fastMath=false);
+  double BAF(double theta, Egt &egt, long snpIndex);
+  double BAF(double theta, const float meanTheta[]);
+  void bafLogR(ClusterTable *clusters, int n, const double theta[], const double r[], double baf[], double logR[]);
   void compareNumberOfSNPs(Manifest *manifest, Gtc *gtc);
   void illuminaCoordinates(double x, double y, double &theta, double &r);
+  void illuminaCoordinates(int n, const double x[], const double y[], double theta[], double r[]);
   string createHeader(string content, int samples, int snps);
-  double logR(double theta, double r, Egt egt, long snpIndex);
-  void write(Egt *egt, Manifest *manifest, ostream *outStream, vector<string> infiles, vector<string> sampleNames);
+  double expectedR(double theta, Egt &egt, long snpIndex);
+  double expectedR(double theta, const float meanR[], const float meanTheta[]);
+  double logR(double theta, double r, Egt &egt, long snpIndex);
+  void log2(int n, const double in[], double out[]);
+  void normalize(Manifest *manifest, Gtc *gtc, double x_norm[], double y_norm[]);
+  void write(ClusterTable *clusters, Manifest *manifest, ostream *outStream, vector<string> infiles, vector<string> sampleNames);
+
+  // if true, use the FcrMath approximations to atan2 and log2, instead of
+  // libm; output is then equal to that of the default at the printed
+  // precision, but not bit-identical in the unprinted digits
+  bool fastMath;
 
 };
 
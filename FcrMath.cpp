@@ -0,0 +1,180 @@
+//
+// FcrMath.cpp
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+/*
+ * FcrMath provides fast versions of the two libm functions on the FCR
+ * hot path: atan2(), for the Illumina theta coordinate, and log2(), for
+ * the LogR ratio. Both are evaluated with argument reduction followed by
+ * a short polynomial, in plain double arithmetic.
+ *
+ * atan2: the ratio t = min(|x|,|y|)/max(|x|,|y|) lies in [0,1]. It is
+ * reduced against the nearest c = k/8 using
+ *   atan(t) = atan(c) + atan((t-c)/(1+tc))
+ * which leaves an argument of at most 1/16, where eight terms of the
+ * Taylor series for atan are accurate to double precision. The octant is
+ * then restored from the signs and relative size of x and y.
+ *
+ * log2: the exponent and mantissa m are split from the IEEE bit pattern,
+ * with m brought into [sqrt(1/2), sqrt(2)). Then log(m) = 2 atanh(s),
+ * s = (m-1)/(m+1), |s| < 0.172, and twelve terms of the atanh series are
+ * accurate to double precision.
+ */
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include "FcrMath.h"
+
+using namespace std;
+
+const double *FcrMath::atanTable(void) {
+  // atan(k/ATAN_STEPS) for k = 0 .. ATAN_STEPS, taken from libm once
+  static const struct AtanTable {
+    double value[ATAN_STEPS + 1];
+    AtanTable() {
+      for (int k = 0; k <= ATAN_STEPS; k++) {
+        value[k] = std::atan((double) k / ATAN_STEPS);
+      }
+    }
+  } table;
+  return table.value;
+}
+
+inline bool FcrMath::atan2Valid(double y, double x) {
+  // polynomial is valid if both inputs are finite and one is normal
+  double ax = fabs(x);
+  double ay = fabs(y);
+  return ax <= DBL_MAX && ay <= DBL_MAX && (ax >= DBL_MIN || ay >= DBL_MIN);
+}
+
+inline double FcrMath::atan2Core(double y, double x, const double table[]) {
+  double ax = fabs(x);
+  double ay = fabs(y);
+  bool steep = ay > ax;
+  // arithmetic is unconditional and only the selects depend on the data,
+  // which keeps the loops in atan2() and log2() branch-free
+  double t = (steep ? ax : ay) / (steep ? ay : ax);
+  // nearest table point, rounded with the 1.5*2^52 trick; atan(c) is then
+  // picked with selects, as SSE2 has no gather instruction
+  double k = (t * ATAN_STEPS + 6755399441055744.0) - 6755399441055744.0;
+  double c = k / ATAN_STEPS;
+  double ac = table[0];
+  ac = k > 0.5 ? table[1] : ac;
+  ac = k > 1.5 ? table[2] : ac;
+  ac = k > 2.5 ? table[3] : ac;
+  ac = k > 3.5 ? table[4] : ac;
+  ac = k > 4.5 ? table[5] : ac;
+  ac = k > 5.5 ? table[6] : ac;
+  ac = k > 6.5 ? table[7] : ac;
+  ac = k > 7.5 ? table[8] : ac;
+  double u = (t - c) / (1.0 + t * c);
+  double u2 = u * u;
+  double p = -1.0/15.0;
+  p = p * u2 + 1.0/13.0;
+  p = p * u2 - 1.0/11.0;
+  p = p * u2 + 1.0/9.0;
+  p = p * u2 - 1.0/7.0;
+  p = p * u2 + 1.0/5.0;
+  p = p * u2 - 1.0/3.0;
+  p = p * u2 + 1.0;
+  double a = ac + u * p;
+  double b = M_PI_2 - a;
+  a = steep ? b : a;
+  b = M_PI - a;
+  a = x < 0 ? b : a;
+  return copysign(a, y);
+}
+
+inline bool FcrMath::log2Valid(double x) {
+  // polynomial is valid for positive, finite, normal inputs
+  return x >= DBL_MIN && x <= DBL_MAX;
+}
+
+inline double FcrMath::log2Core(double x) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  // exponent field as a double, via the 2^52 trick (no int conversion)
+  uint64_t ebits = (bits >> 52) | 0x4330000000000000ULL;
+  double e;
+  memcpy(&e, &ebits, sizeof(e));
+  e = e - 4503599627370496.0 - 1023.0;
+  // mantissa in [1,2), then halved if above sqrt(2)
+  uint64_t mbits = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+  double m;
+  memcpy(&m, &mbits, sizeof(m));
+  bool high = m > M_SQRT2;
+  m = m * (high ? 0.5 : 1.0);
+  e = e + (high ? 1.0 : 0.0);
+  double s = (m - 1.0) / (m + 1.0);
+  double s2 = s * s;
+  double p = 1.0/23.0;
+  p = p * s2 + 1.0/21.0;
+  p = p * s2 + 1.0/19.0;
+  p = p * s2 + 1.0/17.0;
+  p = p * s2 + 1.0/15.0;
+  p = p * s2 + 1.0/13.0;
+  p = p * s2 + 1.0/11.0;
+  p = p * s2 + 1.0/9.0;
+  p = p * s2 + 1.0/7.0;
+  p = p * s2 + 1.0/5.0;
+  p = p * s2 + 1.0/3.0;
+  p = p * s2 + 1.0;
+  return e + (2.0 * s * p) * M_LOG2E;
+}
+
+double FcrMath::atan2(double y, double x) {
+  if (!atan2Valid(y, x)) return std::atan2(y, x);
+  return atan2Core(y, x, atanTable());
+}
+
+double FcrMath::log2(double x) {
+  if (!log2Valid(x)) return std::log2(x);
+  return log2Core(x);
+}
+
+void FcrMath::atan2(int n, const double y[], const double x[], double out[]) {
+  double table[ATAN_STEPS + 1]; // local copy, so it can't alias out[]
+  memcpy(table, atanTable(), sizeof(table));
+  for (int i = 0; i < n; i++) {
+    out[i] = atan2Core(y[i], x[i], table);
+  }
+  // second pass for the (rare) inputs outside the polynomial's domain
+  for (int i = 0; i < n; i++) {
+    if (!atan2Valid(y[i], x[i])) out[i] = std::atan2(y[i], x[i]);
+  }
+}
+
+void FcrMath::log2(int n, const double in[], double out[]) {
+  for (int i = 0; i < n; i++) {
+    out[i] = log2Core(in[i]);
+  }
+  for (int i = 0; i < n; i++) {
+    if (!log2Valid(in[i])) out[i] = std::log2(in[i]);
+  }
+}
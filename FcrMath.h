@@ -0,0 +1,62 @@
+//
+// FcrMath.h
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _FCRMATH_H
+#define _FCRMATH_H
+
+using namespace std;
+
+class FcrMath {
+ // Polynomial replacements for the libm atan2() and log2() calls made for
+ // every (SNP, sample) pair when writing an FCR.
+ //
+ // The array methods are written as straight-line loops with no calls or
+ // data-dependent branches, so the compiler can vectorize them. Inputs the
+ // polynomials do not cover (zero, negative, subnormal, infinite or NaN
+ // values) are then patched with the libm result, so special values come
+ // out exactly as they would from libm.
+ //
+ // Error is a few units in the last place of a double, far below the 3-4
+ // decimal places printed in an FCR; FcrMathTest checks this against libm.
+
+ public:
+  static double atan2(double y, double x);
+  static double log2(double x);
+  static void atan2(int n, const double y[], const double x[], double out[]);
+  static void log2(int n, const double in[], double out[]);
+
+ private:
+  static const int ATAN_STEPS = 8; // table holds atan(k/ATAN_STEPS), k=0..8
+  static const double *atanTable(void);
+  static double atan2Core(double y, double x, const double table[]);
+  static double log2Core(double x);
+  static bool atan2Valid(double y, double x);
+  static bool log2Valid(double x);
+};
+
+#endif	// _FCRMATH_H
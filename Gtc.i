@@ -13,11 +13,16 @@
  #include "gtc_process.h"
  #include "Gtc.h"
  #include "Manifest.h"
+ #include "ManifestCache.h"
  #include "win2unix.h"
  %}
  
  /* Parse the header file to generate wrappers */
+ %ignore ManifestColumns;
+ %ignore RegionIndex;
+ %ignore ManifestCache::open;
  %include "Gtc.h"
  %include "Manifest.h"
+ %include "ManifestCache.h"
  %include "gtc_process.h"
  %include "win2unix.h"
@@ -35,16 +35,99 @@
 #include <iostream>
 #include <fstream>
 #include <map>
+#include <thread>
 #include <vector>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cerrno>
+#include <climits>
+#include <cmath>
 #include <string> 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 using namespace std;
 
 
+// Lookup tables for converting alleles to the TOP strand: the action
+// for each Illumina strand code, and the complement of each base
+struct StrandTables {
+  enum { UNKNOWN, COPY, COMPLEMENT };
+  char action[256];
+  char complement[256];
+
+  StrandTables() {
+    memset(action, UNKNOWN, sizeof(action));
+    action[(unsigned char) 'T'] = COPY;
+    action[(unsigned char) 'M'] = COPY;
+    action[(unsigned char) 'P'] = COPY;
+    action[(unsigned char) 'B'] = COMPLEMENT;
+    memset(complement, '?', sizeof(complement));
+    complement[(unsigned char) 'A'] = 'T';
+    complement[(unsigned char) 'C'] = 'G';
+    complement[(unsigned char) 'G'] = 'C';
+    complement[(unsigned char) 'T'] = 'A';
+  }
+};
+
+static const StrandTables STRAND_TABLES;
+
+static bool convert_alleles (snpClass* snip, const char* input_snp, size_t length);
+
+
+// Binary manifest cache, in native byte order: a CacheHeader, then,
+// each starting at a multiple of 8 bytes,
+//   the absolute path of the CSV file
+//   a CacheRecord for each SNP, in file order
+//   (key, value) int32 pairs of normIdMap
+//   uint32 slots of the name index; see NameIndex
+//   uint32 indexes of the SNPs in locus order
+//   the SNP names and chromosome names
+// The CSV file is identified by path, size, modification time and
+// FNV-1a hash of its contents; if only the time differs, the hash
+// decides whether the cache is still good.
+struct CacheHeader {
+  char magic[3];       // "mfc"
+  uint8_t version;
+  uint32_t flags;      // CACHE_WIDE, CACHE_BEADSETID
+  uint64_t csvSize;
+  int64_t csvTime;     // nanoseconds since the epoch
+  uint64_t csvHash;
+  uint32_t numSnps;
+  uint32_t numNormIds;
+  uint32_t numSlots;
+  uint32_t pathLength;
+  uint64_t stringBytes;
+};
+
+struct CacheRecord {
+  int64_t position;
+  float score;
+  int32_t index;
+  int32_t normId;
+  int32_t beadSetId;
+  uint32_t nameOffset;
+  uint32_t chromOffset;
+  uint16_t nameLength;
+  uint16_t chromLength;
+  char snp[2];
+  char iStrand;
+  char cStrand;
+  uint8_t converted;
+};
+
+static const uint8_t CACHE_VERSION = 1;
+static const uint32_t CACHE_WIDE = 1;
+static const uint32_t CACHE_BEADSETID = 2;
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t) 7; }
+
+
+
 ///////////////////////////
 //
 // Constructor
@@ -57,6 +140,10 @@ Manifest::Manifest(void)
 
   EXCLUDE_CNVS = false;
   hasBeadSetID = false;
+  selectedFields = ALL_FIELDS;
+
+  const char *cache = getenv("SIMTOOLS_MANIFEST_CACHE");
+  cachePath = cache == NULL ? "" : cache;
 
 #ifdef _DEBUG      // compile with g++ -D_DEBUG Manifest.cpp ...
   test_convert();
@@ -88,7 +175,7 @@ void Manifest::open (string filename, string chromosome, bool wide) {
   cout << "\nDEBUG: in chrom-specific open()..\n\n";
 #endif
 
-  this->selectedChromosome = chromosome;
+  if (!chromosome.empty()) select_chromosome(chromosome);
   open (filename, wide);
 
 }
@@ -99,31 +186,295 @@ void Manifest::open (string filename, string chromosome, bool wide) {
 //
 // void Manifest::open (string filename, bool wide = false;) 
 //
-// Open file and parse it one line at a time.
+// Map the file into memory and parse it: a .bpm.csv or
+// wide CSV manifest with parse_csv(), or a binary .bpm
+// manifest, recognised by its "BPM" magic, with
+// parse_bpm(). Fields are read in place from the mapped
+// file. SNPs are stored in file order, as if the file had
+// been read one record at a time.
 //
 /////////////////////////////////////////
 
 void Manifest::open(string filename, bool wide) 
 {
-	string s;
-	ifstream file;
-
-	map<string, int> widecols; // Only used if opening a wide-format file.
-                               // Key = col. name; value = col. number (0 onwards).
+	// Only a whole manifest is cached
+	bool caching = cachePath != "" && snps.empty() && !EXCLUDE_CNVS &&
+	  selectedChromosomes.empty() && selectedRegions.empty() &&
+	  selectedNames.empty();
+	string path;
+	string cachefile;
+	if (caching) {
+	  char *real = realpath(filename.c_str(), NULL);
+	  caching = real != NULL;
+	  if (real != NULL) {
+		path = real;
+		free(real);
+		cachefile = cache_file(path);
+		if (read_cache(cachefile, path, wide)) {
+		  classify_probes();
+		  return;
+		}
+	  }
+	}
 
-	file.open(filename.c_str());
-	if (!file) {
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	struct stat status;
+	if (fd < 0 || fstat(fd, &status) != 0) {
 	  cout << "Can't open file: " << filename << endl << flush;
 		exit(1);
 	}
+	size_t size = status.st_size;
+	const char *data = "";
+	void *addr = NULL;
+	if (size > 0) {
+	  addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	  if (addr == MAP_FAILED) {
+		cout << "Can't open file: " << filename << endl << flush;
+		exit(1);
+	  }
+	  madvise(addr, size, MADV_SEQUENTIAL);
+	  data = (const char *) addr;
+	}
+	::close(fd);
+	const char *end = data + size;
+
+	int fields = caching ? (int) ALL_FIELDS : selectedFields;
+	vector<ParseChunk> parsed;
+	if ( size >= 3 && 0 == memcmp(data, "BPM", 3) ) {
+	  parsed.resize(1);
+	  parse_bpm(data, end, fields, &parsed[0]);
+	}
+	else {
+	  parse_csv(filename, data, end, wide, fields, parsed);
+	}
+	uint64_t hash = caching ? NameIndex::hash(data, size) : 0;
+	if (addr != NULL) munmap(addr, size);
+
+	size_t total = snps.size();
+	for (size_t c = 0; c < parsed.size(); c++) {
+	  if (!parsed[c].error.empty()) throw parsed[c].error;
+	  total += parsed[c].snps.size();
+	}
+	snps.reserve(total);
+	for (size_t c = 0; c < parsed.size(); c++) {
+	  for (size_t i = 0; i < parsed[c].snps.size(); i++) {
+		snps.push_back(std::move(parsed[c].snps[i]));
+	  }
+	  vector<snpClass>().swap(parsed[c].snps);
+	  for (set<int>::iterator id = parsed[c].normIds.begin();
+		   id != parsed[c].normIds.end(); id++) {
+		normIdMap[*id] = 1;
+	  }
+	}
+
+	map<int,int>::iterator i;
+	int n;
+      	for (n=0, i = normIdMap.begin(); i != normIdMap.end(); n++, i++) {
+		normIdMap[i->first] = n;
+	}
+
+	
+	populate_hashmap();
+	classify_probes();
+
+	if (caching) {
+	  int64_t time = status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+	  write_cache(cachefile, path, wide, size, time, hash);
+	}
+
+} // End of Manifest::open()
+
+
+
+//////////////////////////////////////////
+//
+// void Manifest::classify_probes()
+//
+// Find probeClasses and probeChromosomes, so that
+// counts and filters by class need no string
+// operations per SNP.
+//
+/////////////////////////////////////////
+
+void Manifest::classify_probes() {
+	size_t size = 0;
+	for (size_t i = 0; i < snps.size(); i++) {
+	  if (snps[i].index > 0) size = max(size, (size_t) snps[i].index);
+	}
+	probeClasses.assign(size, UNSELECTED_PROBE);
+	probeChromosomes.assign(size, 0);
+	chromosomeNames.clear();
+	for (size_t i = 0; i < snps.size(); i++) {
+	  const snpClass &snp = snps[i];
+	  if (snp.index <= 0) continue;
+	  int probeClass = 0;
+	  if (cnv_name(snp.name.data(), snp.name.size())) probeClass |= CNV_PROBE;
+	  if (snp.snp[0] == 'D' || snp.snp[0] == 'I') probeClass |= INDEL_PROBE;
+	  if (snp.snp[0] == 'N') probeClass |= INTENSITY_ONLY_PROBE;
+	  probeClasses[snp.index - 1] = probeClass;
+
+	  // SNPs of a chromosome are usually together
+	  size_t c = chromosomeNames.size();
+	  if (c == 0 || chromosomeNames[c - 1] != snp.chromosome) {
+		c = find(chromosomeNames.begin(), chromosomeNames.end(), snp.chromosome) -
+		  chromosomeNames.begin();
+		if (c == chromosomeNames.size()) chromosomeNames.push_back(snp.chromosome);
+	  }
+	  else {
+		c--;
+	  }
+	  probeChromosomes[snp.index - 1] = c;
+	}
+}
+
+// The test of a CNV probe for its class; exclude_cnvs() only drops
+// probes whose name begins with "cnv"
+bool Manifest::cnv_name(const char *name, size_t length) {
+	static const char cnv[] = "cnv";
+	return search(name, name + length, cnv, cnv + 3) != name + length;
+}
+
+int Manifest::chromosome_id(string chromosome) const {
+	size_t c = find(chromosomeNames.begin(), chromosomeNames.end(), chromosome) -
+	  chromosomeNames.begin();
+	return c < chromosomeNames.size() ? (int) c : -1;
+}
+
+// The loops have no branches, so the compiler can vectorize them
+void Manifest::count_passing(const vector<float> &scores, double cutOff, int exclude,
+							 long &pass, long &total, int chromosome) const {
+	// The least float not below cutOff, which a float score is at least
+	// if and only if it is at least cutOff
+	float floatCutOff = cutOff;
+	if (floatCutOff < cutOff) floatCutOff = nextafterf(floatCutOff, INFINITY);
+	size_t n = min(scores.size(), probeClasses.size());
+	const float *score = scores.data();
+	const uint8_t *classes = probeClasses.data();
+	const uint16_t *chromosomes = probeChromosomes.data();
+	uint8_t excluded = exclude;
+	long p = 0, t = 0;
+	if (chromosome < 0) {
+	  for (size_t i = 0; i < n; i++) {
+		int in = (classes[i] & excluded) == 0;
+		p += in & (score[i] >= floatCutOff);
+		t += in;
+	  }
+	}
+	else {
+	  uint16_t id = chromosome;
+	  for (size_t i = 0; i < n; i++) {
+		int in = ((classes[i] & excluded) == 0) & (chromosomes[i] == id);
+		p += in & (score[i] >= floatCutOff);
+		t += in;
+	  }
+	}
+
+	// Scores beyond the manifest are of no SNP in it
+	if (chromosome < 0 && !(exclude & UNSELECTED_PROBE)) {
+	  for (size_t i = n; i < scores.size(); i++) {
+		p += score[i] >= floatCutOff;
+		t++;
+	  }
+	}
+	pass = p;
+	total = t;
+}
+
+
+
+//////////////////////////////////////////
+//
+// void Manifest::parse_csv (...)
+//
+// Parse a .bpm.csv manifest, or a wide one, mapped
+// from 'data' to 'end': find the columns from the
+// header, then parse the lines in line-aligned
+// chunks, one thread per chunk. The chunks are
+// returned in file order.
+//
+/////////////////////////////////////////
+
+void Manifest::parse_csv(string filename, const char *data, const char *end,
+						 bool wide, int fields, vector<ParseChunk> &parsed)
+{
+	int cols[NUM_COLS];
+	const char *line;
+	const char *dataEnd;
+	parse_header(filename, data, end, wide, cols, line, dataEnd);
+
+	//
+	// OK, now ready to acquire data: split into chunks which
+	// start at the beginning of a line, and parse them in parallel
+	long chunks = (dataEnd - line) / MIN_CHUNK_BYTES;
+	long cores = thread::hardware_concurrency();
+	if (chunks > cores) chunks = cores;
+	if (chunks < 1) chunks = 1;
+	vector<const char *> bounds(chunks + 1, dataEnd);
+	bounds[0] = line;
+	for (long c = 1; c < chunks; c++) {
+	  const char *p = line + (dataEnd - line) * c / chunks;
+	  if (p < bounds[c-1]) p = bounds[c-1];
+	  const char *eol = (const char *) memchr(p, '\n', dataEnd - p);
+	  bounds[c] = eol == NULL ? dataEnd : eol + 1;
+	}
+	parsed.resize(chunks);
+	for (long c = 0; c < chunks; c++) {
+	  parsed[c].begin = bounds[c];
+	  parsed[c].end = bounds[c+1];
+	}
+	vector<thread> workers;
+	for (long c = 1; c < chunks; c++) {
+	  workers.push_back(thread(&Manifest::parse_lines, this, wide, cols,
+							   fields, &parsed[c]));
+	}
+	parse_lines(wide, cols, fields, &parsed[0]);
+	for (size_t w = 0; w < workers.size(); w++) workers[w].join();
+
+	// Without an index column, a SNP's index is its line number
+	// in the data, whether or not earlier SNPs were selected
+	if ( -1 == cols[INDEX_COL] ) {
+	  long lines = 0;
+	  for (long c = 0; c < chunks; c++) {
+		for (size_t i = 0; i < parsed[c].snps.size(); i++) {
+		  parsed[c].snps[i].index += lines;
+		}
+		lines += parsed[c].lines;
+	  }
+	}
+}
+
+
+
+//////////////////////////////////////////
+//
+// void Manifest::parse_header (...)
+//
+// Read the header of a CSV manifest mapped from
+// 'data' to 'end', and set the column number of
+// each field in 'cols', or -1 if it is absent.
+// The data lines are from 'line' to 'dataEnd'.
+//
+/////////////////////////////////////////
+
+void Manifest::parse_header(string filename, const char *data, const char *end,
+							bool wide, int cols[], const char *&line,
+							const char *&dataEnd)
+{
+	map<string, int> widecols; // Only used if opening a wide-format file.
+                               // Key = col. name; value = col. number (0 onwards).
 
 	// Deal with header line(s).
+	line = data;
+	string s;
 	if ( wide ) {
 	  bool gotcols = false;
 	  string findme = "IlmnID";
-	  while ( getline(file,s) ) {
+	  while ( line < end ) {
+		const char *eol = (const char *) memchr(line, '\n', end - line);
+		if (eol == NULL) eol = end;
+		s.assign(line, eol - line);
+		line = eol < end ? eol + 1 : end;
 		if ( s.find(findme) != string::npos ) {
-		  cout << "\nDBG: got column header line.";
 		  gotcols = find_wide_columns(s, widecols);
 		  break;
 		}
@@ -135,26 +486,26 @@ void Manifest::open(string filename, bool wide)
 	  }
 	}
 	else {
-	  getline(file,s);
+	  const char *eol = (const char *) memchr(line, '\n', end - line);
+	  if (eol == NULL) eol = end;
+	  s.assign(line, eol - line);
+	  line = eol < end ? eol + 1 : end;
 	}
 
 
 	// Set up column numbers. Numbers will be -1 if not found/not available.
-	int INDEX_COL, NAME_COL, CHROM_COL, POS_COL, SCORE_COL, SNP_COL, 
-	  I_COL, C_COL, NORMID_COL, BEADSETID_COL;
-
 	if ( wide ) {
 
-	  INDEX_COL     = get_map_value(widecols, "Index");          // Probably -1
-	  NAME_COL      = get_map_value(widecols, "Name");
-	  CHROM_COL     = get_map_value(widecols, "Chr");
-	  POS_COL       = get_map_value(widecols, "MapInfo");
-	  SCORE_COL     = get_map_value(widecols, "GenTrain Score"); // Probably -1
-      SNP_COL       = get_map_value(widecols, "SNP");
-	  I_COL         = get_map_value(widecols, "IlmnStrand");
-	  C_COL         = get_map_value(widecols, "SourceStrand");
-	  NORMID_COL    = get_map_value(widecols, "NormID");         // Probably -1 
-	  BEADSETID_COL = get_map_value(widecols, "BeadSetID");
+	  cols[INDEX_COL]     = get_map_value(widecols, "Index");          // Probably -1
+	  cols[NAME_COL]      = get_map_value(widecols, "Name");
+	  cols[CHROM_COL]     = get_map_value(widecols, "Chr");
+	  cols[POS_COL]       = get_map_value(widecols, "MapInfo");
+	  cols[SCORE_COL]     = get_map_value(widecols, "GenTrain Score"); // Probably -1
+	  cols[SNP_COL]       = get_map_value(widecols, "SNP");
+	  cols[I_COL]         = get_map_value(widecols, "IlmnStrand");
+	  cols[C_COL]         = get_map_value(widecols, "SourceStrand");
+	  cols[NORMID_COL]    = get_map_value(widecols, "NormID");         // Probably -1 
+	  cols[BEADSETID_COL] = get_map_value(widecols, "BeadSetID");
 
 	}
 	else {
@@ -165,202 +516,520 @@ void Manifest::open(string filename, bool wide)
 	    exit(1);
 	  }
 
-	  INDEX_COL = 0;
-	  NAME_COL = 1;
-	  CHROM_COL = 2;
-	  POS_COL = 3;
-	  SCORE_COL = 4;
-	  SNP_COL = 5;
-	  I_COL = 6;
-	  C_COL = 7;
-	  NORMID_COL = 8; 
-	  BEADSETID_COL = -1; 
+	  for (int c = 0; c < BEADSETID_COL; c++) cols[c] = c;
+	  cols[BEADSETID_COL] = -1; 
 	}
 
-	if (BEADSETID_COL != -1) { hasBeadSetID = true; } // instance variable
+	if (cols[BEADSETID_COL] != -1) { hasBeadSetID = true; } // instance variable
 
-	//
-	// OK, now ready to acquire data
-	// If it's wide. make sure we stop at end of data section.
-	int numsnps = 1; // Use if INDEX_COL missing; only increment on success.
-	while ( getline(file,s) ) {	// read line by line
-
-	  //cout << "\nDEBUG: " << s << flush;
-
-	  snpClass *snp = new snpClass();
+	// If it's wide, make sure we stop at end of data section.
+	dataEnd = end;
+	if ( wide ) {
+	  const char *controls = (const char *) memmem(line, end - line, "[Controls]", 10);
+	  if ( controls != NULL ) {
+		while ( controls > line && controls[-1] != '\n' ) controls--;
+		dataEnd = controls;
+	  }
+	}
 
-	  if ( wide ) {
-		size_t found = s.find("[Controls]");
-		if ( found != string::npos ) {
-		  break;
-		}
+	if ( line < dataEnd ) {
+	  // We always need the probe name.
+	  if ( -1 == cols[NAME_COL] ) {
+		cout <<"\nSadly, the name column was not found in the manifest file. Goodbye.\n" << flush;
+		exit(1);
 	  }
+	  if ( -1 == cols[POS_COL] ) {
+		cout << "\nPosition column not found in Manifest file. Cheerio.\n" << flush;
+		exit(1);
+	  }
+	  if ( -1 == cols[SNP_COL] ) {
+		cout << "\nOops! SNP column not found in Manifest file!\n" << flush;
+		exit(1);
+	  }
+	}
+}
 
-	  // Store each token (substring) from s, inclusing some which may be
-	  // empty, in same order as they are encountered in s.
-	  vector<string> a; 
 
-	  string DELIM = ",";
-	  size_t start = 0;
-	  size_t found = s.find(DELIM, start);
 
-	  while ( found != string::npos ) {
+//////////////////////////////////////////
+//
+// void Manifest::parse_lines (...)
+//
+// Parse the lines of the chunk, which must start at
+// the start of a line, and append the SNPs selected
+// to chunk->snps, decoding only the given fields.
+// A line is dropped as soon as a field it fails a
+// test on is read. Safe to call concurrently for
+// different chunks. Errors are returned in the chunk
+// and not thrown, so they can be passed back from a
+// thread.
+//
+/////////////////////////////////////////
 
-		string datum = s.substr(start, found-start);
-		a.push_back(datum);
-		start = found + DELIM.length();
-		found = s.find(DELIM, start);
+void Manifest::parse_lines(bool wide, const int cols[], int fields,
+						   ParseChunk *chunk)
+{
+	// Fields are (start, length) pairs in the mapped file,
+	// including some which may be empty, in the same order
+	// as they are encountered in the line.
+	vector<const char *> field;
+	vector<size_t> length;
+
+	// Numeric fields are copied so they end in '\0', as for atoi()
+	char buffer[64];
+	auto field_text = [&](int c) -> const char * {
+	  size_t n = min(length[cols[c]], sizeof(buffer) - 1);
+	  memcpy(buffer, field[cols[c]], n);
+	  buffer[n] = '\0';
+	  return buffer;
+	};
+
+	bool selecting = EXCLUDE_CNVS || !selectedChromosomes.empty() ||
+	  !selectedNames.empty();
+	bool haveNormIds = -1 != cols[NORMID_COL] && (fields & NORMID_FIELD);
+	int lastNormId = 0;
+	vector<bool> seen; // small normIds already in chunk->normIds
+	chunk->lines = 0;
+
+	const char *end = chunk->end;
+	const char *line = chunk->begin;
+	while ( line < end ) {
+	  const char *eol = (const char *) memchr(line, '\n', end - line);
+	  if (eol == NULL) eol = end;
+	  field.clear();
+	  length.clear();
+	  const char *start = line;
+	  for (const char *p = line; p < eol; p++) {
+		if (*p == ',') {
+		  field.push_back(start);
+		  length.push_back(p - start);
+		  start = p + 1;
+		}
 	  }
-
 	  // Get last (or only!) candidate:
-	  string dat = s.substr(start, s.length() - start);
-	  a.push_back(dat);
+	  field.push_back(start);
+	  length.push_back(eol - start);
+	  const char *next = eol < end ? eol + 1 : end;
+	  chunk->lines++;
 
-	  if ( (a.size() != 9) && (! wide) ) { 
+	  if ( (field.size() != 9) && (! wide) ) { 
 		string err="line too short or too long"; 
 		err += "\n";
-		err += s;
-		throw err; 
+		err.append(line, eol - line);
+		chunk->error = err;
+		return;
 	  }
-
-	  // DBG
-	  /*
-		cout << "\nsize = " << a.size() << endl << flush;
-		for ( int i = 0; i < a.size(); i++ ) {
-		string thing = a[i];
-		cout << "\n" << i << ": ";
-		if ( thing.empty() ) { cout << " NULL" << flush; }
-		else { cout << thing << flush; }
+	  // A column missing from a short wide-format line reads as empty
+	  for (int c = 0; c < NUM_COLS; c++) {
+		if (cols[c] >= (int) field.size()) {
+		  field.resize(cols[c] + 1, eol);
+		  length.resize(cols[c] + 1, 0);
 		}
-		cout << "\nNow size = " << a.size() << endl << flush;
-		exit(1);
-	  */
+	  }
 
-		
-		if ( -1 == INDEX_COL ) {
-		  snp->index = numsnps;
+	  // normIdMap is of every line, so it is the same whatever is selected
+	  int normId = -1;
+	  if ( haveNormIds ) {
+		normId = atoi(field_text(NORMID_COL));
+	  }
+	  if ( chunk->lines == 1 || normId != lastNormId ) {
+		lastNormId = normId;
+		if ( normId < 0 || normId >= 65536 ) {
+		  chunk->normIds.insert(normId);
 		}
-		else {
-		  snp->index = atoi(a[INDEX_COL].c_str());
+		else if ( (size_t) normId >= seen.size() || !seen[normId] ) {
+		  if ( (size_t) normId >= seen.size() ) seen.resize(normId + 1);
+		  seen[normId] = true;
+		  chunk->normIds.insert(normId);
 		}
+	  }
 
-		// We always need the probe name.
-		if ( -1 == NAME_COL ) {
-		  cout <<"\nSadly, the name column was not found in the manifest file. Goodbye.\n" << flush;
-		  exit(1);
-		}
-		snp->name = a[NAME_COL];
-		if ( EXCLUDE_CNVS && ( 0 == strncmp((snp->name).c_str(), "cnv", 3) ) ) {
-		  continue;
-		}
+	  const char *chromosome = "??";
+	  size_t chromLength = 2;
+	  if ( -1 != cols[CHROM_COL] ) {
+		chromosome = field[cols[CHROM_COL]];
+		chromLength = length[cols[CHROM_COL]];
+	  }
+	  // Always store mitochondrials as "MT"!
+	  if ( ( chromLength == 1 && 0 == strncmp(chromosome, "M", 1) )
+		   ||
+		   ( chromLength == 2 && 0 == strncmp(chromosome, "Mt", 2) ) )
+	  {
+		chromosome = "MT";
+		chromLength = 2;
+	  }
 
-		if ( -1 == CHROM_COL ) {
-		  snp->chromosome = "??";
-		}
-		else {
-		  snp->chromosome = a[CHROM_COL];
-		}
+	  if ( selecting &&
+		   ! selected(field[cols[NAME_COL]], length[cols[NAME_COL]],
+					  chromosome, chromLength) ) {
+		line = next;
+		continue;
+	  }
 
-		// Always store mitochondrials as "MT"!
-		if ( ( 0 == snp->chromosome.compare ("M") )
-			 ||
-			 ( 0 == snp->chromosome.compare ("Mt") ) )
-		{
-		  snp->chromosome = "MT";
-		}
-		
-		// Filter on selected chromosome if necessary:
-		if ( this->selectedChromosome.length() > 0 ) {
-		  if ( 0 != this->selectedChromosome.compare(snp->chromosome) ) {
-		    continue;
-		  }
-		  else {
-		    //    cout << "\nDEBUG: adding in SNP " << snp->name;
+	  long position = atol(field_text(POS_COL));
+
+	  if ( ! selectedRegions.empty() &&
+		   ! in_selected_region(chromosome, chromLength, position) ) {
+		line = next;
+		continue;
+	  }
+
+	  snpClass snp;
+
+	  if ( -1 != cols[INDEX_COL] ) {
+		snp.index = atoi(field_text(INDEX_COL));
+	  }
+	  else {
+		snp.index = chunk->lines;
+	  }
+
+	  snp.name.assign(field[cols[NAME_COL]], length[cols[NAME_COL]]);
+	  snp.chromosome.assign(chromosome, chromLength);
+	  snp.position = position;
+	  snp.normId = normId;
+
+	  if ( -1 == cols[SCORE_COL] || !(fields & SCORE_FIELD) ) {
+		snp.score = -1;
+	  }
+	  else {
+		snp.score = atof(field_text(SCORE_COL));
+	  }
+
+	  if ( fields & ALLELE_FIELDS ) {
+		for (int c = I_COL; c <= C_COL; c++) {
+		  char strand = '?';
+		  if ( -1 != cols[c] ) {
+			if ( length[cols[c]] == 0 ) {
+			  chunk->error = "Empty strand field in manifest line\n" + string(line, eol - line);
+			  return;
+			}
+			strand = field[cols[c]][0];
 		  }
+		  if (c == I_COL) snp.iStrand = strand;
+		  else            snp.cStrand = strand;
 		}
 
-		if ( -1 == POS_COL ) {
-		  cout << "\nPosition column not found in Manifest file. Cheerio.\n" << flush;
-		  exit(1);
-		}
-		else {
-		  snp->position = atol(a[POS_COL].c_str()); 
-		  // cout << "\nDBG; pos is " << a[POS_COL].c_str() << flush;
+		if ( ! convert_alleles(&snp, field[cols[SNP_COL]], length[cols[SNP_COL]]) ) {
+		  chunk->error = "Invalid SNP field in manifest line\n" + string(line, eol - line);
+		  return;
 		}
+	  }
 
-		if ( -1 == SCORE_COL ) {
-		  snp->score = -1;
-		}
-		else {
-		  snp->score = atof(a[SCORE_COL].c_str());
-		}
+	  if ( -1 == cols[BEADSETID_COL] || !(fields & BEADSETID_FIELD) ) {
+		snp.BeadSetID = -1;
+	  }
+	  else {
+		snp.BeadSetID = atoi(field_text(BEADSETID_COL));
+	  }
 
-		if ( -1 == I_COL ) {
-		  snp->iStrand = '?';
-		}
-		else {
-		  snp->iStrand = a[I_COL].at(0);
-		}
-		
-		if ( -1 == C_COL ) {
-		  snp->cStrand = '?';
-		}
-		else {
-		  snp->cStrand = a[C_COL].at(0);
-		}
+	  chunk->snps.push_back(std::move(snp));
+	  line = next;
+	}
+}
 
-		if ( -1 == NORMID_COL ) {
-		  snp->normId = -1;
-		}
-		else {
-		  snp->normId = atoi(a[NORMID_COL].c_str());
-		}
 
-		if ( -1 == SNP_COL ) {
-		  cout << "\nOops! SNP column not found in Manifest file!\n" << flush;
-		  exit(1);
-		}
-		else {
-		  convert (snp, a[SNP_COL]);
 
-		}
+// Reads the little-endian fields of a binary .bpm manifest in place,
+// clearing 'ok' rather than reading past the end
+struct BpmReader {
+  const unsigned char *p;
+  const unsigned char *end;
+  bool ok;
+
+  BpmReader(const char *begin, const char *end) :
+	p((const unsigned char *) begin), end((const unsigned char *) end), ok(true) {}
 
-		if ( -1 == BEADSETID_COL ) {
-		  snp->BeadSetID = -1;
+  bool has(size_t n) {
+	if ( ok && (size_t) (end - p) < n ) ok = false;
+	return ok;
+  }
+  void skip(size_t n) { if ( has(n) ) p += n; }
+  uint8_t byte() { return has(1) ? *p++ : 0; }
+  uint32_t int32() {
+	if ( !has(4) ) return 0;
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+	p += 4;
+	return v;
+  }
+  // A string is its length in 7-bit groups, least significant first,
+  // the top bit set on all but the last, then its bytes
+  const char *str(size_t &length) {
+	length = 0;
+	for (int shift = 0; ; shift += 7) {
+	  uint8_t b = byte();
+	  if ( !ok || shift > 28 ) { ok = false; length = 0; return ""; }
+	  length |= (size_t) (b & 0x7f) << shift;
+	  if ( !(b & 0x80) ) break;
+	}
+	const char *s = (const char *) p;
+	skip(length);
+	if ( !ok ) length = 0;
+	return ok ? s : "";
+  }
+  void skip_strings(int n) {
+	size_t length;
+	while ( n-- > 0 ) str(length);
+  }
+};
+
+
+
+//////////////////////////////////////////
+//
+// void Manifest::parse_bpm (...)
+//
+// Parse a binary .bpm manifest, mapped from 'data'
+// to 'end', into the chunk. The file is a header,
+// the locus names, a normalization ID byte for each,
+// then a locus entry for each; see BpmReader for the
+// encoding. SNPs are in the order of the names, which
+// is the order of the intensities in GTC files, with
+// index from 1, as in a .bpm.csv. As for Illumina's
+// own readers, the normalization ID of an Infinium I
+// locus is its byte plus 100 times its assay type.
+// A .bpm has no GenTrain score, so that is always -1,
+// and the customer strand is the source strand.
+//
+/////////////////////////////////////////
+
+void Manifest::parse_bpm(const char *data, const char *end, int fields,
+						 ParseChunk *chunk)
+{
+	BpmReader in(data, end);
+	chunk->lines = 0;
+	in.skip(3); // "BPM"
+	if ( in.byte() != 1 ) {
+	  chunk->error = "Unknown .bpm manifest format";
+	  return;
+	}
+	uint32_t version = in.int32() & ~0x1000u;
+	if ( version < 3 || version > 5 ) {
+	  chunk->error = "Unsupported .bpm manifest version " + to_string(version);
+	  return;
+	}
+	in.skip_strings(2); // manifest name, control configuration
+	uint32_t total = in.int32();
+	if ( !in.has(4 * (size_t) total) ) {
+	  chunk->error = "Truncated .bpm manifest";
+	  return;
+	}
+	in.skip(4 * (size_t) total);
+
+	// The names, in place, and an index of them for locus entries
+	// which are not in the same order
+	vector<pair<const char *, size_t> > names(total);
+	for (uint32_t i = 0; i < total && in.ok; i++) {
+	  names[i].first = in.str(names[i].second);
+	}
+	vector<int> normIds(total);
+	for (uint32_t i = 0; i < total && in.ok; i++) {
+	  normIds[i] = in.byte();
+	}
+	if ( !in.ok ) {
+	  chunk->error = "Truncated .bpm manifest";
+	  return;
+	}
+
+	struct Locus {
+	  const char *chromosome;
+	  size_t chromLength;
+	  const char *position;
+	  size_t positionLength;
+	  const char *alleles;
+	  size_t allelesLength;
+	  char iStrand;
+	  char cStrand;
+	  bool found;
+	};
+	vector<Locus> loci(total);
+	vector<string> nameStrings;
+	NameIndex byName;
+	for (uint32_t k = 0; k < total; k++) {
+	  uint32_t entryVersion = in.int32();
+	  if ( in.ok && (entryVersion < 6 || entryVersion > 8) ) {
+		chunk->error = "Unsupported .bpm locus entry version " + to_string(entryVersion);
+		return;
+	  }
+	  size_t idLength, nameLength, length;
+	  const char *ilmnId = in.str(idLength);
+	  const char *name = in.str(nameLength);
+	  in.skip_strings(3);
+	  in.skip(4);
+	  in.skip_strings(2);
+	  Locus locus;
+	  locus.alleles = in.str(locus.allelesLength);
+	  locus.chromosome = in.str(locus.chromLength);
+	  in.skip_strings(2);
+	  locus.position = in.str(locus.positionLength);
+	  in.skip_strings(2);
+	  in.skip(8); // bead addresses
+	  in.skip_strings(5);
+	  const char *sourceStrand = in.str(length);
+	  locus.cStrand = length > 0 ? sourceStrand[0] : '?';
+	  in.skip_strings(1);
+	  in.skip(3);
+	  uint8_t assayType = in.byte();
+	  if ( entryVersion >= 7 ) in.skip(16);
+	  if ( entryVersion >= 8 ) in.skip_strings(1);
+	  if ( !in.ok ) {
+		chunk->error = "Truncated .bpm manifest";
+		return;
+	  }
+	  if ( assayType > 2 ) {
+		chunk->error = "Invalid assay type in .bpm manifest for " + string(name, nameLength);
+		return;
+	  }
+
+	  // The Illumina strand is the third last part of the IlmnID,
+	  // e.g. T in rs1000-0_T_F_1234567890
+	  locus.iStrand = '?';
+	  int parts = 0;
+	  for (const char *p = ilmnId + idLength; p > ilmnId; p--) {
+		if ( p[-1] == '_' && ++parts == 3 ) {
+		  if ( p < ilmnId + idLength ) locus.iStrand = *p;
+		  break;
 		}
-		else {
-		  snp->BeadSetID = atoi(a[BEADSETID_COL].c_str());
+	  }
 
+	  // Loci are normally in the order of the names
+	  long i = k;
+	  if ( names[k].second != nameLength ||
+		   0 != memcmp(names[k].first, name, nameLength) ) {
+		if ( byName.empty() ) {
+		  nameStrings.reserve(total);
+		  for (uint32_t j = 0; j < total; j++) {
+			nameStrings.push_back(string(names[j].first, names[j].second));
+		  }
+		  byName.build(nameStrings);
+		}
+		i = byName.find(nameStrings, name, nameLength);
+		if ( i < 0 || loci[i].found ) {
+		  chunk->error = "Locus " + string(name, nameLength) + " of .bpm manifest is not in its name table";
+		  return;
 		}
-		
-		snps.push_back(*snp);
+	  }
+	  normIds[i] += 100 * assayType;
+	  locus.found = true;
+	  loci[i] = locus;
+	}
 
-		/*
-		  cout << "\nDBG: added in probe " << snp->name 
-		  << "; pos = " << snp->position << ", snp: " 
-		  << snp->snp[0] << snp->snp[1] << flush;
-		*/
+	bool selecting = EXCLUDE_CNVS || !selectedChromosomes.empty() ||
+	  !selectedNames.empty();
+	char buffer[64];
+	for (uint32_t i = 0; i < total; i++) {
+	  Locus &locus = loci[i];
+	  if ( !locus.found ) {
+		chunk->error = "Locus " + string(names[i].first, names[i].second) + " of .bpm manifest has no entry";
+		return;
+	  }
+	  chunk->lines++;
+	  // normIdMap is of every locus, so it is the same whatever is selected
+	  if ( i == 0 || normIds[i] != normIds[i-1] ) chunk->normIds.insert(normIds[i]);
+
+	  // Always store mitochondrials as "MT"!
+	  if ( ( locus.chromLength == 1 && 0 == strncmp(locus.chromosome, "M", 1) )
+		   ||
+		   ( locus.chromLength == 2 && 0 == strncmp(locus.chromosome, "Mt", 2) ) )
+	  {
+		locus.chromosome = "MT";
+		locus.chromLength = 2;
+	  }
 
-		normIdMap[snp->normId] = 1;
+	  if ( selecting &&
+		   ! selected(names[i].first, names[i].second,
+					  locus.chromosome, locus.chromLength) ) {
+		continue;
+	  }
 
-		numsnps++; // If we got this far, must be OK to increment!
-	
-		delete snp;
+	  size_t n = min(locus.positionLength, sizeof(buffer) - 1);
+	  memcpy(buffer, locus.position, n);
+	  buffer[n] = '\0';
+	  long position = atol(buffer);
+
+	  if ( ! selectedRegions.empty() &&
+		   ! in_selected_region(locus.chromosome, locus.chromLength, position) ) {
+		continue;
+	  }
+
+	  snpClass snp;
+	  snp.index = i + 1;
+	  snp.name.assign(names[i].first, names[i].second);
+	  snp.chromosome.assign(locus.chromosome, locus.chromLength);
+	  snp.position = position;
+	  snp.score = -1;
+	  if ( fields & NORMID_FIELD ) {
+		snp.normId = normIds[i];
+	  }
+	  if ( fields & ALLELE_FIELDS ) {
+		snp.iStrand = locus.iStrand;
+		snp.cStrand = locus.cStrand;
+		if ( ! convert_alleles(&snp, locus.alleles, locus.allelesLength) ) {
+		  chunk->error = "Invalid SNP field in .bpm manifest for " + snp.name;
+		  return;
+		}
+	  }
+	  chunk->snps.push_back(std::move(snp));
 	}
+}
 
-	file.close();
 
-	map<int,int>::iterator i;
-	int n;
-      	for (n=0, i = normIdMap.begin(); i != normIdMap.end(); n++, i++) {
-		normIdMap[i->first] = n;
+//////////////////////////////////////////
+//
+// bool Manifest::selected (...)
+//
+// Whether a SNP with the given name and chromosome
+// passes the tests chosen by exclude_cnvs(),
+// select_names() and select_chromosome().
+//
+/////////////////////////////////////////
+
+bool Manifest::selected(const char *name, size_t nameLength,
+						const char *chromosome, size_t chromLength)
+{
+	if ( EXCLUDE_CNVS && nameLength >= 3 && 0 == strncmp(name, "cnv", 3) ) {
+	  return false;
+	}
+	if ( !selectedNames.empty() &&
+		 selectedNameIndex.find(selectedNames, name, nameLength) < 0 ) {
+	  return false;
+	}
+	if ( selectedChromosomes.empty() ) {
+	  return true;
+	}
+	for (size_t i = 0; i < selectedChromosomes.size(); i++) {
+	  const string &c = selectedChromosomes[i];
+	  if ( c.length() == chromLength &&
+		   0 == memcmp(c.data(), chromosome, chromLength) ) {
+		return true;
+	  }
 	}
+	return false;
+}
 
-	
-	populate_hashmap();
 
 
-} // End of Manifest::open()
+//////////////////////////////////////////
+//
+// bool Manifest::in_selected_region (...)
+//
+// Whether a chromosome and position are in any
+// region chosen by select_region().
+//
+/////////////////////////////////////////
+
+bool Manifest::in_selected_region(const char *chromosome, size_t chromLength,
+								  long position)
+{
+	for (size_t i = 0; i < selectedRegions.size(); i++) {
+	  const Region &r = selectedRegions[i];
+	  if ( r.chromosome.length() == chromLength &&
+		   0 == memcmp(r.chromosome.data(), chromosome, chromLength) &&
+		   position >= r.start && position <= r.end ) {
+		return true;
+	  }
+	}
+	return false;
+}
 
 
 
@@ -376,20 +1045,277 @@ void Manifest::open(char *filename, bool wide)
 //
 // void Manifest::populate_hashmap ()
 //
-// Populate the snpNames hash_map for quick look-ups of SNPs.
+// Index the SNPs by name for quick look-ups.
 //
 //////////////////////////////////////////
 
 void Manifest::populate_hashmap () {
 
-	//vector<snpClass>::iterator it;
-	//for (it = snps.begin(); it != snps.end(); it++) {
-	int num_snps = snps.size();
-	for (int index = 0; index < num_snps; index++) {
-	      snpClass s = snps[index];
-	      string the_name = s.name;
-	      snpNames[the_name] = index;
+	locusOrder.clear();
+	nameIndex.build(snps);
+
+}
+
+
+
+//////////////////////////////////////////
+//
+// int Manifest::snp2idx (char *snp)
+//
+// Index in snps of the SNP with the given name,
+// or -1 if not found.
+//
+//////////////////////////////////////////
+
+int Manifest::snp2idx(char *snp) {
+
+	return nameIndex.find(snps, snp, strlen(snp));
+
+}
+
+
+
+//////////////////////////////////////////
+//
+// string Manifest::cache_file (string path)
+//
+// Name of the cache file for the manifest at the
+// given absolute path. If cachePath is a directory,
+// the cache is kept there, named after the manifest
+// and a hash of its path; otherwise it is kept next
+// to the manifest, with ".mfc" appended.
+//
+//////////////////////////////////////////
 
+string Manifest::cache_file(string path) {
+
+	struct stat status;
+	if (stat(cachePath.c_str(), &status) != 0 || !S_ISDIR(status.st_mode)) {
+	  return path + ".mfc";
+	}
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx",
+			 (unsigned long long) NameIndex::hash(path.data(), path.length()));
+	string base = path.substr(path.find_last_of('/') + 1);
+	return cachePath + "/" + base + "." + hash + ".mfc";
+
+}
+
+
+
+//////////////////////////////////////////
+//
+// bool Manifest::read_cache (...)
+//
+// Load the SNPs from the cache file, if it exists
+// and is up to date for the manifest at 'path'.
+// Returns false, leaving the Manifest unchanged,
+// if the manifest has to be parsed.
+//
+//////////////////////////////////////////
+
+bool Manifest::read_cache(string cachefile, string path, bool wide) {
+
+	struct stat csv;
+	struct stat status;
+	if (stat(path.c_str(), &csv) != 0) return false;
+	int fd = ::open(cachefile.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	if (fstat(fd, &status) != 0 || status.st_size < (off_t) sizeof(CacheHeader)) {
+	  ::close(fd);
+	  return false;
+	}
+	size_t mapSize = status.st_size;
+	void *addr = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED) return false;
+	const char *data = (const char *) addr;
+
+	CacheHeader header;
+	memcpy(&header, data, sizeof(header));
+	uint32_t flags = wide ? CACHE_WIDE : 0;
+	size_t pathStart = align8(sizeof(CacheHeader));
+	size_t recordStart = pathStart + align8(header.pathLength);
+	size_t normStart = recordStart + align8((size_t) header.numSnps * sizeof(CacheRecord));
+	size_t slotStart = normStart + align8((size_t) header.numNormIds * 2 * sizeof(int32_t));
+	size_t orderStart = slotStart + align8((size_t) header.numSlots * sizeof(uint32_t));
+	size_t stringStart = orderStart + align8((size_t) header.numSnps * sizeof(uint32_t));
+	int64_t time = csv.st_mtim.tv_sec * 1000000000LL + csv.st_mtim.tv_nsec;
+	bool ok = memcmp(header.magic, "mfc", 3) == 0 &&
+	  header.version == CACHE_VERSION &&
+	  (header.flags & CACHE_WIDE) == flags &&
+	  header.csvSize == (uint64_t) csv.st_size &&
+	  stringStart + header.stringBytes == mapSize &&
+	  header.pathLength == path.length() &&
+	  memcmp(data + pathStart, path.data(), path.length()) == 0 &&
+	  header.numSlots > 0 && (header.numSlots & (header.numSlots - 1)) == 0;
+	bool refresh = false;
+	if (ok && header.csvTime != time) {
+	  // touched, but maybe not changed
+	  int csvfd = ::open(path.c_str(), O_RDONLY);
+	  void *csvaddr = MAP_FAILED;
+	  if (csvfd >= 0 && csv.st_size > 0) {
+		csvaddr = mmap(NULL, csv.st_size, PROT_READ, MAP_PRIVATE, csvfd, 0);
+	  }
+	  if (csvfd >= 0) ::close(csvfd);
+	  if (csvaddr != MAP_FAILED) {
+		ok = NameIndex::hash((const char *) csvaddr, csv.st_size) == header.csvHash;
+		munmap(csvaddr, csv.st_size);
+	  } else {
+		ok = csv.st_size == 0 && header.csvHash == NameIndex::hash("", 0);
+	  }
+	  refresh = ok;
+	}
+	if (!ok) {
+	  munmap(addr, mapSize);
+	  return false;
+	}
+
+	const CacheRecord *records = (const CacheRecord *) (data + recordStart);
+	const int32_t *normIds = (const int32_t *) (data + normStart);
+	const uint32_t *slots = (const uint32_t *) (data + slotStart);
+	const uint32_t *order = (const uint32_t *) (data + orderStart);
+	const char *strings = data + stringStart;
+	snps.resize(header.numSnps);
+	for (uint32_t i = 0; i < header.numSnps; i++) {
+	  const CacheRecord &record = records[i];
+	  snpClass &snp = snps[i];
+	  snp.index = record.index;
+	  snp.name.assign(strings + record.nameOffset, record.nameLength);
+	  snp.chromosome.assign(strings + record.chromOffset, record.chromLength);
+	  snp.position = record.position;
+	  snp.score = record.score;
+	  snp.snp[0] = record.snp[0];
+	  snp.snp[1] = record.snp[1];
+	  snp.iStrand = record.iStrand;
+	  snp.cStrand = record.cStrand;
+	  snp.normId = record.normId;
+	  snp.BeadSetID = record.beadSetId;
+	  snp.converted = record.converted != 0;
+	}
+	for (uint32_t i = 0; i < header.numNormIds; i++) {
+	  normIdMap[normIds[2*i]] = normIds[2*i + 1];
+	}
+	nameIndex.slots.assign(slots, slots + header.numSlots);
+	locusOrder.assign(order, order + header.numSnps);
+	hasBeadSetID = (header.flags & CACHE_BEADSETID) != 0;
+	munmap(addr, mapSize);
+
+	if (refresh) write_cache(cachefile, path, wide, csv.st_size, time, header.csvHash);
+	return true;
+
+}
+
+
+
+//////////////////////////////////////////
+//
+// void Manifest::write_cache (...)
+//
+// Save the SNPs, as just parsed from the manifest
+// at 'path', to the cache file. The file is written
+// under a temporary name and renamed, so a reader
+// never sees part of one. Failure is only a warning.
+//
+//////////////////////////////////////////
+
+void Manifest::write_cache(string cachefile, string path, bool wide,
+						   uint64_t size, int64_t time, uint64_t hash) {
+
+	uint32_t numSnps = snps.size();
+	vector<long> order;
+	locus_order(order);
+
+	// name index, as already built or loaded
+	if (nameIndex.empty()) nameIndex.build(snps);
+	const vector<uint32_t> &slots = nameIndex.slots;
+	uint32_t numSlots = slots.size();
+
+	// records, with chromosome names stored once each
+	vector<CacheRecord> records(numSnps);
+	string strings;
+	map<string, uint32_t> chromOffsets;
+	for (uint32_t i = 0; i < numSnps; i++) {
+	  const snpClass &snp = snps[i];
+	  CacheRecord &record = records[i];
+	  memset(&record, 0, sizeof(record));
+	  if (chromOffsets.find(snp.chromosome) == chromOffsets.end()) {
+		chromOffsets[snp.chromosome] = strings.length();
+		strings += snp.chromosome;
+	  }
+	  record.position = snp.position;
+	  record.score = snp.score;
+	  record.index = snp.index;
+	  record.normId = snp.normId;
+	  record.beadSetId = snp.BeadSetID;
+	  record.nameOffset = strings.length();
+	  record.chromOffset = chromOffsets[snp.chromosome];
+	  record.nameLength = snp.name.length();
+	  record.chromLength = snp.chromosome.length();
+	  record.snp[0] = snp.snp[0];
+	  record.snp[1] = snp.snp[1];
+	  record.iStrand = snp.iStrand;
+	  record.cStrand = snp.cStrand;
+	  record.converted = snp.converted;
+	  strings += snp.name;
+	  if (snp.name.length() > 0xffff || snp.chromosome.length() > 0xffff ||
+		  strings.length() > 0xffffffffUL) {
+		return; // not worth caching
+	  }
+	}
+	vector<int32_t> normIds;
+	for (map<int,int>::iterator i = normIdMap.begin(); i != normIdMap.end(); i++) {
+	  normIds.push_back(i->first);
+	  normIds.push_back(i->second);
+	}
+	vector<uint32_t> orderOut(order.begin(), order.end());
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "mfc", 3);
+	header.version = CACHE_VERSION;
+	header.flags = (wide ? CACHE_WIDE : 0) | (hasBeadSetID ? CACHE_BEADSETID : 0);
+	header.csvSize = size;
+	header.csvTime = time;
+	header.csvHash = hash;
+	header.numSnps = numSnps;
+	header.numNormIds = normIds.size() / 2;
+	header.numSlots = numSlots;
+	header.pathLength = path.length();
+	header.stringBytes = strings.length();
+
+	string tempfile = cachefile + ".XXXXXX";
+	vector<char> temp(tempfile.begin(), tempfile.end());
+	temp.push_back('\0');
+	int fd = mkstemp(&temp[0]);
+	if (fd < 0) {
+	  cerr << "Warning: cannot write manifest cache " << cachefile << ": "
+		   << strerror(errno) << endl;
+	  return;
+	}
+	fchmod(fd, 0644);
+	FILE *out = fdopen(fd, "wb");
+	const char padding[8] = { };
+	const void *parts[] = { &header, path.data(), records.data(), normIds.data(),
+							slots.data(), orderOut.data(), strings.data() };
+	size_t lengths[] = { sizeof(header), path.length(),
+						 records.size() * sizeof(CacheRecord),
+						 normIds.size() * sizeof(int32_t),
+						 slots.size() * sizeof(uint32_t),
+						 orderOut.size() * sizeof(uint32_t), strings.length() };
+	bool ok = out != NULL;
+	for (int k = 0; ok && k < 7; k++) {
+	  ok = fwrite(parts[k], 1, lengths[k], out) == lengths[k];
+	  size_t pad = k < 6 ? align8(lengths[k]) - lengths[k] : 0;
+	  if (ok && pad > 0) ok = fwrite(padding, 1, pad, out) == pad;
+	}
+	ok = (out != NULL && fclose(out) == 0) && ok;
+	if (out == NULL) ::close(fd);
+	if (ok) ok = rename(&temp[0], cachefile.c_str()) == 0;
+	if (!ok) {
+	  cerr << "Warning: cannot write manifest cache " << cachefile << ": "
+		   << strerror(errno) << endl;
+	  unlink(&temp[0]);
 	}
 
 }
@@ -416,7 +1342,6 @@ void Manifest::populate_hashmap () {
 
 void Manifest::convert (snpClass* snip, std::string input_snp) {
 
- 
   // input_snp will be something like "[A/C]"; we want to store it as "AC"
   // Illumina method aims to designate A as Allele A on TOP, and the T as Alelle A
   // on BOT.
@@ -446,71 +1371,8 @@ void Manifest::convert (snpClass* snip, std::string input_snp) {
   // [I/D]             P                  ID
   // [N/A]             P                  NA
 
-
-  switch ( snip->iStrand ) {
-
-    case 'T': // Already a TOP, or one of the weird cases
-    case 'M':
-    case 'P':
-      snip->snp[0] = input_snp.at(1);
-      snip->snp[1] = input_snp.at(3);
-      break;
-
-    case 'B':  // BOT
-	{
-		char first = input_snp.at(1);
-		char second = input_snp.at(3);
-      
-		// This relies on the above table (and conversions) being correct and complete!
-		switch ( first ) {
-		case 'C':
-		  snip->snp[0] = 'G';
-		  break;
-	  
-		case 'G':
-		  snip->snp[0] = 'C';
-		  break;
-	
-		case 'T':
-		  snip->snp[0] = 'A';
-		  break;
-
-		case 'A':
-		  snip->snp[0] = 'T';
-		  break;
-
-		default:
-		  snip->snp[0] = '?';
-		}
-
-		switch ( second ) {
-		case 'T':
-		  snip->snp[1] = 'A';
-		  break;
-		  
-		case 'A':
-		  snip->snp[1] = 'T';
-		  break;
-	  
-		case 'C':
-		  snip->snp[1] = 'G';
-		  break;
-		  
-		case 'G':
-		  snip->snp[1] = 'C';
-		  break;
-		  
-		default:
-		  snip->snp[1] = '?';
-		}
-		snip->converted = true;
-	}
-	break;
-   
-  default:   // Unknown
-    snip->snp[0] = '?';
-    snip->snp[1] = '?';
-	
+  if ( ! convert_alleles(snip, input_snp.c_str(), input_snp.length()) ) {
+    throw "Invalid SNP field " + input_snp;
   }
 
 #ifdef _DEBUG
@@ -522,6 +1384,47 @@ void Manifest::convert (snpClass* snip, std::string input_snp) {
 
 
 
+///////////////////////////////////////////////
+//
+// bool convert_alleles (snpClass* snip,
+//                       const char* input_snp,
+//                       size_t length)
+//
+// Table-driven version of the conversion 
+// described for Manifest::convert(), reading
+// the SNP field in place. Returns false if
+// the field is too short to hold "[A/B]".
+//
+/////////////////////////////////////////////
+
+static bool convert_alleles (snpClass* snip, const char* input_snp, size_t length) {
+
+  switch ( STRAND_TABLES.action[(unsigned char) snip->iStrand] ) {
+
+    case StrandTables::COPY: // Already a TOP, or one of the weird cases
+      if ( length < 4 ) return false;
+      snip->snp[0] = input_snp[1];
+      snip->snp[1] = input_snp[3];
+      break;
+
+    case StrandTables::COMPLEMENT: // BOT
+      if ( length < 4 ) return false;
+      snip->snp[0] = STRAND_TABLES.complement[(unsigned char) input_snp[1]];
+      snip->snp[1] = STRAND_TABLES.complement[(unsigned char) input_snp[3]];
+      snip->converted = true;
+      break;
+
+    default:   // Unknown
+      snip->snp[0] = '?';
+      snip->snp[1] = '?';
+
+  }
+  return true;
+
+}
+
+
+
 ///////////////////////////////////////////////
 //
 // void Manifest::test_convert ()
@@ -589,31 +1492,8 @@ void Manifest::test_convert () {
 
 string Manifest::get_chromosome_for_SNP (string snpname) {
 
-
-  int index = snpNames[snpname];
-
-  if ( index != 0 ) { // Normal case.
-
-    return snps[index].chromosome;
-
-  }
-
-  else {
-    // EITHER SNP is in index 0 of our vector, OR it hasn't
-    // been found in our hash_map. So we need to do a special 
-    // check for this case, by checking to see if the name of 
-    // the SNP in index 0 is the same as the snpname string passed in:
-    
-    snpClass s = snps[0];
-    if ( 0 == s.name.compare(snpname) ) { // It's the same
-      return s.chromosome;
-    }
-    else {
-      return string();
-    }
-
-  }
-
+  int index = snp2idx((char *) snpname.c_str());
+  return index < 0 ? string() : snps[index].chromosome;
 
 }
 
@@ -641,25 +1521,12 @@ string Manifest::get_chromosome_for_SNP (string snpname) {
 
 snpClass* Manifest::lookup_SNP_by_name (string snpname) {
 
-  int index = snpNames[snpname];
-  snpClass s = snps[index];
-
-
-  //vector<snpClass>::iterator it;
-  //for (it = snps.begin(); it != snps.end(); it++) {
-
-    //snpClass s = *it;
-
-    if ( 0 == s.name.compare(snpname) ) {
-
-      snpClass* snippy = new snpClass(s);
-      return snippy;
-
-    }
-
-  //}
-
-  return NULL;
+  int index = snp2idx((char *) snpname.c_str());
+  if ( index < 0 ) {
+    return NULL;
+  }
+  snpClass* snippy = new snpClass(snps[index]);
+  return snippy;
 
 }
 
@@ -744,26 +1611,231 @@ void Manifest::dump(void)
 //
 // Write normalized .bpm.csv output to given path
 // Use to create a normalized .bpm.csv file for input to genotype callers
+// Rows are formatted into a buffer, which is written
+// when it reaches WRITE_BUFFER_BYTES.
 //
 ///////////////////////////////////////////////
 
 void Manifest::write(string outPath) {
 
 
+  ofstream outFile;
+  outFile.open(outPath.c_str(), ios::binary | ios::trunc | ios::out);
+
+  string buffer = csv_header();
+  // TODO ensure SNPs are output in sorted order?
+  size_t snpTotal = snps.size();
+  for (size_t i = 0; i < snpTotal; i++) {
+	snps[i].append(buffer);
+	buffer += '\n';
+	if (buffer.size() >= WRITE_BUFFER_BYTES) {
+	  outFile.write(buffer.data(), buffer.size());
+	  buffer.clear();
+	}
+  }
+  outFile.write(buffer.data(), buffer.size());
+  outFile.close();
+
+}
+
+///////////////////////////////////////////////
+//
+// string Manifest::csv_header()
+//
+// The header line of a normalized .bpm.csv
+//
+///////////////////////////////////////////////
+
+string Manifest::csv_header() {
   string header = "Index,Name,Chromosome,Position,GenTrain Score,SNP,ILMN Strand,Customer Strand,NormID";
   if (this->hasBeadSetID) { header += ",BeadSetID"; }
+  return header + "\n";
+}
+
+///////////////////////////////////////////////
+//
+// void Manifest::normalize (string inPath,
+//                           string outPath,
+//                           bool wide, int threads)
+//
+// Write the normalized .bpm.csv of the manifest at
+// inPath to outPath, as open() and write() would,
+// but without keeping the SNPs: the manifest is
+// parsed and written a window of lines at a time,
+// so memory use does not grow with its size. With
+// more than one thread, that many windows are
+// parsed and formatted at once, and written in
+// order. The selections made before, e.g. with
+// exclude_cnvs(), apply. A binary .bpm is not read
+// by lines, so is opened and written whole.
+//
+///////////////////////////////////////////////
+
+void Manifest::normalize(string inPath, string outPath, bool wide, int threads) {
+
+  int fd = ::open(inPath.c_str(), O_RDONLY);
+  struct stat status;
+  if (fd < 0 || fstat(fd, &status) != 0) {
+	cout << "Can't open file: " << inPath << endl << flush;
+	exit(1);
+  }
+  size_t size = status.st_size;
+  const char *data = "";
+  void *addr = NULL;
+  if (size > 0) {
+	addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED) {
+	  cout << "Can't open file: " << inPath << endl << flush;
+	  exit(1);
+	}
+	madvise(addr, size, MADV_SEQUENTIAL);
+	data = (const char *) addr;
+  }
+  ::close(fd);
+
+  if (size >= 3 && 0 == memcmp(data, "BPM", 3)) {
+	if (addr != NULL) munmap(addr, size);
+	open(inPath, wide);
+	write(outPath);
+	return;
+  }
+
+  int cols[NUM_COLS];
+  const char *line;
+  const char *dataEnd;
+  parse_header(inPath, data, data + size, wide, cols, line, dataEnd);
+
   ofstream outFile;
-  outFile.open(outPath.c_str());
+  outFile.open(outPath.c_str(), ios::binary | ios::trunc | ios::out);
+  string header = csv_header();
+  outFile.write(header.data(), header.size());
+
+  if (threads < 1) threads = 1;
+  vector<ParseChunk> parsed(threads);
+  vector<string> text(threads);
+  long lines = 0;
+  const char *done = data; // start of the pages still mapped
+  while (line < dataEnd) {
+	// the next windows, each ending at the end of a line
+	long chunks = 0;
+	for ( ; chunks < threads && line < dataEnd; chunks++) {
+	  const char *p = line + min((long) WRITE_BUFFER_BYTES, (long) (dataEnd - line));
+	  const char *eol = p < dataEnd ? (const char *) memchr(p, '\n', dataEnd - p) : NULL;
+	  parsed[chunks].begin = line;
+	  parsed[chunks].end = line = eol == NULL ? dataEnd : eol + 1;
+	}
 
-  outFile << header << endl;
-  // TODO ensure SNPs are output in sorted order?
-  int snpTotal = snps.size();
-  for (int i = 0; i < snpTotal; i++) {
-	snpClass s = snps[i];
-	outFile << s.toString().c_str() << endl;
+	// parse and format them, each in a thread of its own; an index
+	// from a line number needs the lines of the windows before
+	vector<long> before(chunks);
+	auto format = [&](long c) {
+	  ParseChunk &chunk = parsed[c];
+	  parse_lines(wide, cols, ALL_FIELDS, &chunk);
+	  if ( -1 == cols[INDEX_COL] ) {
+		for (size_t i = 0; i < chunk.snps.size(); i++) chunk.snps[i].index += before[c];
+	  }
+	  text[c].clear();
+	  text[c].reserve(chunk.end - chunk.begin + chunk.lines * 16);
+	  for (size_t i = 0; i < chunk.snps.size(); i++) {
+		chunk.snps[i].append(text[c]);
+		text[c] += '\n';
+	  }
+	  chunk.snps.clear();
+	  chunk.normIds.clear();
+	};
+	if ( -1 == cols[INDEX_COL] ) {
+	  // count the lines of each window first
+	  for (long c = 0; c < chunks; c++) {
+		before[c] = lines;
+		lines += count(parsed[c].begin, parsed[c].end, '\n') +
+		  (parsed[c].end == dataEnd && dataEnd > parsed[c].begin && dataEnd[-1] != '\n');
+	  }
+	}
+	vector<thread> workers;
+	for (long c = 1; c < chunks; c++) {
+	  workers.push_back(thread(format, c));
+	}
+	format(0);
+	for (size_t w = 0; w < workers.size(); w++) workers[w].join();
+
+	for (long c = 0; c < chunks; c++) {
+	  if (!parsed[c].error.empty()) {
+		outFile.close();
+		if (addr != NULL) munmap(addr, size);
+		throw parsed[c].error;
+	  }
+	  outFile.write(text[c].data(), text[c].size());
+	}
+
+	// let the pages already parsed go
+	size_t page = sysconf(_SC_PAGESIZE);
+	const char *upTo = data + ((line - data) / page) * page;
+	if (addr != NULL && upTo > done) {
+	  madvise((void *) done, upTo - done, MADV_DONTNEED);
+	  done = upTo;
+	}
   }
   outFile.close();
+  if (addr != NULL) munmap(addr, size);
+}
+
+///////////////////////////////////////////////
+//
+// string Manifest::selection_key()
+//
+// Describe the fields and SNPs selected, e.g. to
+// tell apart manifests loaded from the same file
+// with different selections. Selected names are
+// described by their number and a hash.
+//
+///////////////////////////////////////////////
+
+string Manifest::selection_key() {
+  string key = "fields=" + to_string(selectedFields);
+  if (EXCLUDE_CNVS) key += ";nocnv";
+  for (size_t i = 0; i < selectedChromosomes.size(); i++) {
+	key += ";chr=" + selectedChromosomes[i];
+  }
+  for (size_t i = 0; i < selectedRegions.size(); i++) {
+	const Region &r = selectedRegions[i];
+	key += ";region=" + r.chromosome + ":" + to_string(r.start) + "-" + to_string(r.end);
+  }
+  if (!selectedNames.empty()) {
+	string names;
+	for (size_t i = 0; i < selectedNames.size(); i++) {
+	  names += selectedNames[i];
+	  names += '\0';
+	}
+	key += ";names=" + to_string(selectedNames.size()) + "/" +
+	  to_string(NameIndex::hash(names.data(), names.size()));
+  }
+  return key;
+}
+
+///////////////////////////////////////////////
+//
+// size_t Manifest::memory_size()
+//
+// Estimate the memory held by the SNPs, their
+// strings where too long to be kept in place, and
+// the name index.
+//
+///////////////////////////////////////////////
 
+size_t Manifest::memory_size() {
+  // a string of up to the capacity of an empty one is kept in place
+  const size_t inPlace = string().capacity();
+  size_t bytes = snps.capacity() * sizeof(snpClass);
+  for (size_t i = 0; i < snps.size(); i++) {
+	const snpClass &snp = snps[i];
+	if (snp.name.capacity() > inPlace) bytes += snp.name.capacity() + 1;
+	if (snp.chromosome.capacity() > inPlace) bytes += snp.chromosome.capacity() + 1;
+  }
+  bytes += nameIndex.slots.capacity() * sizeof(uint32_t);
+  bytes += locusOrder.capacity() * sizeof(uint32_t);
+  bytes += probeClasses.capacity() + probeChromosomes.capacity() * sizeof(uint16_t);
+  bytes += normIdMap.size() * 48;
+  return bytes;
 }
 
 ///////////////////////////////////////////////
@@ -816,20 +1888,263 @@ void Manifest::order_by_position() {
 
 ///////////////////////////////////////////////
 //
-// void Manifest::order_by_locus()
+// void Manifest::order_by_locus(bool numeric)
 //
 // Re-order the vector of snpClass objects such that
 // they are stored in the order first of lexically sorted
 // chromosome name and then chromosomal position.
+// If 'numeric', numbered chromosomes are in numeric
+// order, e.g. 2 before 10, as for PLINK.
 //
-// Must be called after Manifest::open().
+// Must be called after Manifest::open(). The name
+// index is updated to match.
 //
 ///////////////////////////////////////////////
-void Manifest::order_by_locus() {
-  sort(snps.begin(), snps.end());
+void Manifest::order_by_locus(bool numeric) {
+  vector<long> order;
+  locus_order(order, numeric);
+  vector<snpClass> sorted;
+  sorted.reserve(snps.size());
+  vector<uint32_t> position(snps.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    sorted.push_back(std::move(snps[order[i]]));
+    position[order[i]] = i;
+  }
+  snps.swap(sorted);
+  nameIndex.renumber(position);
+  locusOrder.clear();
+  if (!numeric) {
+    for (size_t i = 0; i < snps.size(); i++) locusOrder.push_back(i);
+  }
   return;
 }
 
+///////////////////////////////////////////////
+//
+// void Manifest::locus_order(vector<long> &order,
+//                            bool numeric)
+//
+// Find the order of snps by locus, as for 
+// order_by_locus(), without moving them: order[k]
+// is the index in snps of the k'th SNP by locus.
+// Ties are left in their original order.
+//
+///////////////////////////////////////////////
+void Manifest::locus_order(vector<long> &order, bool numeric) {
+  long total = snps.size();
+  if (!numeric && (long) locusOrder.size() == total) {
+    // a saved order is only used if it is still right
+    order.assign(locusOrder.begin(), locusOrder.end());
+    bool ok = true;
+    for (long k = 0; ok && k < total; k++) {
+      ok = order[k] < total;
+      if (ok && k > 0) {
+        const snpClass &a = snps[order[k-1]];
+        const snpClass &b = snps[order[k]];
+        int cmp = a.chromosome.compare(b.chromosome);
+        ok = cmp < 0 || (cmp == 0 && (a.position < b.position ||
+             (a.position == b.position && a.name.compare(b.name) <= 0)));
+      }
+    }
+    if (ok) return;
+  }
+  ManifestColumns columns(this);
+  columns.sort(order, true, numeric);
+  if (!numeric) locusOrder.assign(order.begin(), order.end());
+}
+
+///////////////////////////////////////////////
+//
+// ManifestColumns::ManifestColumns(Manifest *manifest)
+//
+///////////////////////////////////////////////
+
+ManifestColumns::ManifestColumns(Manifest *manifest) {
+  this->manifest = manifest;
+  vector<snpClass> &snps = manifest->snps;
+  long total = snps.size();
+
+  // intern chromosome names; they are few, so compare with the last
+  // one seen before looking up the map
+  map<string, uint16_t> codes;
+  for (long i = 0; i < total; i++) {
+    if (i > 0 && snps[i].chromosome == snps[i-1].chromosome) continue;
+    codes[snps[i].chromosome] = 0;
+  }
+  if (codes.size() > 0xffff) throw string("Too many chromosome names in manifest");
+  for (map<string, uint16_t>::iterator c = codes.begin(); c != codes.end(); c++) {
+    c->second = chromosomeNames.size();
+    chromosomeNames.push_back(c->first);
+  }
+
+  chromosome.resize(total);
+  position.resize(total);
+  normId.resize(total);
+  index.resize(total);
+  alleles.resize(2 * total);
+  uint16_t code = 0;
+  for (long i = 0; i < total; i++) {
+    const snpClass &snp = snps[i];
+    if (i == 0 || snp.chromosome != snps[i-1].chromosome) {
+      code = codes[snp.chromosome];
+    }
+    chromosome[i] = code;
+    position[i] = snp.position;
+    normId[i] = snp.normId;
+    index[i] = snp.index;
+    alleles[2*i] = snp.snp[0];
+    alleles[2*i + 1] = snp.snp[1];
+  }
+}
+
+///////////////////////////////////////////////
+//
+// void ManifestColumns::sort(vector<long> &order,
+//                            bool byName, bool numeric)
+//
+// Find the order of the SNPs by chromosome and
+// position, and then by name if 'byName'; order[k]
+// is the index of the k'th SNP. Other ties are left
+// in their original order. If 'numeric', numbered
+// chromosomes are in numeric order.
+//
+// Chromosome rank and position make a 64-bit key,
+// sorted by a least significant digit radix sort,
+// 16 bits at a time. Only runs of equal keys need
+// SNP names to be compared.
+//
+///////////////////////////////////////////////
+
+void ManifestColumns::sort(vector<long> &order, bool byName, bool numeric) {
+  long total = chromosome.size();
+
+  // rank of each chromosome code
+  vector<uint64_t> rank(chromosomeNames.size());
+  vector<int> byRank(chromosomeNames.size());
+  for (size_t c = 0; c < byRank.size(); c++) byRank[c] = c;
+  if (numeric) {
+    vector<string> &names = chromosomeNames;
+    std::sort(byRank.begin(), byRank.end(), [&names](int a, int b) {
+        int c1 = atoi(names[a].c_str());
+        int c2 = atoi(names[b].c_str());
+        if (c1 && c2 && (c1 != c2)) return c1 < c2;
+        return names[a].compare(names[b]) < 0;
+      });
+  }
+  for (size_t r = 0; r < byRank.size(); r++) rank[byRank[r]] = r;
+
+  order.resize(total);
+  bool inRange = true;
+  for (long i = 0; i < total && inRange; i++) {
+    inRange = position[i] >= 0 && (uint64_t) position[i] < (1ULL << POSITION_BITS);
+  }
+  if (inRange) {
+    vector<uint64_t> keys(total);
+    vector<uint64_t> keysOut(total);
+    vector<long> orderOut(total);
+    uint64_t all = ~0ULL;
+    uint64_t any = 0;
+    for (long i = 0; i < total; i++) {
+      keys[i] = (rank[chromosome[i]] << POSITION_BITS) | position[i];
+      order[i] = i;
+      all &= keys[i];
+      any |= keys[i];
+    }
+    vector<long> count(1 << 16);
+    for (int shift = 0; shift < 64; shift += 16) {
+      // skip a digit which is the same in every key
+      if ((((all ^ any) >> shift) & 0xffff) == 0) continue;
+      fill(count.begin(), count.end(), 0);
+      for (long i = 0; i < total; i++) count[(keys[i] >> shift) & 0xffff]++;
+      long sum = 0;
+      for (int d = 0; d < (1 << 16); d++) {
+        long n = count[d];
+        count[d] = sum;
+        sum += n;
+      }
+      for (long i = 0; i < total; i++) {
+        long k = count[(keys[i] >> shift) & 0xffff]++;
+        keysOut[k] = keys[i];
+        orderOut[k] = order[i];
+      }
+      keys.swap(keysOut);
+      order.swap(orderOut);
+    }
+    if (byName) {
+      vector<snpClass> &snps = manifest->snps;
+      for (long start = 0; start < total; ) {
+        long end = start + 1;
+        while (end < total && keys[end] == keys[start]) end++;
+        if (end - start > 1) {
+          stable_sort(order.begin() + start, order.begin() + end,
+                      [&snps](long a, long b) {
+                        return snps[a].name.compare(snps[b].name) < 0;
+                      });
+        }
+        start = end;
+      }
+    }
+  } else {
+    // positions which do not fit in the key
+    vector<snpClass> &snps = manifest->snps;
+    vector<uint16_t> &chr = chromosome;
+    vector<long> &pos = position;
+    for (long i = 0; i < total; i++) order[i] = i;
+    stable_sort(order.begin(), order.end(), [&](long a, long b) {
+        if (chr[a] != chr[b]) return rank[chr[a]] < rank[chr[b]];
+        if (pos[a] != pos[b]) return pos[a] < pos[b];
+        return byName && snps[a].name.compare(snps[b].name) < 0;
+      });
+  }
+}
+
+///////////////////////////////////////////////
+//
+// void Manifest::select_fields(int fields)
+// void Manifest::select_chromosome(string chromosome)
+// void Manifest::select_region(string chromosome,
+//                              long start, long end)
+// void Manifest::select_names(const vector<string> &names)
+//
+// Choose the fields to decode, and the SNPs to keep,
+// when the manifest is parsed; see Manifest.h. A
+// manifest is only cached if it is read whole.
+//
+// If required, must be called before Manifest::open().
+//
+///////////////////////////////////////////////
+
+void Manifest::select_fields(int fields) {
+
+  selectedFields = fields;
+
+}
+
+void Manifest::select_chromosome(string chromosome) {
+
+  selectedChromosomes.push_back(chromosome);
+
+}
+
+void Manifest::select_region(string chromosome, long start, long end) {
+
+  Region region;
+  region.chromosome = chromosome;
+  region.start = start;
+  region.end = end;
+  selectedRegions.push_back(region);
+
+}
+
+void Manifest::select_names(const vector<string> &names) {
+
+  selectedNames.insert(selectedNames.end(), names.begin(), names.end());
+  selectedNameIndex.build(selectedNames);
+
+}
+
+
+
 ///////////////////////////////////////////////
 //
 // void Manifest::exclude_cnvs()
@@ -967,59 +2282,52 @@ int Manifest::get_map_value (map<string, int>& mymap, const char* const treasure
 ///////////////////////////////////////////////
 
 string snpClass::toString() {
+  string snpString;
+  append(snpString);
+  return snpString;
+}
 
-  int bufSize = 1000;
-  char buffer[bufSize];
-  int n;
-  string i, s, p, nid, bsid;
-
-  try { // attempt to convert other data types to strings
-
-    n = snprintf(buffer, bufSize, "%d", index);        // index
-    if (n >= bufSize) { throw 1; }
-    i = string(buffer, n);
-
-    n = snprintf(buffer, bufSize, "%ld", position);    // position
-    if (n >= bufSize) { throw 1; }
-    p = string(buffer, n);
-
-    n = snprintf(buffer, bufSize, "%f", score);        // score
-    if (n >= bufSize) { throw 1; }
-    s = string(buffer, n);
-
-    n = snprintf(buffer, bufSize, "%d", normId);       // norm ID
-    if (n >= bufSize) { throw 1; }
-    nid = string(buffer, n);
-
-    if (this->BeadSetID != -1) { // BeadSetID, if any
-      n = snprintf(buffer, bufSize, "%d", this->BeadSetID);
-      if (n >= bufSize) { throw 1; }
-      bsid = string(buffer, n);
-    }
 
-  } catch (int param) {
-    cerr << "Error: String representation of SNP variable is too large for conversion buffer. Bad input or corrupt data in manifest?" << endl;
-    throw;
-  }
+///////////////////////////////////////////////
+//
+// void snpClass::append(string &out)
+//
+// Append the comma-delimited string of toString()
+// to 'out', without a temporary string per field.
+//
+///////////////////////////////////////////////
 
-  // generate the allele string
-  string a = string(1, snp[0]); // this constructor makes 1 copy of snp[0]
-  string b = string(1, snp[1]);
-  if (a=="?") { a = "N"; }
-  if (b=="?") { b = "N"; }
-  string alleles = "["+a+"/"+b+"]";
-  
-  // strands after normalization
-  string iStrandNorm = strandToString(iStrand, converted);
-  string cStrandNorm = strandToString(cStrand, converted);
+void snpClass::append(string &out) {
+  // a float printed with %f has at most 48 characters
+  char buffer[64];
+  int n;
 
   // .bpm.csv fields: "Index,Name,Chromosome,Position,GenTrain Score,SNP,ILMN Strand,Customer Strand,NormID"
-  string snpString = i+","+name+","+chromosome+","+p+","+s+","+alleles+\
-    ","+iStrandNorm+","+cStrandNorm+","+nid;
+  n = snprintf(buffer, sizeof(buffer), "%d,", index);
+  out.append(buffer, n);
+  out += name;
+  out += ',';
+  out += chromosome;
+  n = snprintf(buffer, sizeof(buffer), ",%ld,%f,[", position, score);
+  out.append(buffer, n);
+
+  // the allele string
+  out += snp[0] == '?' ? 'N' : snp[0];
+  out += '/';
+  out += snp[1] == '?' ? 'N' : snp[1];
+  out += "],";
 
-  if (this->BeadSetID != -1) { snpString = snpString+","+bsid; }
-
-  return snpString;
+  // strands after normalization
+  out += strandToString(iStrand, converted);
+  out += ',';
+  out += strandToString(cStrand, converted);
+
+  n = snprintf(buffer, sizeof(buffer), ",%d", normId);
+  out.append(buffer, n);
+  if (this->BeadSetID != -1) { // BeadSetID, if any
+    n = snprintf(buffer, sizeof(buffer), ",%d", this->BeadSetID);
+    out.append(buffer, n);
+  }
 }
 
 
@@ -1050,6 +2358,112 @@ string snpClass::strandToString(char strand, bool converted) {
   return normStrand;
 }
 
+///////////////////////////////////////////////
+//
+// RegionIndex::RegionIndex(Manifest *manifest)
+//
+// The SNPs of each chromosome must be together,
+// in order of position, as order_by_locus() leaves
+// them; the order of the chromosomes themselves
+// does not matter.
+//
+///////////////////////////////////////////////
+
+RegionIndex::RegionIndex(Manifest *manifest) {
+  vector<snpClass> &snps = manifest->snps;
+  long total = snps.size();
+  positions.resize(total);
+  for (long i = 0; i < total; i++) {
+    const snpClass &snp = snps[i];
+    if (i == 0 || snp.chromosome != snps[i-1].chromosome) {
+      if (chromosomes.count(snp.chromosome)) {
+        throw "Manifest is not in locus order: chromosome " + snp.chromosome + " is split";
+      }
+      chromosomes[snp.chromosome] = chromosomeNames.size();
+      chromosomeNames.push_back(snp.chromosome);
+      offsets.push_back(i);
+    } else if (snp.position < positions[i-1]) {
+      throw "Manifest is not in locus order at SNP " + snp.name;
+    }
+    positions[i] = snp.position;
+  }
+  offsets.push_back(total);
+}
+
+///////////////////////////////////////////////
+//
+// bool RegionIndex::find(string chromosome,
+//                        long start, long end,
+//                        long &first, long &last)
+//
+// Find the SNPs on 'chromosome' with position from
+// 'start' to 'end' inclusive; they are the SNPs
+// 'first' to 'last' inclusive of the manifest.
+// Returns false if there are none, with 'last' one
+// less than 'first'.
+//
+///////////////////////////////////////////////
+
+bool RegionIndex::find(string chromosome, long start, long end, long &first, long &last) const {
+  map<string, size_t>::const_iterator c = chromosomes.find(chromosome);
+  if (c == chromosomes.end()) {
+    first = 0;
+    last = -1;
+    return false;
+  }
+  vector<long>::const_iterator begin = positions.begin() + offsets[c->second];
+  vector<long>::const_iterator stop = positions.begin() + offsets[c->second + 1];
+  first = lower_bound(begin, stop, start) - positions.begin();
+  last = upper_bound(begin + (first - offsets[c->second]), stop, end) - positions.begin() - 1;
+  if (last < first) last = first - 1;
+  return last >= first;
+}
+
+bool RegionIndex::find(string region, long &first, long &last) const {
+  string chromosome;
+  long start, end;
+  parse(region, chromosome, start, end);
+  return find(chromosome, start, end, first, last);
+}
+
+///////////////////////////////////////////////
+//
+// void RegionIndex::parse(string region,
+//                         string &chromosome,
+//                         long &start, long &end)
+//
+// Parse a region given as 'chr', 'chr:start' or
+// 'chr:start-end'. Positions are inclusive and may
+// contain commas, e.g. 1:10,000-20,000. Without an
+// end, the region runs to the end of the chromosome.
+//
+///////////////////////////////////////////////
+
+void RegionIndex::parse(string region, string &chromosome, long &start, long &end) {
+  size_t colon = region.rfind(':');
+  chromosome = region.substr(0, colon);
+  start = 0;
+  end = LONG_MAX;
+  if (chromosome.empty()) throw "Invalid region '" + region + "': no chromosome";
+  if (colon == string::npos) return;
+
+  string range;
+  for (size_t i = colon + 1; i < region.size(); i++) {
+    if (region[i] != ',') range += region[i];
+  }
+  size_t dash = range.find('-');
+  string from = range.substr(0, dash);
+  string to = dash == string::npos ? "" : range.substr(dash + 1);
+  char *rest;
+  if (from.empty()) throw "Invalid region '" + region + "': no start position";
+  start = strtol(from.c_str(), &rest, 10);
+  if (*rest || start < 0) throw "Invalid region '" + region + "': bad start position";
+  if (!to.empty()) {
+    end = strtol(to.c_str(), &rest, 10);
+    if (*rest || end < start) throw "Invalid region '" + region + "': bad end position";
+  }
+}
+
 
 
 // EOF
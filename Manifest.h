@@ -34,12 +34,11 @@
 #define _MANIFEST_H
 
 #include <map>
+#include <set>
+#include <stdint.h>
 #include <string>
 #include <vector>
-
-#ifndef SWIG
-#include <unordered_map>  // SGI extension to C++ STL standard
-#endif
+#include "NameIndex.h"
 
 using namespace std;
 
@@ -65,6 +64,7 @@ class snpClass {
   };
 
   string toString();
+  void append(string &out); // append toString() to out
   string strandToString(char strand, bool converted);
 
   int index;
@@ -81,7 +81,7 @@ class snpClass {
   bool converted; // has SNP been converted from original to ILMN top strand?
   // converted=true changes output of toString(), but not the iStrand and cStrand variables (which represent the original values)
 
-  bool operator<(snpClass other) const {
+  bool operator<(const snpClass &other) const {
     if (chromosome.compare(other.chromosome)) {
       return (chromosome.compare(other.chromosome) < 0);
     }
@@ -93,15 +93,6 @@ class snpClass {
 };
 
 
-struct eqstr
-{
-  bool operator()(string s1, string s2) const
-    {
-        return s1.compare(s2) == 0;
-    }
-};
-	   
-
 class Manifest {
 public:
 	Manifest();
@@ -109,15 +100,64 @@ public:
 	void open(string filename, bool wide = false);
 	void open (string filename, string chromosome, bool wide = false);
 
+	// Fields of each SNP to decode: a sum of the *_FIELD values. The
+	// name, chromosome, position and index are always decoded; others
+	// keep the snpClass defaults. Must be called before open().
+	enum { SCORE_FIELD = 1, ALLELE_FIELDS = 2, NORMID_FIELD = 4,
+		   BEADSETID_FIELD = 8, ALL_FIELDS = 15 };
+	void select_fields(int fields);
+
+	// Keep only SNPs which pass every kind of test selected, as each
+	// line is parsed, so others are never stored. Each may be called
+	// more than once to select a further chromosome, region or names.
+	// Must be called before open().
+	void select_chromosome(string chromosome);
+	void select_region(string chromosome, long start, long end); // inclusive
+	void select_names(const vector<string> &names);
+
 	void order_by_position();
-    void order_by_locus();
+    void order_by_locus(bool numeric = false);
+	void locus_order(vector<long> &order, bool numeric = false);
 
 	string filename;
 
+	// Where to keep a binary cache of the parsed manifest; see open().
+	// Empty for no cache. Defaults to $SIMTOOLS_MANIFEST_CACHE.
+	string cachePath;
+
 	vector<snpClass> snps; // If your code removes elements from this vector after
 		 		// it's been populated, for now you must not use code
-				// which uses the hash_map snpNames for lookup.
+				// which uses the name index for lookup.
 	map<int,int> normIdMap;
+
+	// Class of each probe, by index - 1 as in the arrays of a GTC file:
+	// a sum of the *_PROBE bits, found when the manifest is opened. CNV
+	// probes have "cnv" anywhere in their name, though exclude_cnvs() only
+	// drops those beginning with it; indel (alleles D/I) and intensity
+	// only (allele A of N) probes are only known if ALLELE_FIELDS are
+	// selected. An index with no SNP in the manifest, e.g. one not
+	// selected, is UNSELECTED_PROBE.
+	enum { CNV_PROBE = 1, INDEL_PROBE = 2, INTENSITY_ONLY_PROBE = 4,
+		   UNSELECTED_PROBE = 8 };
+	vector<uint8_t> probeClasses;
+	// Chromosome of each probe, by index - 1, as its position in
+	// chromosomeNames, in order of first appearance
+	vector<uint16_t> probeChromosomes;
+	vector<string> chromosomeNames;
+
+	int probe_class(const snpClass &snp) const {
+		size_t i = snp.index - 1;
+		return i < probeClasses.size() ? probeClasses[i] : (int) UNSELECTED_PROBE;
+	}
+	int chromosome_id(string chromosome) const; // -1 if not in the manifest
+	static bool cnv_name(const char *name, size_t length); // "cnv" anywhere
+
+	// Count the probes whose class has none of the 'exclude' bits, and
+	// are on the given chromosome (all if -1), and of those the ones
+	// with a score of at least cutOff. Scores are by index - 1.
+	void count_passing(const vector<float> &scores, double cutOff, int exclude,
+					   long &pass, long &total, int chromosome = -1) const;
+
 	void dump(void);
 
 	snpClass* lookup_SNP_by_name (string snpname);  // Caller must delete object returned.
@@ -130,14 +170,49 @@ public:
 
 	string get_chromosome_for_SNP (string snpname);
 
-	int snp2idx(char *snp) { return snpNames.find(snp) == snpNames.end() ? -1 : snpNames[snp]; }
+	int snp2idx(char *snp);
 
 	void exclude_cnvs();
 
+	// A description of the selections made, equal for two manifests
+	// only if they select the same SNPs and fields
+	string selection_key();
+
+	// Approximate bytes of memory used by the SNPs and their index
+	size_t memory_size();
+
 	void write(string outpath); // write normalized .bpm.csv to file
+	// write normalized .bpm.csv of a manifest file, without loading it
+	void normalize(string inPath, string outPath, bool wide = false, int threads = 1);
 
  protected:
    void populate_hashmap();
+	void classify_probes();
+	string csv_header();
+	string cache_file(string filename);
+	bool read_cache(string cachefile, string path, bool wide);
+	void write_cache(string cachefile, string path, bool wide, uint64_t size,
+					 int64_t time, uint64_t hash);
+	// A line-aligned part of a manifest, and what parse_lines() found in it
+	struct ParseChunk {
+	  const char *begin;
+	  const char *end;
+	  vector<snpClass> snps; // the SNPs selected
+	  set<int> normIds;      // of every line, selected or not
+	  long lines;
+	  string error;
+	};
+	void parse_csv(string filename, const char *data, const char *end,
+				   bool wide, int fields, vector<ParseChunk> &parsed);
+	void parse_header(string filename, const char *data, const char *end,
+					  bool wide, int cols[], const char *&line,
+					  const char *&dataEnd);
+	void parse_lines(bool wide, const int cols[], int fields, ParseChunk *chunk);
+	void parse_bpm(const char *data, const char *end, int fields, ParseChunk *chunk);
+	bool selected(const char *name, size_t nameLength,
+				  const char *chromosome, size_t chromLength);
+	bool in_selected_region(const char *chromosome, size_t chromLength,
+							long position);
 	void convert (snpClass* snip, std::string input_snp); // Convert BOT SNPs to TOP format. 
 	void test_convert();
     
@@ -145,20 +220,89 @@ public:
 
 	int get_map_value (map<string, int>& mymap, const char* const treasure);
 
-	// For fast lookup by SNP name. Key = name of SNP. Value = index in "snps" vector.
-#ifdef SWIG
-	map<string, int> snpNames;
-#else
-	unordered_map<string, int, hash<string>, eqstr> snpNames;
-#endif
-
-	string selectedChromosome; // Used if we are only concerned with a specific chromosome.
+	// For fast lookup by SNP name: index in "snps" of each name, which
+	// is not copied. Loaded from the cache, if any.
+	NameIndex nameIndex;
+
+	// Order of snps by locus, or empty if not known; cleared when the
+	// order of snps is changed.
+	vector<uint32_t> locusOrder;
+
+	// Selection of SNPs and fields; see select_fields() etc.
+	int selectedFields;
+	vector<string> selectedChromosomes;
+	struct Region {
+	  string chromosome;
+	  long start;
+	  long end;
+	};
+	vector<Region> selectedRegions;
+	vector<string> selectedNames;
+	NameIndex selectedNameIndex;
 
 	bool EXCLUDE_CNVS;
 
 	bool hasBeadSetID; // is extra BeadSetID column present?
 
+	// Slots for the column numbers passed to parse_lines()
+	enum { INDEX_COL, NAME_COL, CHROM_COL, POS_COL, SCORE_COL, SNP_COL,
+		   I_COL, C_COL, NORMID_COL, BEADSETID_COL, NUM_COLS };
+
+	// Least amount of a file worth parsing in a thread of its own
+	static const long MIN_CHUNK_BYTES = 4 << 20;
+
+	// Size of the output buffer of write(), and of the windows of
+	// normalize()
+	static const size_t WRITE_BUFFER_BYTES = 4 << 20;
+
 };
 
 
+class ManifestColumns {
+ // Columnar view of the SNPs of a Manifest, for sorting and scanning
+ // without going through the strings of each snpClass. Entry i of each
+ // array is for manifest->snps[i] as it was when the view was made.
+ //
+ // Chromosomes are coded as small integers, numbered in lexical order of
+ // their names, so that comparing codes compares names.
+
+ public:
+  ManifestColumns(Manifest *manifest);
+  void sort(vector<long> &order, bool byName = true, bool numeric = false);
+
+  vector<string> chromosomeNames; // name of each chromosome code
+  vector<uint16_t> chromosome;
+  vector<long> position;
+  vector<int> normId;
+  vector<int> index;
+  vector<char> alleles;           // allele A and B of each SNP
+
+ private:
+  Manifest *manifest;
+
+  static const int POSITION_BITS = 48;
+};
+
+class RegionIndex {
+ // Index of the SNPs of a Manifest in locus order, e.g. after
+ // Manifest::order_by_locus(), for finding the SNPs in a genomic
+ // region. Each chromosome is a contiguous run of SNPs; the run is
+ // found in a table of offsets, and the region within it by binary
+ // search of the positions.
+
+ public:
+  RegionIndex(Manifest *manifest);
+  bool find(string chromosome, long start, long end, long &first, long &last) const;
+  bool find(string region, long &first, long &last) const;
+
+  static void parse(string region, string &chromosome, long &start, long &end);
+
+  vector<string> chromosomeNames; // in the order of the manifest
+  vector<long> offsets;           // first SNP of each chromosome, and the total
+  vector<long> positions;         // position of each SNP
+
+ private:
+  map<string, size_t> chromosomes;
+};
+
 #endif // _MANIFEST_H
@@ -0,0 +1,135 @@
+//
+// ManifestCache.cpp
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ManifestCache.h"
+
+#include <cstdlib>
+
+using namespace std;
+
+ManifestCache::ManifestCache() {
+  const char *size = getenv("SIMTOOLS_MANIFEST_CAPACITY");
+  const char *memory = getenv("SIMTOOLS_MANIFEST_MEMORY");
+  capacity = size == NULL ? DEFAULT_CAPACITY : strtoul(size, NULL, 10);
+  memoryLimit = memory == NULL ? 0 : strtoul(memory, NULL, 10) << 20;
+  if (capacity < 1) capacity = 1;
+  hits = misses = evictions = 0;
+  bytes = 0;
+}
+
+ManifestCache::ManifestCache(size_t capacity, size_t memoryLimit) {
+  this->capacity = capacity < 1 ? 1 : capacity;
+  this->memoryLimit = memoryLimit;
+  hits = misses = evictions = 0;
+  bytes = 0;
+}
+
+ManifestCache::~ManifestCache() {
+  clear();
+}
+
+Manifest *ManifestCache::get(string path) {
+  return open(new Manifest(), path);
+}
+
+Manifest *ManifestCache::open(Manifest *manifest, string path, bool *loaded) {
+  lock_guard<mutex> guard(lock);
+  if (loaded) *loaded = false;
+  char *real = realpath(path.c_str(), NULL);
+  string key = real == NULL ? path : string(real);
+  free(real);
+  key += '\n' + manifest->selection_key();
+
+  for (list<Entry>::iterator e = entries.begin(); e != entries.end(); e++) {
+    if (e->key == key) {
+      hits++;
+      delete manifest;
+      entries.splice(entries.begin(), entries, e);
+      lastReturned[this_thread::get_id()] = e->manifest;
+      return e->manifest;
+    }
+  }
+
+  // Other threads wait while the manifest is read, rather than read it
+  // too
+  misses++;
+  manifest->open(path);
+  if (loaded) *loaded = true;
+  Entry entry;
+  entry.key = key;
+  entry.manifest = manifest;
+  entry.bytes = manifest->memory_size();
+  entries.push_front(entry);
+  bytes += entry.bytes;
+  lastReturned[this_thread::get_id()] = manifest;
+  evict();
+  return manifest;
+}
+
+void ManifestCache::release() {
+  lock_guard<mutex> guard(lock);
+  lastReturned.erase(this_thread::get_id());
+  evict();
+}
+
+// Delete the least recently used manifests while over the limits, but
+// never one pinned by a thread
+void ManifestCache::evict() {
+  list<Entry>::iterator e = entries.end();
+  while (e != entries.begin() &&
+         (entries.size() > capacity || (memoryLimit > 0 && bytes > memoryLimit))) {
+    e--;
+    bool pinned = false;
+    for (map<thread::id, Manifest*>::iterator t = lastReturned.begin();
+         t != lastReturned.end(); t++) {
+      pinned |= t->second == e->manifest;
+    }
+    if (pinned) continue;
+    bytes -= e->bytes;
+    delete e->manifest;
+    e = entries.erase(e);
+    evictions++;
+  }
+}
+
+void ManifestCache::clear() {
+  lock_guard<mutex> guard(lock);
+  lastReturned.clear();
+  for (list<Entry>::iterator e = entries.begin(); e != entries.end(); e++) {
+    delete e->manifest;
+  }
+  entries.clear();
+  bytes = 0;
+}
+
+void ManifestCache::report(ostream &out) {
+  lock_guard<mutex> guard(lock);
+  out << "Manifest cache: " << hits << " hits, " << misses << " misses, "
+      << evictions << " evictions, " << entries.size() << " manifests of "
+      << (bytes >> 20) << " MB held" << endl;
+}
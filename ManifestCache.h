@@ -0,0 +1,103 @@
+//
+// ManifestCache.h
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _MANIFESTCACHE_H
+#define _MANIFESTCACHE_H
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include "Manifest.h"
+
+// Loaded manifests, kept for reuse by the resolved path of the file and
+// the selection made before loading, and evicted least recently used
+// first when there are more than 'capacity' of them, or they use more
+// than 'memoryLimit' bytes. The manifest most recently returned to each
+// thread is pinned, and never evicted, until that thread's next call or
+// its call of release(). A thread which has finished with the cache must
+// call release() before it exits, as its pin would otherwise outlive it,
+// and pass to a later thread given the same id.
+//
+// The cache owns the manifests it returns; they must not be deleted.
+// The same object is returned each time, so a change made to it, e.g.
+// by order_by_locus(), is seen by the next user. get() and open() may be
+// called from several threads, but a manifest shared by threads must
+// then only be read.
+
+class ManifestCache {
+
+ public:
+  // capacity and memory limit (MB, 0 for none) from the environment
+  // variables SIMTOOLS_MANIFEST_CAPACITY and SIMTOOLS_MANIFEST_MEMORY
+  ManifestCache();
+  ManifestCache(size_t capacity, size_t memoryLimit = 0);
+  ~ManifestCache();
+
+  // the whole manifest at 'path'
+  Manifest *get(std::string path);
+
+  // the manifest at 'path' with the selections made on 'manifest',
+  // which the cache takes, and may delete; if opening fails, the
+  // error is thrown and 'manifest' is not taken. If 'loaded' is given,
+  // it is set to whether the file was read.
+  Manifest *open(Manifest *manifest, std::string path, bool *loaded = NULL);
+
+  // unpin the manifest last returned to the calling thread, which must
+  // not use it after this
+  void release();
+
+  void clear();
+  void report(std::ostream &out);
+
+  size_t capacity;
+  size_t memoryLimit;  // bytes, or 0 for no limit
+  long hits;
+  long misses;
+  long evictions;
+
+  static const size_t DEFAULT_CAPACITY = 4;
+
+ private:
+  struct Entry {
+    std::string key;
+    Manifest *manifest;
+    size_t bytes;
+  };
+  std::list<Entry> entries;  // most recently used first
+  size_t bytes;
+  std::map<std::thread::id, Manifest*> lastReturned;  // pinned, by thread
+  std::mutex lock;
+
+  void evict();
+};
+
+#endif // _MANIFESTCACHE_H
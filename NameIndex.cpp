@@ -0,0 +1,62 @@
+//
+// NameIndex.cpp
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "NameIndex.h"
+
+using namespace std;
+
+uint64_t NameIndex::hash(const char *data, size_t length) {
+  // FNV-1a; slots saved by the manifest cache depend on it
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char) data[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+void NameIndex::renumber(const vector<uint32_t> &moved) {
+  for (size_t s = 0; s < slots.size(); s++) {
+    if (slots[s] != 0) slots[s] = moved[slots[s] - 1] + 1;
+  }
+}
+
+void NameArena::reserve(size_t names, size_t bytes) {
+  offsets.reserve(names + 1);
+  chars.reserve(bytes + names);
+}
+
+void NameArena::add(const char *name, size_t length) {
+  chars.insert(chars.end(), name, name + length);
+  chars.push_back('\0');
+  offsets.push_back(chars.size());
+}
+
+void NameArena::clear() {
+  chars.clear();
+  offsets.assign(1, 0);
+}
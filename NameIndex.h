@@ -0,0 +1,130 @@
+//
+// NameIndex.h
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _NAMEINDEX_H
+#define _NAMEINDEX_H
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Index of SNP names by open addressing, over names which are held
+// elsewhere, e.g. in the 'name' member of each SNP in a vector, or in a
+// vector of strings, so that no name is copied into the index. Each slot holds the position of a
+// name in the vector + 1, or 0 if empty; the table is at most half full.
+// If a name occurs more than once, the index finds the last one.
+
+class NameIndex {
+
+ public:
+  static uint64_t hash(const char *data, size_t length);
+
+  // index the names of all of 'items', which must be unchanged while
+  // the index is in use
+  template <class T> void build(const std::vector<T> &items);
+
+  // position in 'items' of the named item, or -1 if none
+  template <class T> long find(const std::vector<T> &items,
+                               const char *name, size_t length) const;
+  template <class T> long find(const std::vector<T> &items,
+                               const std::string &name) const {
+    return find(items, name.data(), name.length());
+  }
+
+  // renumber the slots after 'items' are reordered; the item at
+  // position i is now at moved[i]
+  void renumber(const std::vector<uint32_t> &moved);
+
+  void clear() { slots.clear(); }
+  bool empty() const { return slots.empty(); }
+
+  // name of an item
+  static const std::string &key(const std::string &name) { return name; }
+  template <class T> static const std::string &key(const T &item) { return item.name; }
+
+  std::vector<uint32_t> slots;
+
+};
+
+// Names packed end to end in one buffer, each identified by the order in
+// which it was added. Saves the header and allocation of a string for
+// each of millions of SNP names which are never changed.
+
+class NameArena {
+
+ public:
+  void reserve(size_t names, size_t bytes);
+  void add(const char *name, size_t length);
+  void add(const std::string &name) { add(name.data(), name.length()); }
+  void clear();
+
+  const char *data(size_t id) const { return &chars[offsets[id]]; }
+  size_t length(size_t id) const { return offsets[id + 1] - offsets[id] - 1; }
+  std::string operator[](size_t id) const { return std::string(data(id), length(id)); }
+  size_t size() const { return offsets.size() - 1; }
+  bool empty() const { return offsets.size() <= 1; }
+
+  NameArena() : offsets(1, 0) {}
+
+ private:
+  std::vector<char> chars;      // each name is followed by a NUL
+  std::vector<uint64_t> offsets; // start of each name, then end of the last
+
+};
+
+template <class T> void NameIndex::build(const std::vector<T> &items) {
+  uint32_t numSlots = 1;
+  while (numSlots < 2 * (uint64_t) items.size()) numSlots *= 2;
+  slots.assign(numSlots, 0);
+  uint32_t mask = numSlots - 1;
+  for (uint32_t i = 0; i < items.size(); i++) {
+    const std::string &name = key(items[i]);
+    uint32_t slot = hash(name.data(), name.length()) & mask;
+    while (slots[slot] != 0 && key(items[slots[slot] - 1]) != name) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = i + 1;
+  }
+}
+
+template <class T> long NameIndex::find(const std::vector<T> &items,
+                                        const char *name, size_t length) const {
+  if (slots.empty()) return -1;
+  uint32_t mask = slots.size() - 1;
+  for (uint32_t slot = hash(name, length) & mask; slots[slot] != 0;
+       slot = (slot + 1) & mask) {
+    const std::string &other = key(items[slots[slot] - 1]);
+    if (other.length() == length && memcmp(other.data(), name, length) == 0) {
+      return slots[slot] - 1;
+    }
+  }
+  return -1;
+}
+
+#endif // _NAMEINDEX_H
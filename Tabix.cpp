@@ -0,0 +1,151 @@
+//
+// Tabix.cpp
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "Tabix.h"
+
+#include <cstring>
+
+using namespace std;
+
+// tabix's bin of the metadata of a sequence, and the shift from a
+// position to its 16kb linear index window
+static const int META_BIN = 37450;
+static const int LINEAR_SHIFT = 14;
+static const uint64_t UNSET = ~(uint64_t) 0;
+
+TabixIndex::TabixIndex() {
+  lastBegin = 0;
+}
+
+// The smallest bin of the UCSC binning scheme which holds positions
+// begin to end - 1, as in the SAM specification
+int TabixIndex::bin(long begin, long end) {
+  if (begin < 0) begin = 0;
+  if (end <= begin) end = begin + 1;
+  --end;
+  if (begin >> 14 == end >> 14) return ((1 << 15) - 1) / 7 + (begin >> 14);
+  if (begin >> 17 == end >> 17) return ((1 << 12) - 1) / 7 + (begin >> 17);
+  if (begin >> 20 == end >> 20) return ((1 << 9) - 1) / 7 + (begin >> 20);
+  if (begin >> 23 == end >> 23) return ((1 << 6) - 1) / 7 + (begin >> 23);
+  if (begin >> 26 == end >> 26) return ((1 << 3) - 1) / 7 + (begin >> 26);
+  return 0;
+}
+
+void TabixIndex::add(const string &sequence, long begin, long end,
+                     uint64_t start, uint64_t finish) {
+  // A record at position 0, e.g. of an unplaced probe, is indexed as
+  // if at position 1, as by tabix
+  if (begin < 0) begin = 0;
+  if (sequences.empty() || sequences.back().name != sequence) {
+    if (seen.count(sequence)) {
+      throw "Records of sequence " + sequence + " are not together, so cannot be indexed";
+    }
+    seen[sequence] = sequences.size();
+    sequences.push_back(Sequence());
+    sequences.back().name = sequence;
+    sequences.back().start = start;
+    sequences.back().records = 0;
+  } else if (begin < lastBegin) {
+    throw "Records of sequence " + sequence + " are not in order of position, so cannot be indexed";
+  }
+  lastBegin = begin;
+  if (end <= begin) end = begin + 1;
+
+  Sequence &s = sequences.back();
+  vector<Chunk> &chunks = s.bins[bin(begin, end)];
+  if (!chunks.empty() && chunks.back().second == start) {
+    chunks.back().second = finish;
+  } else {
+    chunks.push_back(Chunk(start, finish));
+  }
+  size_t last = (end - 1) >> LINEAR_SHIFT;
+  if (s.intervals.size() <= last) s.intervals.resize(last + 1, UNSET);
+  for (size_t w = begin >> LINEAR_SHIFT; w <= last; w++) {
+    if (s.intervals[w] == UNSET) s.intervals[w] = start;
+  }
+  s.finish = finish;
+  s.records++;
+}
+
+static void append32(string &out, uint32_t value) {
+  for (int i = 0; i < 4; i++) out += (char) ((value >> (8 * i)) & 0xff);
+}
+
+static void append64(string &out, uint64_t value) {
+  for (int i = 0; i < 8; i++) out += (char) ((value >> (8 * i)) & 0xff);
+}
+
+void TabixIndex::write(string path, const BgzfWriter &data) {
+  string out("TBI\1", 4);
+  append32(out, sequences.size());
+  append32(out, 2);    // format: VCF
+  append32(out, 1);    // columns of the sequence name,
+  append32(out, 2);    // start position
+  append32(out, 0);    // and end position, which VCF does not have
+  append32(out, '#');  // header lines start with this
+  append32(out, 0);    // lines to skip
+  string names;
+  for (size_t i = 0; i < sequences.size(); i++) {
+    names += sequences[i].name;
+    names += '\0';
+  }
+  append32(out, names.size());
+  out += names;
+
+  for (size_t i = 0; i < sequences.size(); i++) {
+    Sequence &s = sequences[i];
+    append32(out, s.bins.size() + 1);
+    for (map<int, vector<Chunk> >::iterator b = s.bins.begin(); b != s.bins.end(); b++) {
+      append32(out, b->first);
+      append32(out, b->second.size());
+      for (size_t c = 0; c < b->second.size(); c++) {
+        append64(out, data.virtual_offset(b->second[c].first));
+        append64(out, data.virtual_offset(b->second[c].second));
+      }
+    }
+    // the extent of the sequence's records, and how many there are
+    append32(out, META_BIN);
+    append32(out, 2);
+    append64(out, data.virtual_offset(s.start));
+    append64(out, data.virtual_offset(s.finish));
+    append64(out, s.records);
+    append64(out, 0);
+
+    // a window with no record takes the offset of the one before
+    append32(out, s.intervals.size());
+    uint64_t offset = 0;
+    for (size_t w = 0; w < s.intervals.size(); w++) {
+      if (s.intervals[w] != UNSET) offset = data.virtual_offset(s.intervals[w]);
+      append64(out, offset);
+    }
+  }
+
+  BgzfWriter index(path);
+  index.write(out);
+  index.close();
+}
@@ -0,0 +1,74 @@
+//
+// Tabix.h
+//
+// Copyright (c) 2026 Genome Research Ltd.
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met:
+// 1. Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright 
+// notice, this list of conditions and the following disclaimer in the 
+// documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Genome Research Ltd nor the names of the 
+// contributors may be used to endorse or promote products derived from 
+// software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR 
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL GENOME RESEARCH LTD. BE LIABLE FOR ANY DIRECT, INDIRECT, 
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF 
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF 
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _TABIX_H
+#define _TABIX_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Bgzf.h"
+
+// A tabix (.tbi) index of a BGZF-compressed VCF file, built as its
+// records are written rather than by reading the file again. Records
+// must be added in the order they are written: all those of a sequence
+// together, in order of position. Errors are thrown as strings.
+
+class TabixIndex {
+
+ public:
+  TabixIndex();
+
+  // a record of 'sequence' covering 0-based positions begin to end - 1,
+  // written from BGZF position start to finish, as given by
+  // BgzfWriter::tell()
+  void add(const std::string &sequence, long begin, long end,
+           uint64_t start, uint64_t finish);
+
+  // write the index of 'data', which must be closed, to 'path'
+  void write(std::string path, const BgzfWriter &data);
+
+  static int bin(long begin, long end);
+
+ private:
+  typedef std::pair<uint64_t, uint64_t> Chunk;  // start, finish
+  struct Sequence {
+    std::string name;
+    std::map<int, std::vector<Chunk> > bins;
+    std::vector<uint64_t> intervals;  // first record in each 16kb window
+    uint64_t start, finish;
+    uint64_t records;
+  };
+  std::vector<Sequence> sequences;
+  std::map<std::string, size_t> seen;
+  long lastBegin;
+};
+
+#endif // _TABIX_H
@@ -38,8 +38,11 @@
 
 #include "commands.h"
 #include "Sim.h"
+#include "BafLrr.h"
+#include "Caller.h"
 #include "Gtc.h"
 #include "Egt.h"
+#include "ClusterTable.h"
 #include "Fcr.h"
 #include "QC.h"
 #include "Manifest.h"
@@ -67,6 +70,7 @@ Commander::Commander() {
 void Commander::loadManifest(Manifest *manifest, string manfile)
 {
   if (manfile == "") throw("No manifest file specified");
+  manifest->select_fields(Manifest::ALLELE_FIELDS | Manifest::NORMID_FIELD);
   manifest->open(manfile);
 }
 
@@ -188,7 +192,7 @@ void Commander::commandCreate(string infile, string outfile, bool normalize, str
   // We need a manifest file to sort the SNPs and to normalise the intensities (if required)
   loadManifest(manifest, manfile);
   // Sort the SNPs into position order
-  sort(manifest->snps.begin(), manifest->snps.end(), SNPSorter());
+  manifest->order_by_locus();
 
   // Create the SIM file and write the header
   sim->openOutput(outfile);
@@ -252,14 +256,20 @@ void Commander::commandCreate(string infile, string outfile, bool normalize, str
 // score, chr, pos, theta, R, X_normalized, Y_normalized, X_raw, Y_raw,
 // BAF, logR)
 //
+// If fastMath is true, theta and logR are computed with the FcrMath
+// approximations rather than libm; see FcrMath.h
+//
+// If cacheFile is given, EGT clusters matched to the manifest are read
+// from it, or written to it if absent or out of date; see ClusterTable.h
+//
 
-void Commander::commandFCR(string infile, string outfile, string manfile, string egtfile, bool verbose)
+void Commander::commandFCR(string infile, string outfile, string manfile, string egtfile, bool verbose, bool fastMath, string cacheFile)
 {
   vector<string> sampleNames;	// list of sample names from JSON input file
   vector<string> infiles;	// list of GTC files to process
   Manifest *manifest = new Manifest();
-  Egt *egt = new Egt();
-  FcrWriter *fcrWriter = new FcrWriter(); // Final Call Report generator
+  ClusterTable *clusters = new ClusterTable(verbose);
+  FcrWriter *fcrWriter = new FcrWriter(fastMath); // Final Call Report generator
   ofstream outFStream;
   ostream *outStream;
   if (outfile == "-") {
@@ -271,15 +281,117 @@ void Commander::commandFCR(string infile, string outfile, string manfile, string
   if (infile == "") throw("commandCreate(): infile not specified");
   parseInfile(infile, sampleNames, infiles);
   loadManifest(manifest, manfile);
-  egt->open(egtfile);
-  // now we have output stream, GTC paths, populated manifest and EGT
+  clusters->open(egtfile, manfile, manifest, cacheFile);
+  // now we have output stream, GTC paths, populated manifest and clusters
   // write output to an FCR file
-  fcrWriter->write(egt, manifest, outStream, infiles, sampleNames);
+  fcrWriter->write(clusters, manifest, outStream, infiles, sampleNames);
   delete manifest;
-  delete egt;
+  clusters->close();
+  delete clusters;
   delete fcrWriter;
 }
 
+//
+// Generate wide BAF and LRR matrices, one pair of files per chromosome
+//
+// outfile		is the prefix for output file names
+// binary		if true, write float32 binary instead of text
+// threads		is the number of samples to process in parallel
+// memory		is the budget in megabytes for transposing each chromosome
+// cacheFile	is an optional cluster table cache, as for commandFCR
+//
+void Commander::commandBafLrr(string infile, string outfile, string manfile, string egtfile, bool binary, int threads, long memory, bool verbose, bool fastMath, string cacheFile)
+{
+  vector<string> sampleNames;	// list of sample names from JSON input file
+  vector<string> infiles;	// list of GTC files to process
+  Manifest *manifest = new Manifest();
+  ClusterTable *clusters = new ClusterTable(verbose);
+  BafLrrWriter *writer = new BafLrrWriter(fastMath, threads, memory);
+  if (infile == "") throw("commandBafLrr(): infile not specified");
+  parseInfile(infile, sampleNames, infiles);
+  loadManifest(manifest, manfile);
+  clusters->open(egtfile, manfile, manifest, cacheFile);
+  int format = binary ? BafLrrWriter::BINARY : BafLrrWriter::TEXT;
+  writer->write(clusters, manifest, outfile, infiles, sampleNames, format, verbose);
+  delete manifest;
+  clusters->close();
+  delete clusters;
+  delete writer;
+}
+
+//
+// Call genotypes from a normalized SIM file and EGT clusters
+//
+// infile		is a SIM file name or '-' for stdin
+// outfile		is the PLINK dataset name, or name of the packed matrix file
+// matrix		if true, write a packed 2-bit matrix instead of PLINK BED
+// threshold	is the minimum score for a call; see Caller.h
+// threads		is the number of samples to call in parallel
+// memory		is the budget in megabytes for transposing calls to a SNP-major BED
+// cacheFile	is an optional cluster table cache, as for commandFCR
+//
+void Commander::commandCall(string infile, string outfile, string manfile, string egtfile, bool matrix, double threshold, int threads, long memory, bool verbose, string cacheFile)
+{
+  Sim *sim = new Sim();
+  Manifest *manifest = new Manifest();
+  ClusterTable *clusters = new ClusterTable(verbose);
+  sim->openInput(infile);
+  loadManifest(manifest, manfile);
+  clusters->open(egtfile, manfile, manifest, cacheFile);
+  // the SIM file has SNPs in position order
+  manifest->order_by_locus();
+  Caller *caller = new Caller(clusters, manifest, threshold);
+  int format = matrix ? Caller::MATRIX : Caller::BED;
+  caller->write(sim, manifest, outfile, format, threads, verbose, memory);
+  sim->close();
+  clusters->close();
+  delete caller;
+  delete clusters;
+  delete manifest;
+  delete sim;
+}
+
+//
+// Re-estimate EGT clusters from a normalized SIM file and GTC calls
+//
+// infile		is a SIM file name or '-' for stdin
+// gtcfile		lists the GTC files of the SIM samples, in the same order
+// outfile		is the cluster table to write; see ClusterTable.h
+// threads		is the number of samples to add in parallel
+// cacheFile	is an optional cluster table cache, as for commandFCR
+//
+void Commander::commandRecluster(string infile, string gtcfile, string outfile, string manfile, string egtfile, int threads, bool verbose, string cacheFile)
+{
+  vector<string> sampleNames;
+  vector<string> gtcfiles;
+  if (gtcfile == "") throw("commandRecluster(): GTC file list not specified");
+  if (outfile == "" || outfile == "-") {
+    throw("Cluster table needs an output file name, not standard output");
+  }
+  parseInfile(gtcfile, sampleNames, gtcfiles);
+  Sim *sim = new Sim();
+  Manifest *manifest = new Manifest();
+  ClusterTable *clusters = new ClusterTable(verbose);
+  sim->openInput(infile);
+  loadManifest(manifest, manfile);
+  clusters->open(egtfile, manfile, manifest, cacheFile);
+  // the SIM file has SNPs in position order
+  manifest->order_by_locus();
+  ClusterEstimator *estimator = new ClusterEstimator(manifest, threads);
+  estimator->add(sim, gtcfiles, verbose);
+  long changed = estimator->update(clusters);
+  if (verbose) {
+    cerr << "Updated " << changed << " clusters from "
+         << estimator->samples << " samples" << endl;
+  }
+  clusters->save(outfile, manfile);
+  sim->close();
+  clusters->close();
+  delete estimator;
+  delete clusters;
+  delete manifest;
+  delete sim;
+}
 
 //
 // Generate Illuminus output
@@ -290,8 +402,10 @@ void Commander::commandFCR(string infile, string outfile, string manfile, string
 // start_pos	is the Probe number (starting from 0) to start from
 // end_pos		is the Probe number (from 0 to numProbes-1) to end at, or -1
 // verbose		if true will display progress messages to stderr
+// region		if not empty, a region 'chr:start-end' whose probes are used
+//			instead of start_pos to end_pos
 //
-void Commander::commandIlluminus(string infile, string outfile, string manfile, int start_pos, int end_pos, bool verbose)
+void Commander::commandIlluminus(string infile, string outfile, string manfile, int start_pos, int end_pos, bool verbose, string region)
 {
   Sim *sim = new Sim();
   ofstream outFStream;
@@ -319,9 +433,17 @@ void Commander::commandIlluminus(string infile, string outfile, string manfile,
   // We need a manifest file to sort the SNPs
   loadManifest(manifest, manfile);
   // Sort the SNPs into position order
-  sort(manifest->snps.begin(), manifest->snps.end(), SNPSorter());
-
-  if (end_pos == -1) end_pos = sim->numProbes - 1;
+  manifest->order_by_locus();
+
+  if (region.size()) {
+    if (start_pos != 0 || end_pos != -1) throw("--region cannot be used with --start or --end");
+    long first, last;
+    RegionIndex regions(manifest);
+    if (!regions.find(region, first, last)) throw("No probes in region " + region);
+    start_pos = first;
+    end_pos = last;
+    if (verbose) cerr << "Region " << region << " has " << last - first + 1 << " probes" << endl;
+  } else if (end_pos == -1) end_pos = sim->numProbes - 1;
 
   // load the (relevant parts of) the SIM file
   if (verbose) cerr << "Reading SIM file " << infile << endl;
@@ -36,8 +36,12 @@
 #include <algorithm>
 
 #include "Sim.h"
+#include "BafLrr.h"
+#include "Caller.h"
+#include "ClusterEstimator.h"
 #include "Gtc.h"
 #include "Egt.h"
+#include "ClusterTable.h"
 #include "Fcr.h"
 #include "QC.h"
 #include "Manifest.h"
@@ -61,8 +65,11 @@ class Commander {
   void parseInfile(string infile, vector<string> &sampleNames, vector<string> &infiles);
   void commandView(string infile, bool verbose);
   void commandCreate(string infile, string outfile, bool normalize, string manfile, bool verbose);
-  void commandFCR(string infile, string outfile, string manfile, string egtfile, bool verbose);
-  void commandIlluminus(string infile, string outfile, string manfile, int start_pos, int end_pos, bool verbose);
+  void commandFCR(string infile, string outfile, string manfile, string egtfile, bool verbose, bool fastMath=false, string cacheFile="");
+  void commandBafLrr(string infile, string outfile, string manfile, string egtfile, bool binary, int threads, long memory, bool verbose, bool fastMath=false, string cacheFile="");
+  void commandCall(string infile, string outfile, string manfile, string egtfile, bool matrix, double threshold, int threads, long memory, bool verbose, string cacheFile="");
+  void commandRecluster(string infile, string gtcfile, string outfile, string manfile, string egtfile, int threads, bool verbose, string cacheFile="");
+  void commandIlluminus(string infile, string outfile, string manfile, int start_pos, int end_pos, bool verbose, string region="");
   void commandGenoSNP(string infile, string outfile, string manfile, int start_pos, int end_pos, bool verbose);
   void commandQC(string infile, string magnitude, string xydiff, bool verbose);
 
@@ -51,38 +51,41 @@
 #include <vector>
 #include <algorithm>
 #include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include "Gtc.h"
 #include "Manifest.h"
+#include "ManifestCache.h"
 #include "win2unix.h"
 #include "Sim.h"
 #include "json/json.h"
 #include "plink_binary.h"
 
-#define CACHESIZE 256
-#define GCCACHESIZE 32
+#define WRITE_BUFFER_BYTES (4 << 20)
 
 using namespace std;
 
 
-unordered_map<string,string> gtcHash;	// <sample_name, filename>
-Manifest *manifest = new Manifest();
-vector<string> sampleArray;
-unordered_map<string,float*> cache;
-unordered_map<string,string> gcCache;
-unordered_map<string,int> exclusionList;	// List of samples to exclude
-typedef unordered_map<string,fstream*> FileMap;
-FileMap outFile;
-FileMap::iterator pos;
-vector<string> filenameArray;
-vector<string> sampleNames;
-vector<string> gender_code;
-
-typedef unordered_map<string,ios::pos_type> PosMap;
-PosMap filePos;
-PosMap::iterator fp;
-
-Gtc gtc;
+//
+// The state of one run of g2i: the samples and manifest being converted,
+// and the output files made. Each output mode works on a Run, rather
+// than on globals, so that the work can be shared between threads.
+//
+struct Run {
+	unordered_map<string,string> gtcHash;	// <sample_name, filename>
+	Manifest *manifest;
+	ManifestCache manifests;
+	vector<string> sampleArray;
+	unordered_map<string,int> exclusionList;	// List of samples to exclude
+	vector<string> filenameArray;
+	vector<string> sampleNames;
+	vector<string> gender_code;
+	Gtc gtc;	// for the modes which read one GTC file at a time
+
+	Run() : manifest(new Manifest()) {}
+};
 
 // command line options
 bool verbose=false;
@@ -94,6 +97,8 @@ bool excludeCnv=false;
 bool includeCnv=false;
 bool excludeExo=false;
 bool normalise=true;
+long memoryBudget = 1024;	// MB for the data of a block of SNPs
+int threads = 1;
 string outputFile;
 string project;
 string manifestDir;
@@ -126,7 +131,9 @@ void displayUsage(void)
 	     << "-s               produce genotype calling data rather than Illuminus" << endl
 	     << "-m               produce SIM file rather than Illuminus" << endl
 	     << "-b               produce BED file rather than Illuminus" << endl
-	     << "-r <chromosome>  select samples for this chromosome only" << endl
+	     << "-M <megabytes>   memory for the data of a block of SNPs, or of samples in BED mode (default 1024); with more than one block, the data of all the samples go to a scratch file beside the output" << endl
+	     << "-j <threads>     number of threads to read GTC files and write chromosome files in Illuminus and genotype calling modes (default 1)" << endl
+	     << "-r <region>      select SNPs for this chromosome, or chr:start-end, only" << endl
 	     << "-p <project>     extract data for samples in this project ID from the Illumina LIMS" << endl
 	     << "-n               do NOT perform normalisation on intensities" << endl
 	     << "-c               exclude any SNPs beginning with cnv" << endl
@@ -140,94 +147,248 @@ void displayUsage(void)
 }
 
 
-void loadExclusionFile(string fname) 
+void loadExclusionFile(Run &run, string fname)
 {
 	ifstream f; 
 	string s;
 	f.open(fname.c_str());
 	while (f >> s) {
-		exclusionList[s] = 1;
+		run.exclusionList[s] = 1;
 		if (verbose) cout << timestamp() << "Excluding: " << s << endl;
 	}
 	f.close();
 }
 
-// Sort function to sort SNPs by position
-bool SortByPosition(const snpClass &snp1, const snpClass &snp2)
-{
-	if (snp1.chromosome.compare(snp2.chromosome))
-		return (snp1.chromosome.compare(snp2.chromosome) < 0);
-	if (snp1.position != snp2.position)
-		return (snp1.position < snp2.position);
-	return (snp1.name.compare(snp2.name) < 0);
-}
+// A chromosome file made by writeChromosomeFiles, and the rows waiting
+// to be written to it
+struct ChromosomeFile {
+	ofstream f;
+	string buffer;
+};
 
-// Sort function to sort SNPs by position for BED file
-bool SortByPositionBED(const snpClass &snp1, const snpClass &snp2)
+//
+// Write a file for each chromosome, with a row for each SNP, in locus
+// order: the 'prefix' of the SNP, then a Slot of data from each GTC file,
+// formatted by 'format' and padded with spaces to recordLength. Each Slot
+// is set by fill(gtc, snp, slot) when the GTC file, opened with the given
+// parts, is read.
+//
+// The slots of a block of SNPs, as many as fit in memoryBudget, are
+// collected in one matrix, addressed by the ordinal of the SNP in the
+// block, from every GTC file; then the rows are written. So each
+// chromosome file is written once, from start to end, in large writes.
+// If the SNPs do not all fit, each GTC file is still read only once: its
+// slots are spilled to a scratch file beside the output, one region per
+// block holding the slots of that block's SNPs for each GTC file in turn,
+// and the matrix of each block is then read back from its region. The
+// scratch file holds the slots of every SNP of every GTC file.
+//
+// With more than one thread, the GTC files are shared out between
+// reader threads, each with its own Gtc, and the chromosomes of a block
+// between writer threads; and a block is read into one of two matrices
+// while the block before it is written from the other.
+//
+template <class Slot, class Fill, class Prefix, class Format>
+void writeChromosomeFiles(Run &run, string fname, string suffix, string header, int parts,
+                          size_t recordLength, Fill fill, Prefix prefix, Format format)
 {
+	vector<snpClass*> snps;
+	vector<size_t> chromosomeStart;	// ordinal of the first SNP of each chromosome
+	for (vector<snpClass>::iterator snp = run.manifest->snps.begin(); snp != run.manifest->snps.end(); snp++) {
+		if (excludeCnv && (run.manifest->probe_class(*snp) & Manifest::CNV_PROBE)) continue;
+		if (snps.empty() || snp->chromosome != snps.back()->chromosome) chromosomeStart.push_back(snps.size());
+		snps.push_back(&*snp);
+	}
+	chromosomeStart.push_back(snps.size());
+	vector<string> files;
+	for (unordered_map<string,string>::iterator i = run.gtcHash.begin(); i != run.gtcHash.end(); i++) {
+		files.push_back(i->second);
+	}
+	size_t stride = files.size();
+	int matrices = threads > 1 ? 2 : 1;
+	size_t blockSize = ((size_t) memoryBudget << 20) / (matrices * stride * sizeof(Slot));
+	if (blockSize < 1) blockSize = 1;
+	if (blockSize > snps.size()) blockSize = snps.size();
+	vector<Slot> slots[2];
+	for (int m = 0; m < matrices; m++) slots[m].resize(blockSize * stride);
+	size_t blocks = blockSize ? (snps.size() + blockSize - 1) / blockSize : 0;
+	int scratch = -1;
+	if (blocks > 1) {
+		// the scratch file is unlinked at once, so it is removed on any exit
+		string scratchPath = fname + suffix + "XXXXXX";
+		vector<char> pathBuffer(scratchPath.begin(), scratchPath.end());
+		pathBuffer.push_back('\0');
+		scratch = mkstemp(&pathBuffer[0]);
+		if (scratch < 0) throw "Cannot create scratch file " + scratchPath + ": " + strerror(errno);
+		unlink(&pathBuffer[0]);
+		if (verbose) cout << timestamp() << "Writing blocks of " << blockSize << " SNPs to a scratch file" << endl;
+	}
 
-	int c1 = atoi(snp1.chromosome.c_str());
-	int c2 = atoi(snp2.chromosome.c_str());
-	if (c1 && c2 && (c1!=c2))
-		return (c1 < c2);
-	if (snp1.chromosome.compare(snp2.chromosome))
-		return (snp1.chromosome.compare(snp2.chromosome) < 0);
-	if (snp1.position != snp2.position)
-		return (snp1.position < snp2.position);
-	return (snp1.name.compare(snp2.name) < 0);
-}
+	deque<ChromosomeFile> chromosomeFiles;
+	struct Segment { size_t chromosome, begin, end; };	// SNPs of a chromosome in a block
+	string errorMsg;
+	mutex outputLock;
 
-void flushCache(int cacheIndex)
-{
-	if (verbose) cout << timestamp() << "Flushing cache..." << endl;
-	for (vector<snpClass>::iterator snp = manifest->snps.begin(); snp != manifest->snps.end(); snp++) {
-		if (excludeCnv && snp->name.find("cnv") != string::npos) continue;
-		if (chrSelect.size() && chrSelect.compare(snp->chromosome)) continue;
-		// look up the file and position for this SNP
-		fstream *f = outFile[snp->chromosome];
-		f->seekp(filePos[snp->name]);
-
-		ostringstream os;
-		for (int i=0; i<cacheIndex; i++) {
-			if (cache[snp->name][i] < 0) cache[snp->name][i] = 0; 
-			os << '\t' << setw(7) << std::fixed << setprecision(3) << cache[snp->name][i];
+	// read every threads'th GTC file, starting at the given one, and
+	// spill its slots for each block to the scratch file
+	auto spill = [&](int start) {
+		Gtc gtc;
+		vector<Slot> row(blockSize);
+		try {
+			for (size_t n = start; n < files.size(); n += threads) {
+				if (verbose) {
+					lock_guard<mutex> lock(outputLock);
+					cout << timestamp() << "Processing GTC file " << n+1 << " of " << files.size() << endl;
+				}
+				gtc.open(files[n], parts);
+				if (gtc.errorMsg.length()) throw gtc.errorMsg;
+				for (size_t first = 0; first < snps.size(); first += blockSize) {
+					size_t last = min(first + blockSize, snps.size());
+					for (size_t k = first; k < last; k++) fill(gtc, snps[k], row[k - first]);
+					size_t bytes = (last - first) * sizeof(Slot);
+					off_t offset = (first * stride + n * (last - first)) * sizeof(Slot);
+					if (pwrite(scratch, &row[0], bytes, offset) != (ssize_t) bytes) {
+						throw string("Error writing scratch file: ") + strerror(errno);
+					}
+				}
+			}
+		}
+		catch (string msg) {
+			lock_guard<mutex> lock(outputLock);
+			if (errorMsg.empty()) errorMsg = msg;
+		}
+	};
+
+	// read every threads'th GTC file, starting at the given one, into
+	// the matrix for SNPs first to last; or its slots for those SNPs
+	// from the scratch file, if they have been spilled
+	auto read = [&](size_t first, size_t last, vector<Slot> &matrix, int start) {
+		Gtc gtc;
+		vector<Slot> row(scratch < 0 ? 0 : last - first);
+		try {
+			for (size_t n = start; n < files.size(); n += threads) {
+				Slot *slot = &matrix[n];
+				if (scratch >= 0) {
+					size_t bytes = (last - first) * sizeof(Slot);
+					off_t offset = (first * stride + n * (last - first)) * sizeof(Slot);
+					if (pread(scratch, &row[0], bytes, offset) != (ssize_t) bytes) {
+						throw string("Error reading scratch file: ") + strerror(errno);
+					}
+					for (size_t k = first; k < last; k++, slot += stride) *slot = row[k - first];
+					continue;
+				}
+				if (verbose) {
+					lock_guard<mutex> lock(outputLock);
+					cout << timestamp() << "Processing GTC file " << n+1 << " of " << files.size()
+					     << " for SNPs " << first+1 << " to " << last << " of " << snps.size() << endl;
+				}
+				gtc.open(files[n], parts);	// reload GTC file to read required arrays
+				if (gtc.errorMsg.length()) throw gtc.errorMsg;
+				for (size_t k = first; k < last; k++, slot += stride) {
+					fill(gtc, snps[k], *slot);
+				}
+			}
+		}
+		catch (string msg) {
+			lock_guard<mutex> lock(outputLock);
+			if (errorMsg.empty()) errorMsg = msg;
+		}
+	};
+
+	// write the rows of every threads'th segment, starting at the given
+	// one, from the matrix for the SNPs from first
+	auto write = [&](size_t first, const vector<Slot> &matrix, const vector<Segment> &segments, int start) {
+		for (size_t s = start; s < segments.size(); s += threads) {
+			const Segment &segment = segments[s];
+			ChromosomeFile &file = chromosomeFiles[segment.chromosome];
+			const Slot *slot = &matrix[(segment.begin - first) * stride];
+			for (size_t k = segment.begin; k < segment.end; k++, slot += stride) {
+				prefix(snps[k], file.buffer);
+				size_t valuesStart = file.buffer.size();
+				for (size_t i = 0; i < stride; i++) format(slot[i], file.buffer);
+				if (file.buffer.size() - valuesStart + 1 < recordLength) {
+					file.buffer.append(recordLength - 1 - (file.buffer.size() - valuesStart), ' ');
+				}
+				file.buffer += '\n';
+				if (file.buffer.size() >= WRITE_BUFFER_BYTES) {
+					file.f.write(file.buffer.data(), file.buffer.size());
+					file.buffer.clear();
+				}
+			}
+			file.f.write(file.buffer.data(), file.buffer.size());
+			file.buffer.clear();
+			if (segment.end == chromosomeStart[segment.chromosome + 1]) file.f.close();
+		}
+	};
+
+	if (scratch >= 0) {
+		vector<thread> workers;
+		if (threads == 1) spill(0);
+		else for (int t = 0; t < threads; t++) workers.push_back(thread(spill, t));
+		for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+		if (!errorMsg.empty()) {
+			close(scratch);
+			throw errorMsg;
 		}
-		f->write(os.str().c_str(), os.str().size());
-		filePos[snp->name] += os.str().size();
 	}
-}
 
-void flushgcCache(int cacheIndex)
-{
-	if (verbose) cout << timestamp() << "Flushing cache..." << endl;
-	for (vector<snpClass>::iterator snp = manifest->snps.begin(); snp != manifest->snps.end(); snp++) {
-		if (excludeCnv && snp->name.find("cnv") != string::npos) continue;
-		if (chrSelect.size() && chrSelect.compare(snp->chromosome)) continue;
-		// look up the file and position for this SNP
-		fstream *f = outFile[snp->chromosome];
-		f->seekp(filePos[snp->name]);
-
-		ostringstream os;
-		os << gcCache[snp->name];
-		f->write(os.str().c_str(), os.str().size());
-		filePos[snp->name] += os.str().size();
-		gcCache[snp->name] = "";
+	//
+	// Read block b while block b - matrices + 1 is written. With one
+	// thread, that is the same block, read and then written here.
+	//
+	for (size_t b = 0; b + 1 < blocks + matrices; b++) {
+		vector<thread> workers;
+		if (b < blocks) {
+			size_t first = b * blockSize;
+			size_t last = min(first + blockSize, snps.size());
+			vector<Slot> &matrix = slots[b % matrices];
+			if (threads == 1) read(first, last, matrix, 0);
+			else for (int t = 0; t < threads; t++) workers.push_back(thread(read, first, last, ref(matrix), t));
+		}
+		vector<Segment> segments;
+		if (b + 1 >= (size_t) matrices) {
+			size_t w = b + 1 - matrices;
+			size_t first = w * blockSize;
+			size_t last = min(first + blockSize, snps.size());
+			// start a new output file at each new chromosome
+			size_t c = upper_bound(chromosomeStart.begin(), chromosomeStart.end(), first) - chromosomeStart.begin() - 1;
+			for (; chromosomeStart[c] < last; c++) {
+				if (chromosomeStart[c] >= first) {
+					string chromosome = snps[chromosomeStart[c]]->chromosome;
+					string fullFname = fname + suffix + chromosome + ".txt";
+					run.filenameArray.push_back(suffix + chromosome + ".txt");
+					if (verbose) {
+						lock_guard<mutex> lock(outputLock);
+						cout << timestamp() << "creating file " << fullFname << endl;
+					}
+					chromosomeFiles.push_back(ChromosomeFile());
+					chromosomeFiles.back().f.open(fullFname.c_str(), ios::binary | ios::out | ios::trunc);
+					chromosomeFiles.back().buffer = header;
+				}
+				Segment segment = { c, max(first, chromosomeStart[c]), min(last, chromosomeStart[c+1]) };
+				segments.push_back(segment);
+			}
+			const vector<Slot> &matrix = slots[w % matrices];
+			if (threads == 1) write(first, matrix, segments, 0);
+			else for (int t = 0; t < threads; t++) workers.push_back(thread(write, first, cref(matrix), cref(segments), t));
+		}
+		for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+		if (!errorMsg.empty()) {
+			if (scratch >= 0) close(scratch);
+			throw errorMsg;
+		}
 	}
+	if (scratch >= 0) close(scratch);
 }
 
 //
 // We've read the Manifest and all the GTC files
 // Now it's time to create the output files
 //
-void goForIt(string fname)
+void goForIt(Run &run, string fname)
 {
-	int recordLength = gtcHash.size() * 10 * 2;
-	char *buffer = new char[recordLength];
-	memset(buffer,' ',recordLength);
-	buffer[recordLength-1] = '\n';
-
 	// Sort the SNPs into position order
-	sort(manifest->snps.begin(), manifest->snps.end(), SortByPosition);
+	run.manifest->order_by_locus();
 
 	// Create lockfile
 	string lockFileName = fname + ".lock";
@@ -239,87 +400,60 @@ void goForIt(string fname)
 	}
 	fclose(lockfile);
 
-	//
-	// Create all of the output files - one for each chromosome
-	//
-	for (vector<snpClass>::iterator snp = manifest->snps.begin(); snp != manifest->snps.end(); snp++) {
-		if (excludeCnv && snp->name.find("cnv") != string::npos) continue;
-		if (chrSelect.size() && chrSelect.compare(snp->chromosome)) continue;
-		fstream *f = outFile[snp->chromosome];
-		if (!f) {
-			f = new fstream();
-			string fullFname = fname + "_intu_" + snp->chromosome + ".txt";
-			filenameArray.push_back("_intu_" + snp->chromosome + ".txt");
-			if (verbose) cout << timestamp() << "creating file " << fullFname << endl;
-			f->open(fullFname.c_str(), ios::in | ios::out | ios::trunc);
-
-			*f << "SNP\tCoor\tAlleles";
-			// write sample names from all the gtc files
-			for (unordered_map<string,string>::iterator i = gtcHash.begin(); i != gtcHash.end(); i++) {
-				*f << "\t" << i->first << "A\t" << i->first << "B";
-			}
-			*f << endl;
-			// associate the file handle with the chromosome
-			outFile[snp->chromosome] = f;
-		}
-		f = outFile[snp->chromosome];
-		*f << snp->name << "\t" << snp->position << "\t" << snp->snp[0] << snp->snp[1];
-		filePos[snp->name] = f->tellp();	// store next position to write
-		f->write(buffer,recordLength);	// fill with nulls (or spaces)
-
-		cache[snp->name] = new float[CACHESIZE];
+	string header = "SNP\tCoor\tAlleles";
+	// write sample names from all the gtc files
+	for (unordered_map<string,string>::iterator i = run.gtcHash.begin(); i != run.gtcHash.end(); i++) {
+		header += "\t" + i->first + "A\t" + i->first + "B";
 	}
+	header += '\n';
+
+	// normalised intensities of a SNP in one sample
+	struct Intensity { float x, y; };
+	// called from the reader threads, so the shared manifest is only read
+	auto fill = [&run](Gtc &gtc, snpClass *snp, Intensity &slot) {
+		int idx = snp->index - 1;	// index is zero based in arrays, but starts from 1 in the map file
+		map<int,int>::const_iterator id = run.manifest->normIdMap.find(snp->normId);
+		unsigned int norm = id == run.manifest->normIdMap.end() ? 0 : id->second;
+		XFormClass *XF = &gtc.XForm[norm];
+
+		double xn, yn;
+		if (normalise) {
+			// first do the normalisation calculation
+			double tempx = gtc.xRawIntensity[idx] - XF->xOffset;
+			double tempy = gtc.yRawIntensity[idx] - XF->yOffset;
 
-	//
-	// Process each GTC file in turn
-	//
-	int n=1;
-	int cacheIndex = 0;
-	for (unordered_map<string,string>::iterator i = gtcHash.begin(); i != gtcHash.end(); i++) {
-		if (verbose) cout << timestamp() << "Processing GTC file " << n++ << " of " << gtcHash.size() << endl;
-		gtc.open(i->second,Gtc::XFORM | Gtc::INTENSITY);	// reload GTC file to read XForm and Intensity arrays
-
-		for (vector<snpClass>::iterator snp = manifest->snps.begin(); snp != manifest->snps.end(); snp++) {
-			if (excludeCnv && snp->name.find("cnv") != string::npos) continue;
-			if (chrSelect.size() && chrSelect.compare(snp->chromosome)) continue;
-			int idx = snp->index - 1;	// index is zero based in arrays, but starts from 1 in the map file
-			unsigned int norm = manifest->normIdMap[snp->normId];
-			XFormClass *XF = &gtc.XForm[norm];
-
-			double xn, yn;
-			if (normalise) {
-				// first do the normalisation calculation
-				double tempx = gtc.xRawIntensity[idx] - XF->xOffset;
-				double tempy = gtc.yRawIntensity[idx] - XF->yOffset;
-
-				double cos_theta = cos(XF->theta);
-				double sin_theta = sin(XF->theta);
-				double tempx2 = cos_theta * tempx + sin_theta * tempy;
-				double tempy2 = -sin_theta * tempx + cos_theta * tempy;
-
-				double tempx3 = tempx2 - XF->shear * tempy2;
-				double tempy3 = tempy2;
-
-				xn = tempx3 / XF->xScale;
-				yn = tempy3 / XF->yScale;
-			} else {
-				xn = gtc.xRawIntensity[idx];
-				yn = gtc.yRawIntensity[idx];
-			}
-
-			cache[snp->name][cacheIndex] = xn;
-			cache[snp->name][cacheIndex+1] = yn;
-		}
-		cacheIndex += 2;
-		if (cacheIndex == CACHESIZE) { flushCache(cacheIndex); cacheIndex=0; }
-	}
+			double cos_theta = cos(XF->theta);
+			double sin_theta = sin(XF->theta);
+			double tempx2 = cos_theta * tempx + sin_theta * tempy;
+			double tempy2 = -sin_theta * tempx + cos_theta * tempy;
 
-	flushCache(cacheIndex);
+			double tempx3 = tempx2 - XF->shear * tempy2;
+			double tempy3 = tempy2;
 
-	// close all of the files
-	for (pos = outFile.begin(); pos != outFile.end(); pos++) {
-		pos->second->close();
-	}
+			xn = tempx3 / XF->xScale;
+			yn = tempy3 / XF->yScale;
+		} else {
+			xn = gtc.xRawIntensity[idx];
+			yn = gtc.yRawIntensity[idx];
+		}
+		slot.x = xn;
+		slot.y = yn;
+	};
+	auto prefix = [](snpClass *snp, string &buffer) {
+		char text[64];
+		buffer += snp->name;
+		snprintf(text, sizeof(text), "\t%ld\t%c%c", snp->position, snp->snp[0], snp->snp[1]);
+		buffer += text;
+	};
+	auto format = [](const Intensity &slot, string &buffer) {
+		char text[64];
+		int len = snprintf(text, sizeof(text), "\t%7.3f\t%7.3f",
+		                   slot.x < 0 ? 0.0 : slot.x, slot.y < 0 ? 0.0 : slot.y);
+		buffer.append(text, len);
+	};
+	// Rows are padded with spaces to the length they have always had
+	writeChromosomeFiles<Intensity>(run, fname, "_intu_", header, Gtc::XFORM | Gtc::INTENSITY,
+	                                run.gtcHash.size() * 10 * 2, fill, prefix, format);
 
 	// delete lockfile and create donefile
 	string doneFileName = lockFileName;
@@ -336,12 +470,25 @@ void goForIt(string fname)
 // on the command line. manifestName is the name of the manifest file
 // as stored in the GTC file
 //
-void loadManifest(string manifestPath, string manifestName)
+void loadManifest(Run &run, string manifestPath, string manifestName)
 {
     string mfile = manifestPath + '/' + manifestName + ".csv";
 	if (verbose) cout << timestamp() << "Reading manifest: " << mfile << endl;
+	// only the fields used here, and only SNPs on the selected chromosome
+	// or region
+	run.manifest->select_fields(Manifest::ALLELE_FIELDS | Manifest::NORMID_FIELD);
+	if (chrSelect.find(':') != string::npos) {
+		string chromosome;
+		long start, end;
+		try { RegionIndex::parse(chrSelect, chromosome, start, end); }
+		catch (string s) {
+			cerr << s << endl;
+			exit(1);
+		}
+		run.manifest->select_region(chromosome, start, end);
+	} else if (chrSelect.size()) run.manifest->select_chromosome(chrSelect);
 	try { 
-        manifest->open(mfile); 
+        run.manifest = run.manifests.open(run.manifest, mfile); 
 	}
 	catch (string s) {
 		cout << s << endl;
@@ -415,21 +562,27 @@ void getAutocallInfo(vector<string> &infiles, string project)
 	
 }
 
-void createBedFile(string fname, vector<string>infiles)
+//
+// Write a SNP-major BED file, as PLINK expects. Each GTC file gives the
+// calls of one sample, so the calls of four samples at a time are packed
+// and transposed into SNP-major order in a block of samples. If the calls
+// of all the samples do not fit in memoryBudget, each block is written to
+// a scratch file, and the rows of the BED file are put together from the
+// blocks at the end.
+//
+void createBedFile(Run &run, string fname, vector<string>infiles)
 {
-	vector<int> genotypes;
 	plink_binary *pb = new plink_binary();
-	pb->bed_mode = 0;	// specify individual major
 	pb->open(fname,1);
 
 	// Sort the SNPs into position order
-	sort(manifest->snps.begin(), manifest->snps.end(), SortByPositionBED);
+	run.manifest->order_by_locus(true);
 
 	// Load the SNP names into gftools
-	for (vector<snpClass>::iterator snp = manifest->snps.begin(); snp != manifest->snps.end(); snp++) {
+	vector<snpClass*> snps;
+	for (vector<snpClass>::iterator snp = run.manifest->snps.begin(); snp != run.manifest->snps.end(); snp++) {
 		gftools::snp gfsnp;
-		if (excludeCnv && snp->name.find("cnv") != string::npos) continue;
-		if (chrSelect.size() && chrSelect.compare(snp->chromosome)) continue;
+		if (excludeCnv && (run.manifest->probe_class(*snp) & Manifest::CNV_PROBE)) continue;
 		gfsnp.name = snp->name;
 		gfsnp.chromosome = snp->chromosome;
 		if (snp->chromosome == "X") gfsnp.chromosome = "23";
@@ -445,104 +598,179 @@ void createBedFile(string fname, vector<string>infiles)
 			gfsnp.allele_b = snp->snp[1];
 		}
 		pb->snps.push_back(gfsnp);
+		snps.push_back(&*snp);
 	}
 
 	if (verbose) cerr << "Pushed " << pb->snps.size() << " SNPs" << endl;
+
+	// PLINK's two bit code for a call, by the class of each base: 0 for
+	// neither allele, 1 for allele A, 2 for allele B, 3 for both (when
+	// they are the same) and 4 for no call; or -1 if malformed
+	int plinkCode[5][5];
+	for (int c1 = 0; c1 < 5; c1++) {
+		for (int c2 = 0; c2 < 5; c2++) {
+			bool a1 = c1 & 1 && c1 < 4, b1 = c1 & 2 && c1 < 4;
+			bool a2 = c2 & 1 && c2 < 4, b2 = c2 & 2 && c2 < 4;
+			int code = -1;
+			if (c1 == 4 && c2 == 4) code = 1;
+			if (a1 && a2) code = 0;
+			if ((a1 && b2) || (b1 && a2)) code = 2;
+			if (b1 && b2) code = 3;
+			plinkCode[c1][c2] = code;
+		}
+	}
+
+	size_t numSnps = snps.size();
+	size_t numSamples = infiles.size();
+	size_t sampleBytes = (3 + numSnps) / 4;		// calls of a sample
+	size_t snpBytes = (3 + numSamples) / 4;		// calls of a SNP
+	size_t blockBytes = numSnps ? ((size_t) memoryBudget << 20) / numSnps : snpBytes;
+	if (blockBytes < 1) blockBytes = 1;
+	if (blockBytes > snpBytes) blockBytes = snpBytes;
+	vector<char> block(numSnps * blockBytes);
+	vector<char> samples(4 * sampleBytes);	// calls of four samples
+	int scratch = -1;
+	if (blockBytes < snpBytes) {
+		string scratchPath = fname + ".bed.XXXXXX";
+		vector<char> pathBuffer(scratchPath.begin(), scratchPath.end());
+		pathBuffer.push_back('\0');
+		scratch = mkstemp(&pathBuffer[0]);
+		if (scratch < 0) throw "Cannot create scratch file " + scratchPath + ": " + strerror(errno);
+		unlink(&pathBuffer[0]);
+		if (verbose) cout << timestamp() << "Writing blocks of " << 4 * blockBytes << " samples to a scratch file" << endl;
+	}
+
 	//
 	// Process each GTC file in turn
 	//
-	for (unsigned int n = 0; n < infiles.size(); n++) {
-//	for (unordered_map<string,string>::iterator i = gtcHash.begin(); i != gtcHash.end(); i++) {
-		if (verbose) cout << timestamp() << "Processing GTC file " << n+1 << " of " << infiles.size() << endl << infiles[n] << endl;
-		gtc.open(infiles[n],Gtc::GENOTYPES | Gtc::BASECALLS | Gtc::SCORES);	// reload GTC file to read required arrays
-
-		gftools::individual ind;
-		if (!sampleNames.empty()) ind.name = sampleNames[n];
-		else                      ind.name = gtc.sampleName;
-		if (!gender_code.empty()) ind.sex = gender_code[n]; 
-		pb->individuals.push_back(ind);
-
-		for (vector<snpClass>::iterator snp = manifest->snps.begin(); snp != manifest->snps.end(); snp++) {
-			if (excludeCnv && snp->name.find("cnv") != string::npos) continue;
-			if (chrSelect.size() && chrSelect.compare(snp->chromosome)) continue;
-			int idx = snp->index - 1;	// index is zero based in arrays, but starts from 1 in the map file
-			char buff[3];
-		    sprintf(buff,"%c%c", gtc.baseCalls[idx].a, gtc.baseCalls[idx].b);
-			char allele_a = snp->snp[0];
-			char allele_b = snp->snp[1];
-			int call = -1;
-			if (buff[0] == '-' && buff[1] == '-') call=0;
-			if (buff[0] == allele_a && buff[1] == allele_a) call = 1;
-			if (buff[0] == allele_a && buff[1] == allele_b) call = 2;
-			if (buff[0] == allele_b && buff[1] == allele_a) call = 2;
-			if (buff[0] == allele_b && buff[1] == allele_b) call = 3;
-			if (call == -1) {
-				cerr << "malformed data: " << endl;
-				cerr << "snp = '" << allele_a << allele_b << "'" << endl;
-				cerr << "buff = '" << buff << "'" << endl;
-				cerr << "name = " << snp->name << endl;
-				cerr << "idx = " << idx << endl;
-				exit(1);
+	for (size_t first = 0; first < numSamples; first += 4 * blockBytes) {
+		size_t last = min(first + 4 * blockBytes, numSamples);
+		size_t width = (3 + last - first) / 4;
+		for (size_t n = first; n < last; n += 4) {
+			size_t count = min((size_t) 4, last - n);
+			fill(samples.begin(), samples.end(), 0);
+			for (size_t m = 0; m < count; m++) {
+				if (verbose) cout << timestamp() << "Processing GTC file " << n+m+1 << " of " << numSamples << endl << infiles[n+m] << endl;
+				run.gtc.open(infiles[n+m],Gtc::GENOTYPES | Gtc::BASECALLS | Gtc::SCORES);	// reload GTC file to read required arrays
+
+				gftools::individual ind;
+				if (!run.sampleNames.empty()) ind.name = run.sampleNames[n+m];
+				else                          ind.name = run.gtc.sampleName;
+				if (!run.gender_code.empty()) ind.sex = run.gender_code[n+m];
+				pb->individuals.push_back(ind);
+
+				char *calls = &samples[m * sampleBytes];
+				for (size_t k = 0; k < numSnps; k++) {
+					snpClass *snp = snps[k];
+					int idx = snp->index - 1;	// index is zero based in arrays, but starts from 1 in the map file
+					char allele_a = snp->snp[0];
+					char allele_b = snp->snp[1];
+					int c[2];
+					char base[2] = { run.gtc.baseCalls[idx].a, run.gtc.baseCalls[idx].b };
+					for (int i = 0; i < 2; i++) {
+						c[i] = (base[i] == allele_a) | (base[i] == allele_b) << 1;
+						if (!c[i] && base[i] == '-') c[i] = 4;
+					}
+					int code = plinkCode[c[0]][c[1]];
+					if (code < 0) {
+						cerr << "malformed data: " << endl;
+						cerr << "snp = '" << allele_a << allele_b << "'" << endl;
+						cerr << "buff = '" << base[0] << base[1] << "'" << endl;
+						cerr << "name = " << snp->name << endl;
+						cerr << "idx = " << idx << endl;
+						exit(1);
+					}
+					calls[k / 4] |= code << (2 * (k % 4));
+				}
 			}
-			genotypes.push_back(call);
+			plink_binary::transpose_calls(&samples[0], count, numSnps, &block[(n - first) / 4], width);
+		}
+		if (scratch < 0) {
+			pb->write_packed_snps(&block[0], numSnps);
+		} else if (write(scratch, &block[0], numSnps * width) != (ssize_t) (numSnps * width)) {
+			throw string("Error writing BED scratch file: ") + strerror(errno);
 		}
-		pb->write_individual(genotypes);
-		genotypes.clear();
+	}
+
+	//
+	// Put the rows of the BED file together from the blocks of samples
+	//
+	if (scratch >= 0) {
+		size_t rows = ((size_t) memoryBudget << 20) / snpBytes;
+		if (rows < 1) rows = 1;
+		if (rows > numSnps) rows = numSnps;
+		vector<char> snpCalls(rows * snpBytes);
+		for (size_t j = 0; j < numSnps; j += rows) {
+			size_t count = min(rows, numSnps - j);
+			off_t offset = 0;
+			for (size_t first = 0; first < numSamples; first += 4 * blockBytes) {
+				size_t width = (3 + min(first + 4 * blockBytes, numSamples) - first) / 4;
+				size_t bytes = count * width;
+				if (pread(scratch, &block[0], bytes, offset + j * width) != (ssize_t) bytes) {
+					throw string("Error reading BED scratch file: ") + strerror(errno);
+				}
+				for (size_t k = 0; k < count; k++) {
+					memcpy(&snpCalls[k * snpBytes + first / 4], &block[k * width], width);
+				}
+				offset += numSnps * width;
+			}
+			pb->write_packed_snps(&snpCalls[0], count);
+		}
+		close(scratch);
 	}
 
 	pb->close();
 }
 
-void createSimFile(string fname)
+void createSimFile(Run &run, string fname)
 {
 	Sim *sim = new Sim();
 
-	unordered_map<string,string>::iterator i = gtcHash.begin();
-	gtc.open(i->second, Gtc::INTENSITY);
+	unordered_map<string,string>::iterator i = run.gtcHash.begin();
+	run.gtc.open(i->second, Gtc::INTENSITY);
 	sim->openOutput(fname);
-	sim->writeHeader(gtcHash.size(), gtc.xRawIntensity.size());
+	sim->writeHeader(run.gtcHash.size(), run.gtc.xRawIntensity.size());
 
 	//
 	//
 	// Process each GTC file in turn
 	//
 	unsigned int n=1;
-	for (unordered_map<string,string>::iterator i = gtcHash.begin(); i != gtcHash.end(); i++) {
+	for (unordered_map<string,string>::iterator i = run.gtcHash.begin(); i != run.gtcHash.end(); i++) {
 		char *buffer;
-		if (verbose) cout << timestamp() << "Processing GTC file " << n << " of " << gtcHash.size() << endl;
+		if (verbose) cout << timestamp() << "Processing GTC file " << n << " of " << run.gtcHash.size() << endl;
 		//
 		// add sample name to each output file
 		// no family info as yet (todo?) - write sample ID twice
 //		fn << i->first << endl;
 
-		gtc.open(i->second,Gtc::XFORM | Gtc::INTENSITY);	// reload GTC file to read XForm and Intensity arrays
+		run.gtc.open(i->second,Gtc::XFORM | Gtc::INTENSITY);	// reload GTC file to read XForm and Intensity arrays
 		buffer = new char[sim->sampleNameSize];
 		memset(buffer,0,sim->sampleNameSize);
 		// if we have a sample name from the json file, use it
-		if (sampleNames.size() > (n-1)) { strcpy(buffer, sampleNames[n-1].c_str()); }
-		else                            { strcpy(buffer,gtc.sampleName.c_str()); }
+		if (run.sampleNames.size() > (n-1)) { strcpy(buffer, run.sampleNames[n-1].c_str()); }
+		else                            { strcpy(buffer,run.gtc.sampleName.c_str()); }
 		sim->write(buffer, sim->sampleNameSize);
 
-		for (unsigned int idx = 0; idx < gtc.xRawIntensity.size(); idx++) {
+		for (unsigned int idx = 0; idx < run.gtc.xRawIntensity.size(); idx++) {
 			uint16_t v;
-			v = gtc.xRawIntensity[idx];
+			v = run.gtc.xRawIntensity[idx];
 			sim->write(&v,sizeof(v));
-			v = gtc.yRawIntensity[idx];
+			v = run.gtc.yRawIntensity[idx];
 			sim->write(&v,sizeof(v));
 		}
 		n++;
 
 #if 0
-		for (vector<snpClass>::iterator snp = manifest->snps.begin(); snp != manifest->snps.end(); snp++) {
-			if (excludeCnv && snp->name.find("cnv") != string::npos) continue;
-			if (chrSelect.size() && chrSelect.compare(snp->chromosome)) continue;
+		for (vector<snpClass>::iterator snp = run.manifest->snps.begin(); snp != run.manifest->snps.end(); snp++) {
+			if (excludeCnv && (run.manifest->probe_class(*snp) & Manifest::CNV_PROBE)) continue;
 			int idx = snp->index - 1;	// index is zero based in arrays, but starts from 1 in the map file
-			unsigned int norm = manifest->normIdMap[snp->normId];
-			XFormClass *XF = &gtc.XForm[norm];
+			unsigned int norm = run.manifest->normIdMap[snp->normId];
+			XFormClass *XF = &run.gtc.XForm[norm];
 
 			// first do the normalisation calculation
-			double tempx = gtc.xRawIntensity[idx] - XF->xOffset;
-			double tempy = gtc.yRawIntensity[idx] - XF->yOffset;
+			double tempx = run.gtc.xRawIntensity[idx] - XF->xOffset;
+			double tempy = run.gtc.yRawIntensity[idx] - XF->yOffset;
 
 			double cos_theta = cos(XF->theta);
 			double sin_theta = sin(XF->theta);
@@ -565,10 +793,10 @@ void createSimFile(string fname)
 }
 
 
-void createGenoSNP(string fname)
+void createGenoSNP(Run &run, string fname)
 {
 	// Sort the SNPs into position order
-	sort(manifest->snps.begin(), manifest->snps.end(), SortByPosition);
+	run.manifest->order_by_locus();
 
 	// Create lockfile
 	string lockFileName = fname + ".lock";
@@ -581,9 +809,9 @@ void createGenoSNP(string fname)
 	string rawFname = fname + ".raw.txt";
 	string snpFname = fname + ".snp.txt";
 	string norFname = fname + ".nor.txt";
-	filenameArray.push_back(".raw.txt");
-	filenameArray.push_back(".snp.txt");
-	filenameArray.push_back(".nor.txt");
+	run.filenameArray.push_back(".raw.txt");
+	run.filenameArray.push_back(".snp.txt");
+	run.filenameArray.push_back(".nor.txt");
 	
 	fstream fn;
 	fstream fs;
@@ -594,9 +822,8 @@ void createGenoSNP(string fname)
 	if (verbose) cout << timestamp() << "creating file " << rawFname << ", " << norFname << " and " << snpFname << endl;
 
         // Write SNP list to .snp
-	for (vector<snpClass>::iterator snp = manifest->snps.begin(); snp != manifest->snps.end(); snp++) {
-		if (excludeCnv && snp->name.find("cnv") != string::npos) continue;
-		if (chrSelect.size() && chrSelect.compare(snp->chromosome)) continue;
+	for (vector<snpClass>::iterator snp = run.manifest->snps.begin(); snp != run.manifest->snps.end(); snp++) {
+		if (excludeCnv && (run.manifest->probe_class(*snp) & Manifest::CNV_PROBE)) continue;
 		fs << snp->name << '\t'
 		   << (snp->normId % 100) + 1 << '\t'
 		   << snp->snp[0] << " " << snp->snp[1] << endl;
@@ -609,26 +836,25 @@ void createGenoSNP(string fname)
 	// Process each GTC file in turn
 	//
 	int n=1;
-	for (unordered_map<string,string>::iterator i = gtcHash.begin(); i != gtcHash.end(); i++) {
-		if (verbose) cout << timestamp() << "Processing GTC file " << n++ << " of " << gtcHash.size() << endl;
+	for (unordered_map<string,string>::iterator i = run.gtcHash.begin(); i != run.gtcHash.end(); i++) {
+		if (verbose) cout << timestamp() << "Processing GTC file " << n++ << " of " << run.gtcHash.size() << endl;
 		//
 		// add sample name to each output file
 		// no family info as yet (todo?) - write sample ID twice
 		fn << i->first << "\t" << i->first;
 		fr << i->first << "\t" << i->first;
 
-		gtc.open(i->second,Gtc::XFORM | Gtc::INTENSITY);	// reload GTC file to read XForm and Intensity arrays
+		run.gtc.open(i->second,Gtc::XFORM | Gtc::INTENSITY);	// reload GTC file to read XForm and Intensity arrays
 
-		for (vector<snpClass>::iterator snp = manifest->snps.begin(); snp != manifest->snps.end(); snp++) {
-			if (excludeCnv && snp->name.find("cnv") != string::npos) continue;
-			if (chrSelect.size() && chrSelect.compare(snp->chromosome)) continue;
+		for (vector<snpClass>::iterator snp = run.manifest->snps.begin(); snp != run.manifest->snps.end(); snp++) {
+			if (excludeCnv && (run.manifest->probe_class(*snp) & Manifest::CNV_PROBE)) continue;
 			int idx = snp->index - 1;	// index is zero based in arrays, but starts from 1 in the map file
-			unsigned int norm = manifest->normIdMap[snp->normId];
-			XFormClass *XF = &gtc.XForm[norm];
+			unsigned int norm = run.manifest->normIdMap[snp->normId];
+			XFormClass *XF = &run.gtc.XForm[norm];
 
 			// first do the normalisation calculation
-			double tempx = gtc.xRawIntensity[idx] - XF->xOffset;
-			double tempy = gtc.yRawIntensity[idx] - XF->yOffset;
+			double tempx = run.gtc.xRawIntensity[idx] - XF->xOffset;
+			double tempy = run.gtc.yRawIntensity[idx] - XF->yOffset;
 
 			double cos_theta = cos(XF->theta);
 			double sin_theta = sin(XF->theta);
@@ -642,7 +868,7 @@ void createGenoSNP(string fname)
 			double yn = tempy3 / XF->yScale;
 
 			// add raw/norm x/y to .raw and .nor files
-			fr << "\t" << std::fixed << setprecision(3) << gtc.xRawIntensity[idx] << " " << gtc.yRawIntensity[idx];
+			fr << "\t" << std::fixed << setprecision(3) << run.gtc.xRawIntensity[idx] << " " << run.gtc.yRawIntensity[idx];
 			fn << "\t" << std::fixed << setprecision(3) << xn << " " << yn;
 		}
 		fn << endl;
@@ -662,15 +888,10 @@ void createGenoSNP(string fname)
 	if (verbose) cout << timestamp() << "Renamed " << lockFileName << " to " << doneFileName << endl;
 }
 
-void createGenoCalling(string fname)
+void createGenoCalling(Run &run, string fname)
 {
-	int recordLength = gtcHash.size() * 18;
-	char *buffer = new char[recordLength];
-	memset(buffer,' ',recordLength);
-	buffer[recordLength-1] = '\n';
-
 	// Sort the SNPs into position order
-	sort(manifest->snps.begin(), manifest->snps.end(), SortByPosition);
+	run.manifest->order_by_locus();
 
 	// Create lockfile
 	string lockFileName = fname + ".lock";
@@ -678,69 +899,40 @@ void createGenoCalling(string fname)
 	if (!lockfile) throw (strerror(errno));
 	fclose(lockfile);
 
-	//
-	// Create all of the output files - one for each chromosome
-	//
-	for (vector<snpClass>::iterator snp = manifest->snps.begin(); snp != manifest->snps.end(); snp++) {
-		if (excludeCnv && snp->name.find("cnv") != string::npos) continue;
-		if (chrSelect.size() && chrSelect.compare(snp->chromosome)) continue;
-		fstream *f = outFile[snp->chromosome];
-		if (!f) {
-			f = new fstream();
-			string fullFname = fname + "_gtu_" + snp->chromosome + ".txt";
-			filenameArray.push_back("_gtu_" + snp->chromosome + ".txt");
-			
-			if (verbose) cout << timestamp() << "creating file " << fullFname << endl;
-			f->open(fullFname.c_str(), ios::in | ios::out | ios::trunc);
-
-			// write sample names from all the gtc files
-			for (unordered_map<string,string>::iterator i = gtcHash.begin(); i != gtcHash.end(); i++) {
-				*f << "\t" << i->first;
-			}
-			*f << endl;
-			// associate the file handle with the chromosome
-			outFile[snp->chromosome] = f;
-		}
-		f = outFile[snp->chromosome];
-		*f << snp->name;
-		filePos[snp->name] = f->tellp();	// store next position to write
-		f->write(buffer,recordLength);	// fill with nulls (or spaces)
-
-		gcCache[snp->name] = "";
+	string header;
+	// write sample names from all the gtc files
+	for (unordered_map<string,string>::iterator i = run.gtcHash.begin(); i != run.gtcHash.end(); i++) {
+		header += "\t" + i->first;
 	}
-
-	//
-	// Process each GTC file in turn
-	//
-	int n=1;
-	int cacheIndex = 0;
-	for (unordered_map<string,string>::iterator i = gtcHash.begin(); i != gtcHash.end(); i++) {
-		if (verbose) cout << timestamp() << "Processing GTC file " << n++ << " of " << gtcHash.size() << endl;
-		gtc.open(i->second,Gtc::GENOTYPES | Gtc::BASECALLS | Gtc::SCORES);	// reload GTC file to read required arrays
-
-		for (vector<snpClass>::iterator snp = manifest->snps.begin(); snp != manifest->snps.end(); snp++) {
-			if (excludeCnv && snp->name.find("cnv") != string::npos) continue;
-			if (chrSelect.size() && chrSelect.compare(snp->chromosome)) continue;
-			int idx = snp->index - 1;	// index is zero based in arrays, but starts from 1 in the map file
-			char buffer[128];
-                        if (gtc.genotypes[idx] > 3)
-			   cout << "Unknown genotype value: " << gtc.genotypes[idx] << endl;
-                        if (gtc.genotypes[idx] == 0)
-			    sprintf(buffer,"\tNN;%f", gtc.scores[idx]);
-                        else
-			    sprintf(buffer,"\t%c%c;%f", gtc.baseCalls[idx].a, gtc.baseCalls[idx].b, gtc.scores[idx]);
-			gcCache[snp->name] += buffer;
+	header += '\n';
+
+	// call and score of a SNP in one sample, formatted when written
+	struct Call { char a, b; float score; };
+	// called from the reader threads; an error is thrown to the main thread
+	auto fill = [](Gtc &gtc, snpClass *snp, Call &slot) {
+		int idx = snp->index - 1;	// index is zero based in arrays, but starts from 1 in the map file
+		if (gtc.genotypes[idx] > 3) {
+			throw "Unknown genotype value " + to_string((int) gtc.genotypes[idx]) +
+			      " for SNP " + snp->name + " in " + gtc.filename;
 		}
-		cacheIndex++;
-		if (cacheIndex == GCCACHESIZE) { flushgcCache(cacheIndex); cacheIndex=0; }
-	}
-
-	flushgcCache(cacheIndex);
-
-	// close all of the files
-	for (pos = outFile.begin(); pos != outFile.end(); pos++) {
-		pos->second->close();
-	}
+		if (gtc.genotypes[idx] == 0) {
+			slot.a = slot.b = 'N';
+		} else {
+			slot.a = gtc.baseCalls[idx].a;
+			slot.b = gtc.baseCalls[idx].b;
+		}
+		slot.score = gtc.scores[idx];
+	};
+	auto prefix = [](snpClass *snp, string &buffer) {
+		buffer += snp->name;
+	};
+	auto format = [](const Call &slot, string &buffer) {
+		char text[128];
+		int len = snprintf(text, sizeof(text), "\t%c%c;%f", slot.a, slot.b, slot.score);
+		buffer.append(text, len);
+	};
+	writeChromosomeFiles<Call>(run, fname, "_gtu_", header, Gtc::GENOTYPES | Gtc::BASECALLS | Gtc::SCORES,
+	                           run.gtcHash.size() * 18, fill, prefix, format);
 
 	// delete lockfile and create donefile
 	string doneFileName = lockFileName;
@@ -756,8 +948,9 @@ int main(int argc, char *argv[])
 	char c;
 	int nBadFiles = 0;
 	vector<string> infiles;
+	Run run;
 
-	while ((c = getopt (argc, argv, "neckmsvbw?hgo:i:x:p:d:r:t:")) != -1) {
+	while ((c = getopt (argc, argv, "neckmsvbw?hgo:i:x:p:d:r:t:M:j:")) != -1) {
 		switch (c) {
 				case 'v':	verbose=true; break;
 				case 'b':	bed=true; break;
@@ -776,6 +969,8 @@ int main(int argc, char *argv[])
                 case 'd':   manifestDir = optarg; break;
                 case 'x':   exclusionFile = optarg; break;
 				case 'r':	chrSelect = optarg; break;
+				case 'M':	memoryBudget = atol(optarg); break;
+				case 'j':	threads = atoi(optarg); break;
 				case 'i':	ifstream f; string s;
 							f.open(optarg);
 							if (strstr(optarg,".json")) {
@@ -787,10 +982,10 @@ int main(int argc, char *argv[])
 									return 0;
 								}
 								for ( unsigned int index = 0; index < root.size(); ++index ) { // Iterates over the sequence elements.
-									sampleNames.push_back(root[index]["uri"].asString());
+									run.sampleNames.push_back(root[index]["uri"].asString());
 									char buffer[8];
 									sprintf(buffer,"%d",root[index]["gender_code"].asInt());
-									gender_code.push_back(buffer);
+									run.gender_code.push_back(buffer);
 									infiles.push_back(root[index]["result"].asString());
 									if (verbose) {
 										cerr << root[index]["uri"].asString() << "\t" 
@@ -820,7 +1015,7 @@ int main(int argc, char *argv[])
 	}
 
 	if (exclusionFile.size() != 0) {
-		loadExclusionFile(exclusionFile);
+		loadExclusionFile(run, exclusionFile);
 	}
 
 	// read the rest of the command line
@@ -839,6 +1034,7 @@ int main(int argc, char *argv[])
 	}
 
 	if (!excludeCnv && !includeCnv) excludeCnv=true;	// default to 'exclude' if nothing specified
+	if (threads < 1) threads = 1;
 
 	// sanity check the GTC files
 	if (verbose) cout << timestamp() << "Sanity checking";
@@ -847,48 +1043,48 @@ int main(int argc, char *argv[])
 		bool badFile = false;
 		if (verbose) cout << '.';
 		try {
-			gtc.open(*f,0);
-			if (gtc.errorMsg.length()) throw gtc.errorMsg;
+			run.gtc.open(*f,0);
+			if (run.gtc.errorMsg.length()) throw run.gtc.errorMsg;
 		}
 		catch (string s) {
 			cout << s << endl;
 			badFile = true;
 			nBadFiles++;
 		}
-		if (excludeExo && ( (gtc.sampleName.find("Exo") == 0) || 
-		                    (gtc.sampleName.find("EXO") == 0))) {
+		if (excludeExo && ( (run.gtc.sampleName.find("Exo") == 0) || 
+		                    (run.gtc.sampleName.find("EXO") == 0))) {
 			badFile=true;
 			if (verbose) cout << "X";
 		}
-		if (exclusionList[gtc.sampleName]) {
+		if (run.exclusionList[run.gtc.sampleName]) {
 			badFile = true;
 			if (verbose) cout << "X";
 		}
 		if (!badFile) {
-			gtcHash[gtc.sampleName] = *f;
-			sampleArray.push_back(gtc.sampleName);
+			run.gtcHash[run.gtc.sampleName] = *f;
+			run.sampleArray.push_back(run.gtc.sampleName);
 		}
 	}
 	if (verbose) cout << endl;
 
 	// a little validation...
-	if (gtcHash.size() == 0) {
+	if (run.gtcHash.size() == 0) {
 		cout << "No gtc files specified\n";
 		exit(1);
 	}
 
 	string manifestName = "";
-	for (unordered_map<string,string>::iterator i = gtcHash.begin(); i != gtcHash.end(); i++) {
-		gtc.open(i->second,0);
-		if (manifestName != "" && gtc.manifest != manifestName) {
+	for (unordered_map<string,string>::iterator i = run.gtcHash.begin(); i != run.gtcHash.end(); i++) {
+		run.gtc.open(i->second,0);
+		if (manifestName != "" && run.gtc.manifest != manifestName) {
 			cout << "GTC files do not all have the same manifest" << endl;
 			exit(1);
 		}
-		manifestName = gtc.manifest;
+		manifestName = run.gtc.manifest;
 	}
 
 	if (verbose) {
-		cout << timestamp() << "About to process " << gtcHash.size() << " GTC files" << endl;
+		cout << timestamp() << "About to process " << run.gtcHash.size() << " GTC files" << endl;
 		if (nBadFiles) cout << "Cannot process " << nBadFiles << " GTC files" << endl;
 	}
 
@@ -896,27 +1092,31 @@ int main(int argc, char *argv[])
 	if (verbose) cout << "Loading manifest " << manifestName << endl;
     
     if (manifestDir.size()) {
-      loadManifest(manifestDir, manifestName);
+      loadManifest(run, manifestDir, manifestName);
     } else {
-      loadManifest(relativeManifestPath(infiles[0]), manifestName);
+      loadManifest(run, relativeManifestPath(infiles[0]), manifestName);
     }
 	}
 
 	try {
-	if (genoSNP)          { createGenoSNP(tmpFile); }
-	else if (genoCalling) { createGenoCalling(tmpFile);   }
-	else if (simOutput)   { createSimFile(tmpFile);   }
-	else if (bed)         { createBedFile(tmpFile,infiles);   }
-	else                  { goForIt(tmpFile);       }
+	if (genoSNP)          { createGenoSNP(run, tmpFile); }
+	else if (genoCalling) { createGenoCalling(run, tmpFile);   }
+	else if (simOutput)   { createSimFile(run, tmpFile);   }
+	else if (bed)         { createBedFile(run, tmpFile, infiles);   }
+	else                  { goForIt(run, tmpFile);       }
 	}
 	catch (char *s) {
 		cerr << timestamp() << "Caught fatal error: " << s << endl;
 		return 1;
 	}
+	catch (string s) {
+		cerr << timestamp() << "Caught fatal error: " << s << endl;
+		return 1;
+	}
 
 	// Copy temporary files to final output files
 	if (tmpFile.compare(outputFile)) {
-		for (vector<string>::iterator i = filenameArray.begin(); i != filenameArray.end(); i++) {
+		for (vector<string>::iterator i = run.filenameArray.begin(); i != run.filenameArray.end(); i++) {
 			string command = "cp " + tmpFile + *i + " " + outputFile + *i;
 			if (verbose) cout << timestamp() << "Sending command: '" << command << "'" << endl;
 			int ret = system(command.c_str());
@@ -929,6 +1129,10 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (verbose) {
+		cout << timestamp();
+		run.manifests.report(cout);
+	}
 	return 0;
 }
 
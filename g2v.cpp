@@ -33,13 +33,20 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <sstream>
+#include <thread>
 
+#include "Bgzf.h"
 #include "Gtc.h"
 #include "Manifest.h"
+#include "Tabix.h"
+#include "json/json.h"
 
 using namespace std;
 
@@ -48,22 +55,44 @@ string VCF_VERSION = "4.2";
 int CLI_OPTIONS_ERR = 2;
 int    MANIFEST_ERR = 3;
 int       GTC_ERROR = 4;
+int    OUTPUT_ERR = 5;
 
 bool verbose = false;
 
-string gtc_file;
+vector<string> gtc_files;
+vector<string> sample_names;
+string sample_sheet;
 string manifest_file;
 string reference_name;
+string output_file;
+int threads = 1;
+long memory_budget = 1024; // MB for the genotype codes of a block of loci
 
 int GENCALL_THRESHOLD = 15; // 0.15 * 100
 
+// Where the VCF goes: standard output, a file, or a BGZF file, whose
+// tabix index is built as it is written; or a BCF file, which is BGZF
+ofstream vcf_file;
+ostream *vcf = &cout;
+BgzfWriter *bgzf = NULL;
+TabixIndex *tabix = NULL;
+bool bcf = false;
+
+// Genotype code of a probe whose GenCall score failed
+const unsigned char FAILED = 0xff;
+
 void print_usage() {
   cout << "g2v "
-       << "-g <GTC file> "
+       << "-g <GTC file> [-g <GTC file> ...] | -s <sample sheet> "
        << "[-h] "
+       << "[-j <threads>] "
        << "-m <manifest file> "
+       << "[-M <megabytes>] "
        << "[-r <reference name>] "
-       << "[> <VCF file>]" << endl;
+       << "[-o <VCF or BCF file> | > <VCF file>]" << endl
+       << "A VCF file named *.gz is BGZF-compressed, "
+       << "with a tabix index written to <VCF file>.tbi; "
+       << "a file named *.bcf is BCF" << endl;
 }
 
 char *timestamp(void) {
@@ -74,52 +103,184 @@ char *timestamp(void) {
   return buffer;
 }
 
-// Remove indel probes and anything with a failed GenCall score
-void filter_fails_and_indels(Manifest & manifest, Gtc & gtc,
-                             vector<snpClass> & called_snps) {
+// Read a sample sheet: a file of GTC file names, one per line, or a JSON
+// array of objects with the GTC file name in "result" and the sample name
+// in "uri"
+void read_sample_sheet(string path, vector<string> & files,
+                       vector<string> & names) {
+  ifstream f(path.c_str());
+  if (!f) {
+    cerr << "Cannot open sample sheet " << path << endl;
+    exit(CLI_OPTIONS_ERR);
+  }
+  if (path.size() > 5 && path.compare(path.size() - 5, 5, ".json") == 0) {
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(f, root)) {
+      cerr << "Failed to parse sample sheet " << path << endl
+           << reader.getFormatedErrorMessages() << endl;
+      exit(CLI_OPTIONS_ERR);
+    }
+    for (unsigned int i = 0; i < root.size(); i++) {
+      files.push_back(root[i]["result"].asString());
+      names.push_back(root[i]["uri"].asString());
+    }
+  }
+  else {
+    string file;
+    while (f >> file) files.push_back(file);
+  }
+}
+
+// The loci of the manifest, apart from indels, with what is needed to
+// print their records; built once, then only read. The probes of locus
+// l are probes[locus_start[l]] to probes[locus_start[l+1] - 1]; its
+// identifiers, sorted and unique, are names[name_start[l]] onwards, and
+// its candidate alt bases, sorted and unique, alts[alt_start[l]] onwards.
+struct LocusTable {
+  vector<snpClass*> probes;
+  vector<size_t> locus_start;
+  vector<string> names;
+  vector<size_t> name_start;
+  vector<int> name_rank;  // of each probe's name among those of its locus
+  vector<char> alts;
+  vector<size_t> alt_start;
+  vector<int> alt_rank;   // of each probe's alt base among those of its locus
+  size_t max_probes;      // at any locus
+};
+
+void build_locus_table(Manifest & manifest, LocusTable & table) {
   for (auto si = manifest.snps.begin(); si != manifest.snps.end(); si++) {
     if (si->snp[0] != 'D' && si->snp[0] != 'I') {
+      table.probes.push_back(&*si);
+    }
+  }
+  vector<snpClass*> & probes = table.probes;
+  stable_sort(probes.begin(), probes.end(),
+              [](const snpClass *a, const snpClass *b) { return *a < *b; });
+
+  table.max_probes = 0;
+  table.name_rank.resize(probes.size());
+  table.alt_rank.resize(probes.size());
+  for (size_t p = 0; p < probes.size(); p++) {
+    if (p > 0 && probes[p]->position == probes[p - 1]->position &&
+        probes[p]->chromosome == probes[p - 1]->chromosome) {
+      continue;
+    }
+    size_t end = p + 1;
+    while (end < probes.size() && probes[end]->position == probes[p]->position &&
+           probes[end]->chromosome == probes[p]->chromosome) {
+      end++;
+    }
+    table.locus_start.push_back(p);
+    table.max_probes = max(table.max_probes, end - p);
+
+    // Probes are in name order within a locus
+    table.name_start.push_back(table.names.size());
+    for (size_t q = p; q < end; q++) {
+      if (q == p || probes[q]->name != probes[q - 1]->name) {
+        table.names.push_back(probes[q]->name);
+      }
+      table.name_rank[q] = table.names.size() - 1 - table.name_start.back();
+    }
+
+    size_t first_alt = table.alts.size();
+    table.alt_start.push_back(first_alt);
+    for (size_t q = p; q < end; q++) table.alts.push_back(probes[q]->snp[1]);
+    sort(table.alts.begin() + first_alt, table.alts.end());
+    table.alts.erase(unique(table.alts.begin() + first_alt, table.alts.end()),
+                     table.alts.end());
+    for (size_t q = p; q < end; q++) {
+      table.alt_rank[q] = lower_bound(table.alts.begin() + first_alt, table.alts.end(),
+                                      probes[q]->snp[1]) - table.alts.begin() - first_alt;
+    }
+  }
+  table.locus_start.push_back(probes.size());
+  table.name_start.push_back(table.names.size());
+  table.alt_start.push_back(table.alts.size());
+}
 
-      int i = si->index - 1;
-      float score = gtc.scores[i];
-      if (score * 100 > GENCALL_THRESHOLD) {
-        called_snps.push_back(*si);
+// Read the genotype codes of probes first to last from every threads'th
+// GTC file, starting at the given one, into codes: a row for each probe,
+// with a code for each sample, or FAILED for a failed GenCall score
+void decode_genotypes(vector<snpClass*> & probes, size_t first, size_t last,
+                      unsigned char *codes, int start, string & error_msg) {
+  static mutex error_lock;
+  size_t num_samples = gtc_files.size();
+  Gtc gtc;
+  try {
+    for (size_t s = start; s < num_samples; s += threads) {
+      gtc.open(gtc_files[s], Gtc::GENOTYPES | Gtc::SCORES);
+      if (gtc.errorMsg.length()) throw gtc.errorMsg;
+      unsigned char *code = codes + s;
+      for (size_t p = first; p < last; p++, code += num_samples) {
+        int i = probes[p]->index - 1;
+        if (gtc.scores[i] * 100 > GENCALL_THRESHOLD) {
+          *code = gtc.genotypes[i];
+        }
+        else {
+          *code = FAILED;
+        }
       }
     }
   }
-  sort(called_snps.begin(), called_snps.end());
+  catch (string msg) {
+    lock_guard<mutex> lock(error_lock);
+    if (error_msg.empty()) error_msg = msg;
+  }
+}
+
+void output(const string & text) {
+  try {
+    if (bgzf) {
+      bgzf->write(text);
+    }
+    else {
+      vcf->write(text.data(), text.size());
+    }
+  }
+  catch (string s) {
+    cerr << s << endl;
+    exit(OUTPUT_ERR);
+  }
 }
 
-void print_boilerplate_fields() {
-  cout << "##fileformat=VCFv" << VCF_VERSION
+void print_boilerplate_fields(ostream & out) {
+  out << "##fileformat=VCFv" << VCF_VERSION
        << endl;
 
-  cout << "##fileDate=" << timestamp()
+  out << "##fileDate=" << timestamp()
        << endl;
 
   if (reference_name.size() > 0) {
-    cout << "##reference=" << reference_name
+    out << "##reference=" << reference_name
          << endl;
   }
 
-  cout << "##INFO=<ID=NS,"
+  // PASS is first in the dictionary of strings of a BCF header
+  if (bcf) {
+    out << "##FILTER=<ID=PASS,Description=\"All filters passed\">"
+        << endl;
+  }
+
+  out << "##INFO=<ID=NS,"
        << "Number=1,Type=Integer,"
        << "Description=\"Number of samples with data\">"
        << endl;
 
-  cout << "##INFO=<ID=AC,"
+  out << "##INFO=<ID=AC,"
        << "Number=.,Type=Integer,Description=\"Allele count\">"
        << endl;
 
-  cout << "##INFO=<ID=AN,"
+  out << "##INFO=<ID=AN,"
        << "Number=1,Type=Integer,"
        << "Description=\"Number of alleles with data\">"
        << endl;
 
-  cout << "##FILTER=<ID=gencall,Description=\"Illumina GenCall score\">"
+  out << "##FILTER=<ID=gencall,Description=\"Illumina GenCall score\">"
        << endl;
 
-  cout << "##FORMAT=<ID=GT,"
+  out << "##FORMAT=<ID=GT,"
        << "Number=1,Type=String,"
        << "Description=\"Genotype\">"
        << endl;
@@ -139,174 +300,370 @@ void collect_chr_names(Manifest & manifest, vector<string> & chr_names) {
   return;
 }
 
-void collect_unique_alts(Gtc & gtc, vector<snpClass> & snps,
-                         vector<char> & alts) {
-  for (auto si = snps.begin(); si != snps.end(); si++) {
-    int i = si->index - 1;
-    int gt_code = gtc.genotypes[i];
-    if (gt_code == 2 or gt_code == 3) {
-      alts.push_back(si->snp[1]);
-    }
+void print_chr_name_fields(ostream & out, vector<string> & chr_names) {
+  for (auto ni = chr_names.begin(); ni != chr_names.end(); ni++) {
+    out << "##contig=<ID=" << *ni << ">" << endl;
   }
-  sort(alts.begin(), alts.end());
-  alts.erase(unique(alts.begin(), alts.end()), alts.end());
+
+  return;
 }
 
-void collect_unique_identifiers(vector<snpClass> & snps,
-                                vector<string> & ids) {
-  for (auto si = snps.begin(); si != snps.end(); si++) {
-    ids.push_back(si->name);
+void print_data_header(ostream & out, vector<string> & sample_names) {
+  out << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+  for (auto ni = sample_names.begin(); ni != sample_names.end(); ni++) {
+    out << "\t" << *ni;
   }
+  out << endl;
 
-  sort(ids.begin(), ids.end());
-  ids.erase(unique(ids.begin(), ids.end()), ids.end());
+  return;
 }
 
-void format_identifiers(vector<string> & identifiers, string & field) {
-  for (auto ni = identifiers.begin(); ni != identifiers.end(); ni++) {
-    field += *ni;
-
-    if (next(ni) != identifiers.end()) {
-      field += ";";
+// Buffers for the record of a locus, sized for the largest locus and
+// reused for every record
+struct RecordBuffers {
+  vector<int> kept;            // probes in the record
+  vector<char> alt_called;     // of each probe, by any sample
+  vector<char> name_used;      // of each name of the locus
+  vector<int> alt_num;         // of each candidate alt, or 0 if not called
+  vector<string> gt_text;      // of each code of each kept probe
+  string gt_values;            // BCF GT values of each code of each kept probe
+  size_t num_kept;
+  int num_called_alts;
+  string genotypes;
+  string record;
+
+  RecordBuffers(size_t max_probes, size_t num_samples) :
+    kept(max_probes), alt_called(max_probes), name_used(max_probes),
+    alt_num(max_probes), gt_text(max_probes * 4), gt_values(max_probes * 8, 0) {
+    genotypes.reserve(num_samples * (max_probes * 4 + 1));
+  }
+};
+
+// Select the probes of locus l to go in its record, from the rows of
+// genotype codes of its probes: those with a GenCall score that passed
+// for at least one sample. Marks the names of the locus that are used
+// and numbers its called alts from 1, after the ref. Returns false if
+// there is no record.
+bool select_locus_probes(LocusTable & table, size_t l, const unsigned char *codes,
+                         RecordBuffers & buffers) {
+  size_t num_samples = gtc_files.size();
+  size_t first = table.locus_start[l];
+  size_t num_probes = table.locus_start[l + 1] - first;
+  size_t num_alts = table.alt_start[l + 1] - table.alt_start[l];
+
+  // Probes which passed for any sample, and whether their alt was called
+  size_t num_kept = 0;
+  const unsigned char *row = codes;
+  for (size_t j = 0; j < num_probes; j++, row += num_samples) {
+    bool passed = false, alt = false;
+    for (size_t s = 0; s < num_samples; s++) {
+      unsigned char code = row[s];
+      passed |= code != FAILED;
+      alt |= code == 2 || code == 3;
     }
+    if (passed) {
+      buffers.alt_called[num_kept] = alt;
+      buffers.kept[num_kept++] = j;
+    }
+  }
+  buffers.num_kept = num_kept;
+  if (num_kept == 0) return false;
+
+  fill(buffers.name_used.begin(), buffers.name_used.begin() + num_probes, 0);
+  fill(buffers.alt_num.begin(), buffers.alt_num.begin() + num_alts, 0);
+  for (size_t k = 0; k < num_kept; k++) {
+    size_t p = first + buffers.kept[k];
+    buffers.name_used[table.name_rank[p]] = 1;
+    if (buffers.alt_called[k]) buffers.alt_num[table.alt_rank[p]] = 1;
   }
+  int num_called_alts = 0;
+  for (size_t a = 0; a < num_alts; a++) {
+    if (buffers.alt_num[a]) buffers.alt_num[a] = ++num_called_alts;
+  }
+  buffers.num_called_alts = num_called_alts;
+  return true;
+}
+
+void invalid_genotype_code(LocusTable & table, size_t p, int gt_code) {
+  cerr << "Invalid genotype code " << gt_code
+       << " for index " << table.probes[p]->index - 1 << endl;
+  exit(GTC_ERROR);
 }
 
-void format_alts(vector<char> & alts, string & field) {
-  if (alts.empty()) {
-    field = ".";
+// Print the record of locus l, from the rows of genotype codes of its
+// probes. Only probes with a GenCall score that passed for at least one
+// sample are in the record; a sample's genotype for a probe that failed
+// for it is ".".
+void print_locus_record(LocusTable & table, size_t l, const unsigned char *codes,
+                        RecordBuffers & buffers) {
+  if (!select_locus_probes(table, l, codes, buffers)) return;
+  size_t num_samples = gtc_files.size();
+  size_t first = table.locus_start[l];
+  size_t num_probes = table.locus_start[l + 1] - first;
+  const string *names = &table.names[table.name_start[l]];
+  const char *alts = &table.alts[table.alt_start[l]];
+  size_t num_alts = table.alt_start[l + 1] - table.alt_start[l];
+  size_t num_kept = buffers.num_kept;
+
+  // Text of each genotype code of each kept probe
+  for (size_t k = 0; k < num_kept; k++) {
+    size_t p = first + buffers.kept[k];
+    string alt_num = to_string(buffers.alt_num[table.alt_rank[p]]);
+    string *text = &buffers.gt_text[k * 4];
+    text[0] = ".";
+    text[1] = "0/0";
+    text[2] = "0/" + alt_num;
+    text[3] = alt_num + "/" + alt_num;
   }
-  else {
-    for (auto ai = alts.begin(); ai != alts.end(); ai++) {
-      field += *ai;
 
-      if (next(ai) != alts.end()) {
-        field += ",";
+  // Genotypes field of each sample
+  string & genotypes = buffers.genotypes;
+  genotypes.clear();
+  int n = 0;          // Total number of called alleles
+  int num_with_data = 0;
+  for (size_t s = 0; s < num_samples; s++) {
+    genotypes += '\t';
+    bool with_data = false;
+    for (size_t k = 0; k < num_kept; k++) {
+      if (k > 0) genotypes += ':';
+      int gt_code = codes[buffers.kept[k] * num_samples + s];
+      if (gt_code == FAILED) {
+        genotypes += '.';
+        continue;
       }
+      if (gt_code > 3) invalid_genotype_code(table, first + buffers.kept[k], gt_code);
+      with_data = true;
+      if (gt_code) n += 2;
+      genotypes += buffers.gt_text[k * 4 + gt_code];
     }
+    if (with_data) num_with_data++;
   }
-}
-
-void format_info(int num_called, vector<char> & alts, string & field) {
-  field += "NS=1";
-  field += ";AC=" + to_string(alts.size());
-  field += ";AN=" + to_string(num_called);
-}
 
-void format_genotypes(vector<string> & genotypes,
-                      string & format_field, string & genotypes_field) {
-  for (auto gi = genotypes.begin(); gi != genotypes.end(); gi++) {
-    format_field    += "GT";
-    genotypes_field += *gi;
+  snpClass *locus = table.probes[first];
+  string & record = buffers.record;
+  record.clear();
+  record += locus->chromosome;
+  record += '\t';
+  record += to_string(locus->position);
+  record += '\t';
 
-    if (next(gi) != genotypes.end()) {
-      format_field    += ":";
-      genotypes_field += ":";
-    }
+  // VCF spec section 1.4.1.3
+  bool separator = false;
+  for (size_t i = 0; i < num_probes; i++) {
+    if (!buffers.name_used[i]) continue;
+    if (separator) record += ';';
+    record += names[i];
+    separator = true;
   }
-}
+  record += '\t';
+  record += locus->snp[0];
+  record += '\t';
 
-void print_chr_name_fields(vector<string> & chr_names) {
-  for (auto ni = chr_names.begin(); ni != chr_names.end(); ni++) {
-    cout << "##contig=<ID=" << *ni << ">" << endl;
+  // VCF spec section 1.4.1.5
+  separator = false;
+  for (size_t a = 0; a < num_alts; a++) {
+    if (!buffers.alt_num[a]) continue;
+    if (separator) record += ',';
+    record += alts[a];
+    separator = true;
   }
+  if (!separator) record += '.';
+  record += "\t.\tPASS\t";
 
-  return;
+  // VCF spec section 1.4.1.8
+  record += "NS=" + to_string(num_with_data);
+  record += ";AC=" + to_string(buffers.num_called_alts);
+  record += ";AN=" + to_string(n);
+  record += '\t';
+
+  for (size_t k = 0; k < num_kept; k++) {
+    if (k > 0) record += ':';
+    record += "GT";
+  }
+  record += genotypes;
+  record += '\n';
+  uint64_t start = bgzf ? bgzf->tell() : 0;
+  output(record);
+  if (tabix) {
+    // REF is one base
+    tabix->add(locus->chromosome, locus->position - 1, locus->position,
+               start, bgzf->tell());
+  }
 }
 
-void print_data_header(string sample_name) {
-  cout << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\t"
-       << sample_name
-       << endl;
+// BCF2 typed values, VCF spec section 6.3.3; BCF is little-endian
+const int BCF_INT8 = 1, BCF_INT16 = 2, BCF_INT32 = 3, BCF_CHAR = 7;
+const uint32_t BCF_MISSING_FLOAT = 0x7f800001;
+const char BCF_INT8_VECTOR_END = (char) 0x81;
 
-  return;
-}
+// Offsets in the dictionary of strings of the BCF header, which has the
+// IDs of its FILTER, INFO and FORMAT lines in order, with PASS first
+const int BCF_PASS = 0, BCF_NS = 1, BCF_AC = 2, BCF_AN = 3, BCF_GT = 5;
 
-void print_locus_records(Gtc & gtc, vector<snpClass> & snps) {
-  vector<string> identifiers;
-  collect_unique_identifiers(snps, identifiers);
+void bcf_append32(string & out, uint32_t value) {
+  for (int i = 0; i < 4; i++) out += (char) ((value >> (8 * i)) & 0xff);
+}
 
-  vector<char> alts;
-  collect_unique_alts(gtc, snps, alts);
+// A single integer, in the smallest type that holds it
+void bcf_typed_int(string & out, int32_t value) {
+  if (value >= -120 && value <= 127) {
+    out += (char) (1 << 4 | BCF_INT8);
+    out += (char) value;
+  }
+  else if (value >= -32760 && value <= 32767) {
+    out += (char) (1 << 4 | BCF_INT16);
+    out += (char) (value & 0xff);
+    out += (char) ((value >> 8) & 0xff);
+  }
+  else {
+    out += (char) (1 << 4 | BCF_INT32);
+    bcf_append32(out, value);
+  }
+}
 
-  // Map sorted alt bases to an alt index number
-  map<char, int> alt_nums;
-  for (auto ai = alts.begin(); ai != alts.end(); ai++) {
-    alt_nums[*ai] = alt_nums.size();
+void bcf_type_descriptor(string & out, size_t count, int type) {
+  if (count < 15) {
+    out += (char) (count << 4 | type);
+  }
+  else {
+    out += (char) (15 << 4 | type);
+    bcf_typed_int(out, count);
   }
+}
 
-  vector<string> genotypes;
-  int n = 0; // Total number of called alleles
+void bcf_typed_string(string & out, const string & s) {
+  bcf_type_descriptor(out, s.size(), BCF_CHAR);
+  out += s;
+}
 
-  // Calculate data fields 
-  for (auto si = snps.begin(); si != snps.end(); si++) {
-    int i = si->index - 1;
-    int gt_code = gtc.genotypes[i];
+// Write the BCF header: the VCF header text, with its length
+void print_bcf_header(const string & text) {
+  string header("BCF\2\2", 5);
+  bcf_append32(header, text.size() + 1);
+  header += text;
+  header += '\0';
+  output(header);
+}
 
-    string gt_ref = "0";
-    string gt_alt;
-    if (gt_code == 2 or gt_code == 3) {
-      gt_alt = to_string(alt_nums[si->snp[1]]);
-    }
+// Write the BCF record of locus l, whose chromosome is the contig'th in
+// the header. As print_locus_record, but each sample's GT values are
+// taken directly from its genotype codes, as two int8 allele values.
+void print_locus_bcf(LocusTable & table, size_t l, const unsigned char *codes,
+                     int contig, RecordBuffers & buffers) {
+  if (!select_locus_probes(table, l, codes, buffers)) return;
+  size_t num_samples = gtc_files.size();
+  size_t first = table.locus_start[l];
+  size_t num_probes = table.locus_start[l + 1] - first;
+  const string *names = &table.names[table.name_start[l]];
+  const char *alts = &table.alts[table.alt_start[l]];
+  size_t num_alts = table.alt_start[l + 1] - table.alt_start[l];
+  size_t num_kept = buffers.num_kept;
+
+  // GT values of each genotype code of each kept probe: an allele a is
+  // (a + 1) << 1, unphased; a missing genotype is a missing allele, 0,
+  // padded with the end of the vector
+  for (size_t k = 0; k < num_kept; k++) {
+    size_t p = first + buffers.kept[k];
+    char alt = (buffers.alt_num[table.alt_rank[p]] + 1) << 1;
+    char *values = &buffers.gt_values[k * 8];
+    values[0] = 0;   values[1] = BCF_INT8_VECTOR_END;
+    values[2] = 2;   values[3] = 2;
+    values[4] = 2;   values[5] = alt;
+    values[6] = alt; values[7] = alt;
+  }
 
-    string genotype;
-    switch (gt_code) {
-        case 0: genotype += ".";                           break;
-        case 1: genotype += gt_ref + "/" + gt_ref; n += 2; break;
-        case 2: genotype += gt_ref + "/" + gt_alt; n += 2; break;
-        case 3: genotype += gt_alt + "/" + gt_alt; n += 2; break;
-
-        default:
-          cerr << "Invalid genotype code " << gt_code
-               << " for index " << i << endl;
-          exit(GTC_ERROR);
+  // Per-sample fields: a GT of two int8 values for each kept probe
+  string & genotypes = buffers.genotypes;
+  genotypes.clear();
+  int n = 0;          // Total number of called alleles
+  size_t num_with_data = 0;
+  for (size_t k = 0; k < num_kept; k++) {
+    const unsigned char *row = codes + buffers.kept[k] * num_samples;
+    const char *values = &buffers.gt_values[k * 8];
+    bcf_typed_int(genotypes, BCF_GT);
+    bcf_type_descriptor(genotypes, 2, BCF_INT8);
+    size_t offset = genotypes.size();
+    genotypes.resize(offset + num_samples * 2);
+    char *gt = &genotypes[offset];
+    for (size_t s = 0; s < num_samples; s++, gt += 2) {
+      int gt_code = row[s];
+      if (gt_code == FAILED) gt_code = 0;
+      else if (gt_code > 3) invalid_genotype_code(table, first + buffers.kept[k], gt_code);
+      else if (gt_code) n += 2;
+      gt[0] = values[gt_code * 2];
+      gt[1] = values[gt_code * 2 + 1];
+    }
+  }
+  for (size_t s = 0; s < num_samples; s++) {
+    for (size_t k = 0; k < num_kept; k++) {
+      if (codes[buffers.kept[k] * num_samples + s] != FAILED) {
+        num_with_data++;
+        break;
+      }
     }
-
-    genotypes.push_back(genotype);
   }
 
-  // VCF spec section 1.4.1.3
-  string identifiers_field;
-  format_identifiers(identifiers, identifiers_field);
-
-  // VCF spec section 1.4.1.5
-  string alts_field;
-  format_alts(alts, alts_field);
-
-  // VCF spec section 1.4.1.8
-  string info_field;
-  format_info(n, alts, info_field);
-
-  string format_field;
-  string genotypes_field;
-  format_genotypes(genotypes, format_field, genotypes_field);
-
-  cout << snps.at(0).chromosome << "\t"
-       << snps.at(0).position   << "\t"
-       << identifiers_field     << "\t"
-       << snps.at(0).snp[0]     << "\t"
-       << alts_field            << "\t"
-       << "."                   << "\t"
-       << "PASS"                << "\t"
-       << info_field            << "\t"
-       << format_field          << "\t"
-       << genotypes_field       << endl;
+  snpClass *locus = table.probes[first];
+  string & record = buffers.record;
+  record.assign(8, 0);  // lengths of the shared and per-sample data
+  bcf_append32(record, contig);
+  bcf_append32(record, locus->position - 1);
+  bcf_append32(record, 1);  // REF is one base
+  bcf_append32(record, BCF_MISSING_FLOAT);
+  bcf_append32(record, (buffers.num_called_alts + 1) << 16 | 3);
+  bcf_append32(record, num_kept << 24 | num_samples);
+
+  string id;
+  for (size_t i = 0; i < num_probes; i++) {
+    if (!buffers.name_used[i]) continue;
+    if (id.size()) id += ';';
+    id += names[i];
+  }
+  bcf_typed_string(record, id);
+  bcf_typed_string(record, string(1, locus->snp[0]));
+  for (size_t a = 0; a < num_alts; a++) {
+    if (buffers.alt_num[a]) bcf_typed_string(record, string(1, alts[a]));
+  }
+  bcf_typed_int(record, BCF_PASS);
+
+  bcf_typed_int(record, BCF_NS);
+  bcf_typed_int(record, num_with_data);
+  bcf_typed_int(record, BCF_AC);
+  bcf_typed_int(record, buffers.num_called_alts);
+  bcf_typed_int(record, BCF_AN);
+  bcf_typed_int(record, n);
+
+  uint32_t shared = record.size() - 8, indiv = genotypes.size();
+  for (int i = 0; i < 4; i++) {
+    record[i] = (char) ((shared >> (8 * i)) & 0xff);
+    record[4 + i] = (char) ((indiv >> (8 * i)) & 0xff);
+  }
+  output(record);
+  output(genotypes);
 }
 
 int main(int argc, char *argv[]) {
 
   char c;
-  while ((c = getopt (argc, argv, "g:hm:r:v")) != -1) {
+  while ((c = getopt (argc, argv, "g:hj:m:M:o:r:s:v")) != -1) {
     switch (c) {
-        case 'g': gtc_file       = optarg; break;
+        case 'g': gtc_files.push_back(optarg); break;
         case 'h': print_usage(); exit(0);  break;
+        case 'j': threads        = atoi(optarg); break;
         case 'm': manifest_file  = optarg; break;
+        case 'M': memory_budget  = atol(optarg); break;
+        case 'o': output_file    = optarg; break;
         case 'r': reference_name = optarg; break;
+        case 's': sample_sheet   = optarg; break;
         case 'v': verbose = true;          break;
     }
   }
+  if (threads < 1) threads = 1;
 
-  if (gtc_file.size() == 0) {
+  if (sample_sheet.size() > 0) {
+    read_sample_sheet(sample_sheet, gtc_files, sample_names);
+  }
+  if (gtc_files.size() == 0) {
     print_usage();
     cerr << "No GTC file specified" << endl;
     exit(CLI_OPTIONS_ERR);
@@ -322,6 +679,7 @@ int main(int argc, char *argv[]) {
     if (verbose) {
       cout << "Using manifest file " << manifest_file << endl;
     }
+    manifest->select_fields(Manifest::ALLELE_FIELDS);
     manifest->open(manifest_file);
     manifest->order_by_locus();
   }
@@ -330,47 +688,137 @@ int main(int argc, char *argv[]) {
     exit(MANIFEST_ERR);
   }
 
+  // Sample names not given in the sample sheet are those in the GTC files
+  size_t num_samples = gtc_files.size();
+  sample_names.resize(num_samples);
   Gtc gtc;
-  gtc.open(gtc_file, Gtc::GENOTYPES | Gtc::BASECALLS | Gtc::SCORES);
+  for (size_t s = 0; s < num_samples; s++) {
+    if (sample_names[s].size() > 0) continue;
+    try {
+      gtc.open(gtc_files[s], 0);
+      if (gtc.errorMsg.length()) throw gtc.errorMsg;
+    }
+    catch (string msg) {
+      cerr << msg << endl;
+      exit(GTC_ERROR);
+    }
+    sample_names[s] = gtc.sampleName;
+  }
 
   vector<string> chromosomes;
   collect_chr_names(*manifest, chromosomes);
 
-  vector<snpClass> called_snps;
-  filter_fails_and_indels(*manifest, gtc, called_snps);
-
-  print_boilerplate_fields();
-  print_chr_name_fields(chromosomes);
-  print_data_header(gtc.sampleName);
-
   // There are multiple probes at the same locus to be combined into a
   // single VCF record
-  vector<snpClass> accum;
-  for (auto si = called_snps.begin(); si != called_snps.end(); si++) {
-    // Collect first result
-    if (si == called_snps.begin()) {
-      accum.push_back(*si);
-      continue;
+  LocusTable table;
+  build_locus_table(*manifest, table);
+  vector<size_t> & locus_start = table.locus_start;
+
+  size_t n = output_file.size();
+  try {
+    if (n > 4 && output_file.compare(n - 4, 4, ".bcf") == 0) {
+      bgzf = new BgzfWriter(output_file, threads);
+      bcf = true;
+    }
+    else if (n > 3 && output_file.compare(n - 3, 3, ".gz") == 0) {
+      bgzf = new BgzfWriter(output_file, threads);
+      tabix = new TabixIndex();
+    }
+    else if (n > 0) {
+      vcf_file.open(output_file.c_str(), ios::binary | ios::out | ios::trunc);
+      if (!vcf_file) throw "Cannot open " + output_file + " for writing";
+      vcf = &vcf_file;
     }
+  }
+  catch (string s) {
+    cerr << s << endl;
+    exit(OUTPUT_ERR);
+  }
+
+  ostringstream header;
+  print_boilerplate_fields(header);
+  print_chr_name_fields(header, chromosomes);
+  print_data_header(header, sample_names);
+  if (bcf) {
+    print_bcf_header(header.str());
+  }
+  else {
+    output(header.str());
+  }
 
-    if (si->chromosome.compare(prev(si, 1)->chromosome) == 0 &&
-        si->position == prev(si, 1)->position) {
-      // Collect current locus
-      accum.push_back(*si);
+  // The genotype codes of a block of whole loci, as many as fit in
+  // memory_budget, are read from every GTC file, then their records
+  // are printed. If the loci do not all fit, the GTC files are read
+  // again for each block.
+  size_t block_probes = ((size_t) memory_budget << 20) / num_samples;
+  vector<size_t> block_start(1, 0);  // first locus of each block
+  size_t max_probes = 0;
+  size_t num_loci = locus_start.size() - 1;
+  for (size_t l = 0; l < num_loci; l++) {
+    size_t first = locus_start[block_start.back()];
+    if (l > block_start.back() && locus_start[l + 1] - first > block_probes) {
+      block_start.push_back(l);
+      first = locus_start[l];
+    }
+    max_probes = max(max_probes, locus_start[l + 1] - first);
+  }
+  block_start.push_back(num_loci);
+  vector<unsigned char> codes(max_probes * num_samples);
+
+  RecordBuffers buffers(table.max_probes, num_samples);
+  for (size_t b = 0; b + 1 < block_start.size(); b++) {
+    size_t first = locus_start[block_start[b]];
+    size_t last = locus_start[block_start[b + 1]];
+    if (first == last) continue;
+    if (verbose) {
+      cerr << "Reading probes " << first + 1 << " to " << last << " of "
+           << table.probes.size() << " from " << num_samples << " GTC files" << endl;
+    }
+    string error_msg;
+    if (threads == 1) {
+      decode_genotypes(table.probes, first, last, &codes[0], 0, error_msg);
     }
     else {
-      // Process current locus and clear
-      print_locus_records(gtc, accum);
-      accum.clear();
+      vector<thread> workers;
+      for (int t = 0; t < threads; t++) {
+        workers.push_back(thread(decode_genotypes, ref(table.probes), first, last,
+                                 &codes[0], t, ref(error_msg)));
+      }
+      for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+    }
+    if (!error_msg.empty()) {
+      cerr << error_msg << endl;
+      exit(GTC_ERROR);
+    }
 
-      // Collect new current locus
-      accum.push_back(*si);
+    for (size_t l = block_start[b]; l < block_start[b + 1]; l++) {
+      const unsigned char *locus_codes = &codes[(locus_start[l] - first) * num_samples];
+      if (bcf) {
+        // Index of the chromosome among the contigs of the header
+        const string & chromosome = table.probes[locus_start[l]]->chromosome;
+        int contig = lower_bound(chromosomes.begin(), chromosomes.end(), chromosome) -
+          chromosomes.begin();
+        print_locus_bcf(table, l, locus_codes, contig, buffers);
+      }
+      else {
+        print_locus_record(table, l, locus_codes, buffers);
+      }
     }
   }
 
-  if (!accum.empty()) {
-    // Print final locus
-    print_locus_records(gtc, accum);
+  try {
+    if (bgzf) {
+      bgzf->close();
+      if (tabix) tabix->write(output_file + ".tbi", *bgzf);
+    }
+    else if (vcf_file.is_open()) {
+      vcf_file.close();
+      if (vcf_file.fail()) throw "Error writing " + output_file;
+    }
+  }
+  catch (string s) {
+    cerr << s << endl;
+    exit(OUTPUT_ERR);
   }
 
   // The destructor causes a segfault by attempting to free something
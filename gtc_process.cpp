@@ -43,10 +43,17 @@
 #include <cmath>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
 
 #include "Gtc.h"
 #include "Manifest.h"
+#include "ManifestCache.h"
+#include "gtc_process.h"
 #include "win2unix.h"
+#include "json/json.h"
 
 using namespace std;
 
@@ -92,24 +99,33 @@ double goForIt(Gtc *gtc, Manifest *manifest)
 	return n ? meanTotal / n : 0;
 }
 
-// Read the manifest
+// The manifest of a GTC file is in the parent of its directory
+string manifestPath(string gtcName, string manifestName)
+{
+	string f = gtcName;
+	f = f.substr(0,f.find_last_of('/'));
+	return f + "/../" + manifestName + ".csv";
+}
+
+// Read the manifest, or find it in the cache
 //
 // gtcName is the full pathname of the GTC file, which we use to find the correct directory
 // manifestName is the name of the manifest file as stored in the GTC file
 //
-Manifest *loadManifest(string gtcName, string manifestName)
+Manifest *loadManifest(ManifestCache *cache, string gtcName, string manifestName)
 {
 	Manifest *manifest = new Manifest();
-	string f = gtcName;
-	f = f.substr(0,f.find_last_of('/'));
-	f = f + "/../" + manifestName + ".csv";
-	if (verbose) cout << "Reading manifest: " << f << endl;
-	try { 
-		manifest->open(f); 
+	manifest->select_fields(Manifest::NORMID_FIELD);
+	string f = manifestPath(gtcName, manifestName);
+	bool loaded;
+	try {
+		manifest = cache->open(manifest, f, &loaded);
 	}
 	catch (string s) {
-		cout << s << endl;
+		delete manifest;
+		throw;
 	}
+	if (verbose && loaded) cerr << "Read manifest: " << f << endl;
 	return manifest;
 }
 
@@ -121,10 +137,6 @@ double getMeanIntensity(Gtc *gtc, Manifest *manifest)
 
 double getIlluminaPassrate(double cutOff, Gtc *gtc, Manifest *manifest)
 {
-	int pass=0;
-	int fail=0;
-	int cnv=0;
-
 	if (gtc->scores.size() != manifest->snps.size()) {
 		cerr << "Mismatch in sizes: scores = " << gtc->scores.size() << "  snps = " << manifest->snps.size() << endl;
 		exit(1);
@@ -132,43 +144,260 @@ double getIlluminaPassrate(double cutOff, Gtc *gtc, Manifest *manifest)
 
 	if (gtc->scores.size() == 0) return 0;
 
-	vector<float>::iterator s;
-	vector<snpClass>::iterator snp;
+	long pass, total;
+	manifest->count_passing(gtc->scores, cutOff, Manifest::CNV_PROBE, pass, total);
+	return (double)pass / (double)total * 100.0;
+}
 
-	for (s = gtc->scores.begin(), snp = manifest->snps.begin(); s != gtc->scores.end(); s++, snp++) {
-		if (snp->name.find("cnv") == string::npos) {
-			if (*s >= cutOff) pass++;
-			else              fail++;
-		} else {
-			cnv++;
+GtcQc getQc(double cutOff, Gtc *gtc, Manifest *manifest)
+{
+	GtcQc qc = {0, 0, 0, 0};
+	if (gtc->scores.size() != manifest->snps.size()) {
+		ostringstream msg;
+		msg << "Mismatch in sizes: scores = " << gtc->scores.size()
+		    << "  snps = " << manifest->snps.size();
+		throw msg.str();
+	}
+
+	// The rotation of each normalisation
+	vector<double> cosTheta, sinTheta;
+	for (vector<XFormClass>::iterator xf = gtc->XForm.begin(); xf != gtc->XForm.end(); xf++) {
+		cosTheta.push_back(cos(xf->theta));
+		sinTheta.push_back(sin(xf->theta));
+	}
+
+	long illuminaPass, illuminaTotal;
+	manifest->count_passing(gtc->scores, cutOff, Manifest::CNV_PROBE, illuminaPass, illuminaTotal);
+	// Float thresholds, so the loop can be vectorized: the least float
+	// at least cutOff, and the least above the "no call" score
+	float passScore = cutOff;
+	if (passScore < cutOff) passScore = nextafterf(passScore, INFINITY);
+	float callScore = 0.00000001;
+	if (callScore <= 0.00000001) callScore = nextafterf(callScore, INFINITY);
+	long pass = 0, correctedPass = 0, corrected = 0;
+	const float *scores = gtc->scores.data();
+	size_t numScores = gtc->scores.size();
+	for (size_t i = 0; i < numScores; i++) {
+		long passed = scores[i] >= passScore;
+		long counted = scores[i] >= callScore;
+		pass += passed;
+		correctedPass += passed & counted;
+		corrected += counted;
+	}
+
+	double meanTotal = 0;
+	int n = 0;
+	double epsilon = 1e-6;
+	for (size_t i = 0; i < manifest->snps.size(); i++) {
+		snpClass *snp = &manifest->snps[i];
+
+		// Normalised intensities; see goForIt()
+		int idx = snp->index - 1;
+		map<int,int>::const_iterator norm = manifest->normIdMap.find(snp->normId);
+		unsigned int xf = norm == manifest->normIdMap.end() ? 0 : norm->second;
+		XFormClass *XF = &gtc->XForm[xf];
+		double tempx = gtc->xRawIntensity[idx] - XF->xOffset;
+		double tempy = gtc->yRawIntensity[idx] - XF->yOffset;
+		double tempx2 = cosTheta[xf] * tempx + sinTheta[xf] * tempy;
+		double tempy2 = -sinTheta[xf] * tempx + cosTheta[xf] * tempy;
+		double tempx3 = tempx2 - XF->shear * tempy2;
+		double tempy3 = tempy2;
+		if (abs(XF->xScale) > epsilon && abs(XF->yScale) > epsilon) {
+			double xn = tempx3 / XF->xScale;
+			double yn = tempy3 / XF->yScale;
+			if (!std::isnan(xn) && !std::isnan(yn)) {
+				meanTotal += (yn-xn);
+				n++;
+			}
 		}
 	}
 
-	return (double)pass / (double)(pass+fail) * 100.0;
+	if (gtc->scores.size() == 0) return qc;
+	if (illuminaTotal) {
+		qc.illuminaPassrate = (double)illuminaPass / (double)illuminaTotal * 100.0;
+	}
+	qc.passrate = (double)pass / (double)gtc->scores.size() * 100.0;
+	if (corrected) {
+		qc.correctedPassrate = (double)correctedPass / (double)corrected * 100.0;
+	}
+	qc.meanIntensity = n ? meanTotal / n : 0;
+	return qc;
 }
 
 #ifdef TEST
-int main(int argc, char *argv[])
+int threads = 1;
+double cutOff = 0.15;
+
+void print_usage()
+{
+	cout << "gtc_process "
+	     << "[-h] "
+	     << "[-j <threads>] "
+	     << "[-o <output file>] "
+	     << "[-s <sample sheet>] "
+	     << "[-v] "
+	     << "[<GTC file> ...]" << endl
+	     << "Writes the QC metrics of each GTC file as TSV, or as JSON "
+	     << "if the output file is named *.json" << endl;
+}
+
+// Read a sample sheet: a file of GTC file names, one per line, or a JSON
+// array of objects with the GTC file name in "result" and the sample name
+// in "uri"
+void readSampleSheet(string path, vector<string> &files, vector<string> &names)
 {
-	string manifestFile = "";
-	Manifest *manifest = NULL;
-	Gtc *gtc = new Gtc();
-	verbose = true;
-
-	for (int n=1; n<argc; n++) {
-		gtc->open(win2unix(argv[n]),Gtc::XFORM | Gtc::INTENSITY | Gtc::SCORES);
-		if (manifestFile != gtc->manifest) manifest = loadManifest(win2unix(argv[n]),gtc->manifest);
-		manifestFile = gtc->manifest;
-//		double mean = getMeanIntensity(gtc, manifest);
-//		printf("Mean Intensity Difference for %s \t= %lf\n", argv[n], mean);
-		double passrate = getIlluminaPassrate(0.15, gtc, manifest);
-		printf("Illumina Passrate = %lf\n", passrate);
-//		passrate = gtc->passRate(0.15);
-//		printf("Passrate = %lf\n", passrate);
-//		passrate = gtc->correctedPassRate(0.15);
-//		printf("Corrected Passrate = %lf\n", passrate);
+	ifstream f(path.c_str());
+	if (!f) throw "Cannot open sample sheet " + path;
+	if (path.size() > 5 && path.compare(path.size() - 5, 5, ".json") == 0) {
+		Json::Value root;
+		Json::Reader reader;
+		if (!reader.parse(f, root)) {
+			throw "Failed to parse sample sheet " + path + "\n" + reader.getFormatedErrorMessages();
+		}
+		for (unsigned int i = 0; i < root.size(); i++) {
+			files.push_back(win2unix(root[i]["result"].asString()));
+			names.push_back(root[i]["uri"].asString());
+		}
+	}
+	else {
+		string file;
+		while (f >> file) {
+			files.push_back(win2unix(file));
+			names.push_back("");
+		}
 	}
 }
-#endif
 
+// Find the QC metrics of the GTC files, taking the next file not yet
+// taken by another thread until there are none left, or one has failed
+void processFiles(vector<string> &files, vector<string> &names, vector<GtcQc> &results,
+                  ManifestCache &cache, atomic<size_t> &next, string &errorMsg)
+{
+	static mutex errorLock;
+	static atomic<bool> failed(false);
+	Gtc gtc;
+	try {
+		for (size_t n = next++; n < files.size() && !failed; n = next++) {
+			gtc.open(files[n], Gtc::XFORM | Gtc::INTENSITY | Gtc::SCORES);
+			if (gtc.errorMsg.length()) throw gtc.errorMsg;
+			if (names[n].empty()) names[n] = gtc.sampleName;
+			Manifest *manifest = loadManifest(&cache, files[n], gtc.manifest);
+			try {
+				results[n] = getQc(cutOff, &gtc, manifest);
+			}
+			catch (string s) {
+				throw files[n] + ": " + s;
+			}
+		}
+	}
+	catch (string msg) {
+		lock_guard<mutex> lock(errorLock);
+		failed = true;
+		if (errorMsg.empty()) errorMsg = msg;
+	}
+	cache.release();
+}
+
+void writeTsv(ostream &out, vector<string> &files, vector<string> &names, vector<GtcQc> &results)
+{
+	out << "sample\tgtc\tillumina_pass_rate\tpass_rate\tcorrected_pass_rate\tmean_intensity_difference" << endl;
+	out << fixed << setprecision(6);
+	for (size_t n = 0; n < files.size(); n++) {
+		out << names[n] << '\t' << files[n] << '\t'
+		    << results[n].illuminaPassrate << '\t' << results[n].passrate << '\t'
+		    << results[n].correctedPassrate << '\t' << results[n].meanIntensity << '\n';
+	}
+}
+
+void writeJson(ostream &out, vector<string> &files, vector<string> &names, vector<GtcQc> &results)
+{
+	Json::Value root(Json::arrayValue);
+	for (size_t n = 0; n < files.size(); n++) {
+		Json::Value sample;
+		sample["sample"] = names[n];
+		sample["gtc"] = files[n];
+		sample["illumina_pass_rate"] = results[n].illuminaPassrate;
+		sample["pass_rate"] = results[n].passrate;
+		sample["corrected_pass_rate"] = results[n].correctedPassrate;
+		sample["mean_intensity_difference"] = results[n].meanIntensity;
+		root.append(sample);
+	}
+	Json::StyledStreamWriter writer;
+	writer.write(out, root);
+}
+
+int main(int argc, char *argv[])
+{
+	vector<string> files;
+	vector<string> names;
+	string sampleSheet;
+	string outfile;
+
+	int c;
+	while ((c = getopt(argc, argv, "hj:o:s:v")) != -1) {
+		switch (c) {
+			case 'h': print_usage(); exit(0); break;
+			case 'j': threads = atoi(optarg); break;
+			case 'o': outfile = optarg; break;
+			case 's': sampleSheet = optarg; break;
+			case 'v': verbose = true; break;
+			default: print_usage(); exit(1);
+		}
+	}
+	if (threads < 1) threads = 1;
+
+	try {
+		if (sampleSheet.size()) readSampleSheet(sampleSheet, files, names);
+		for (int n = optind; n < argc; n++) {
+			files.push_back(win2unix(argv[n]));
+			names.push_back("");
+		}
+		if (files.empty()) {
+			print_usage();
+			throw string("No GTC file specified");
+		}
+
+		// Results are kept in input order, whichever thread finds them
+		vector<GtcQc> results(files.size());
+		ManifestCache cache;
+		atomic<size_t> next(0);
+		string errorMsg;
+		if (threads == 1) {
+			processFiles(files, names, results, cache, next, errorMsg);
+		}
+		else {
+			vector<thread> workers;
+			for (int t = 0; t < threads; t++) {
+				workers.push_back(thread(processFiles, ref(files), ref(names), ref(results),
+				                         ref(cache), ref(next), ref(errorMsg)));
+			}
+			for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+		}
+		if (errorMsg.size()) throw errorMsg;
+		if (verbose) cache.report(cerr);
 
+		ofstream f;
+		ostream *out = &cout;
+		if (outfile.size()) {
+			f.open(outfile.c_str());
+			if (!f) throw "Cannot open " + outfile + " for writing";
+			out = &f;
+		}
+		if (outfile.size() > 5 && outfile.compare(outfile.size() - 5, 5, ".json") == 0) {
+			writeJson(*out, files, names, results);
+		}
+		else {
+			writeTsv(*out, files, names, results);
+		}
+		if (f.is_open()) {
+			f.close();
+			if (f.fail()) throw "Error writing " + outfile;
+		}
+	}
+	catch (string s) {
+		cerr << s << endl;
+		exit(1);
+	}
+	return 0;
+}
+#endif
@@ -30,3 +30,15 @@
 double getMeanIntensity(Gtc *gtc, Manifest *manifest);
 double getIlluminaPassrate(double cutOff, Gtc *gtc, Manifest *manifest);
 
+// The QC metrics of a sample, found in a single pass over its probes
+struct GtcQc {
+	double illuminaPassrate;   // as getIlluminaPassrate()
+	double passrate;           // as Gtc::passRate()
+	double correctedPassrate;  // as Gtc::correctedPassRate()
+	double meanIntensity;      // as getMeanIntensity()
+};
+
+// Only reads the manifest, so it may be shared by threads. Throws a
+// string if the manifest does not match the GTC file.
+GtcQc getQc(double cutOff, Gtc *gtc, Manifest *manifest);
+string manifestPath(string gtcName, string manifestName);
@@ -46,6 +46,7 @@ static struct option long_options[] = {
                    {"infile", 1, 0, 0},
                    {"outfile", 1, 0, 0},
                    {"verbose", 0, 0, 0},
+                   {"threads", 1, 0, 0},
                    {"help", 0, 0, 0},
                    {0, 0, 0, 0}
                };
@@ -55,8 +56,9 @@ void showUsage(char *argv[]) {
 
   cout << "Usage:   " << argv[0] << " [options]" << endl << endl;
 
-  cout << "Options: --infile <filename>    Input path to raw (unnormalized) .bpm.csv manifest" << endl;
+  cout << "Options: --infile <filename>    Input path to raw (unnormalized) .bpm.csv or .bpm manifest" << endl;
   cout << "         --outfile <filename>   Output path for normalized .bpm.csv manifest" << endl;
+  cout << "         --threads <n>          Number of parts of the manifest to normalize at once (default 1)" << endl;
   cout << "         --verbose              Show progress messages to STDERR" << endl;
   cout << "         --help                 Display this help text and exit" << endl;
 
@@ -71,6 +73,7 @@ int main(int argc, char *argv[])
   string outfile = "";
   bool verbose = false;
   bool help = false;
+  int threads = 1;
   int option_index = -1;
   int c;
 
@@ -85,6 +88,7 @@ int main(int argc, char *argv[])
       if (option == "infile") infile = optarg;
       if (option == "outfile") outfile = optarg;
       if (option == "verbose") verbose = true;
+      if (option == "threads") threads = atoi(optarg);
       if (option == "help") help = true;
     }
   }
@@ -101,10 +105,10 @@ int main(int argc, char *argv[])
     exit(1);
   }
 
+  // The manifest is read and written a part at a time, so it is
+  // never all in memory
   Manifest *manifest = new Manifest();
-  manifest->open(infile);
-  if (verbose) cerr << "Finished reading manifest: " << infile << endl;
-  manifest->write(outfile);
+  manifest->normalize(infile, outfile, false, threads);
   if (verbose) cerr << "Finished writing normalized manifest: " << outfile << endl;
 
 }
@@ -21,6 +21,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <stdint.h>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -144,8 +145,11 @@ bool plink_binary::next_snp(snp &snp, vector<string> &genotypes) {
 
 void plink_binary::read_snp(string snp, vector<string> &genotypes) {
     vector<int> gt_int;
-    int index = snp_index[snp];
-    read_snp(3 + index * bytes_per_snp, gt_int);
+    long index = snp_index.find(snps, snp);
+    if (index < 0) {
+        throw gftools::malformed_data("No SNP named " + snp + " in " + dataset);
+    }
+    read_snp(index, gt_int);
     genotypes_itoa(snps[index], gt_int, genotypes);
     snp_ptr = index + 1;
 }
@@ -342,13 +346,11 @@ void plink_binary::read_bim(vector<snp> &snps) {
     }
 
     string str;
-    int i = 0;
 
     while (getline(file, str)) {
-        snp snp = from_bim(str);
-        snps.push_back(snp);
-        snp_index[snp.name] = i++;
+        snps.push_back(from_bim(str));
     }
+    snp_index.build(snps);
 
     file.close();
 }
@@ -530,6 +532,40 @@ void plink_binary::write_individual(const vector<int> genotypes) {
     bed_write(genotypes);
 }
 
+void plink_binary::write_packed_snps(const char *buffer, size_t count) {
+    if (individuals.size() == 0) {
+        throw gftools::malformed_data("No individuals defined");
+    }
+    if (bed_mode != 1) {
+        throw gftools::malformed_data("Packed SNPs need a SNP-major BED file");
+    }
+    bed_file->write(buffer, count * ((3 + individuals.size()) / 4));
+}
+
+void plink_binary::transpose_calls(const char *individual_major, size_t individuals,
+                                   size_t snps, char *snp_major, size_t snp_bytes) {
+    size_t individual_bytes = (3 + snps) / 4;
+    for (size_t i = 0; i < individuals; i += 4) {
+        for (size_t c = 0; c < individual_bytes; c++) {
+            // a byte of each of four individuals, each of four SNPs; call
+            // (r, q), of individual r and SNP q, is at bit 8r + 2q
+            uint32_t x = 0;
+            for (size_t r = 0; r < 4 && i + r < individuals; r++) {
+                x |= (uint32_t) (unsigned char) individual_major[(i + r) * individual_bytes + c] << (8 * r);
+            }
+            // swap the calls across the diagonal of each 2x2 square,
+            // then the off-diagonal 2x2 squares, so call (r, q) is at bit 8q + 2r
+            uint32_t t = ((x >> 6) ^ x) & 0x00CC00CC;
+            x ^= t ^ (t << 6);
+            t = ((x >> 12) ^ x) & 0x0000F0F0;
+            x ^= t ^ (t << 12);
+            for (size_t q = 0; q < 4 && 4 * c + q < snps; q++) {
+                snp_major[(4 * c + q) * snp_bytes + i / 4] = x >> (8 * q);
+            }
+        }
+    }
+}
+
 void plink_binary::write_snp(snp snp, vector<string> genotypes) {
     vector<int> g_num;
     genotypes_atoi(snp, genotypes, g_num);
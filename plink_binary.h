@@ -29,6 +29,7 @@
 #include "snp.h"
 #include "individual.h"
 #include "exceptions.h"
+#include "NameIndex.h"
 
 class plink_binary {
 private:
@@ -89,7 +90,8 @@ public:
     /// The vector of individuals.
     std::vector<gftools::individual> individuals;
     /// An index of SNPs by name, mapping the name to an index in the BED data.
-    std::map<std::string, int> snp_index;
+    /// It refers to the names in snps, and must be rebuilt if they change.
+    NameIndex snp_index;
 
     /** Constructor that creates and initializes named dataset.
      * Implicitly opens the dataset in read mode.
@@ -235,6 +237,30 @@ public:
     void write_snp(gftools::snp snp, std::vector<std::string> genotypes);
     void write_individual(std::vector<int> genotypes);
 
+    /** Writes packed genotype calls of SNPs into the BED data, in SNP-major
+     * mode. The SNPs must already be in snps, and the individuals in
+     * individuals.
+     *
+     * @param buffer The calls of each SNP in turn, in PLINK's two bit
+     * encoding, (3 + individuals.size()) / 4 bytes per SNP.
+     * @param count The number of SNPs in buffer.
+     */
+    void write_packed_snps(const char *buffer, size_t count);
+
+    /** Transposes packed genotype calls from individual-major to SNP-major
+     * order, four SNPs of four individuals at a time.
+     *
+     * @param individual_major The calls of each individual in turn, in
+     * PLINK's two bit encoding, (3 + snps) / 4 bytes per individual.
+     * @param individuals The number of individuals.
+     * @param snps The number of SNPs.
+     * @param snp_major Updated with the calls of each SNP in turn, in the
+     * first (3 + individuals) / 4 bytes of each row.
+     * @param snp_bytes The length of a row of snp_major.
+     */
+    static void transpose_calls(const char *individual_major, size_t individuals,
+                                size_t snps, char *snp_major, size_t snp_bytes);
+
     /** Translates integer representations of genotype calls for one SNP to their
      * corresponding string representations.
      *
@@ -50,8 +50,17 @@ static struct option long_options[] = {
                    {"verbose", 0, 0, 0},
                    {"start", 1, 0, 0},
                    {"end", 1, 0, 0},
+                   {"region", 1, 0, 0},
                    {"magnitude", 1, 0, 0},
                    {"xydiff", 1, 0, 0},
+                   {"fast_math", 0, 0, 0},
+                   {"binary", 0, 0, 0},
+                   {"threads", 1, 0, 0},
+                   {"memory", 1, 0, 0},
+                   {"cluster_cache", 1, 0, 0},
+                   {"matrix", 0, 0, 0},
+                   {"threshold", 1, 0, 0},
+                   {"gtc_file", 1, 0, 0},
                    {0, 0, 0, 0}
                };
 
@@ -80,6 +89,54 @@ void showUsage(int argc, char *argv[])
           cout << "         --outfile <filename>   Name of FCR file to create or '-' for STDOUT" << endl;
           cout << "         --man_file <dirname>   Path to bpm.csv manifest file" << endl;
           cout << "         --egt_file <dirname>   Path to EGT binary cluster file" << endl;
+          cout << "         --fast_math            Use fast approximations for theta and logR (same output to printed precision)" << endl;
+          cout << "         --cluster_cache <filename>  Cache of EGT clusters in manifest order; created if absent or out of date" << endl;
+          cout << "         --verbose              Show progress messages to STDERR" << endl;
+          exit(0);
+        }
+
+        if (command == "baflrr") {
+          cout << "Usage:   " << argv[0] << " baflrr [options]" << endl << endl;
+          cout << "Create per-chromosome SNP x sample matrices of B allele frequency and log R ratio" << endl<< endl;
+          cout << "Options: --infile <filename>    File containing list of GTC files to process" << endl;
+          cout << "         --outfile <prefix>     Prefix for output files <prefix>.<chr>.baf.txt and <prefix>.<chr>.lrr.txt" << endl;
+          cout << "         --man_file <dirname>   Path to bpm.csv manifest file" << endl;
+          cout << "         --egt_file <dirname>   Path to EGT binary cluster file" << endl;
+          cout << "         --binary               Write float32 binary matrices (.bin) instead of text" << endl;
+          cout << "         --threads <n>          Number of samples to process in parallel (default 1)" << endl;
+          cout << "         --memory <MB>          Memory budget for transposing each chromosome (default " << BafLrrWriter::DEFAULT_MEMORY << ")" << endl;
+          cout << "         --fast_math            Use fast approximations for theta and logR (same output to printed precision)" << endl;
+          cout << "         --cluster_cache <filename>  Cache of EGT clusters in manifest order; created if absent or out of date" << endl;
+          cout << "         --verbose              Show progress messages to STDERR" << endl;
+          exit(0);
+        }
+
+        if (command == "call") {
+          cout << "Usage:   " << argv[0] << " call [options]" << endl << endl;
+          cout << "Call genotypes from a normalized SIM file, using the clusters in an EGT file" << endl<< endl;
+          cout << "Options: --infile <filename>    Name of SIM file to process or '-' for STDIN" << endl;
+          cout << "         --outfile <name>       PLINK dataset name for <name>.bed, .bim, .fam, or name of matrix file" << endl;
+          cout << "         --man_file <dirname>   Path to bpm.csv manifest file" << endl;
+          cout << "         --egt_file <dirname>   Path to EGT binary cluster file" << endl;
+          cout << "         --matrix               Write a packed 2-bit call matrix instead of PLINK BED" << endl;
+          cout << "         --threshold <score>    Minimum score for a call, from 0 to 1 (default 0.15)" << endl;
+          cout << "         --threads <n>          Number of samples to call in parallel (default 1)" << endl;
+          cout << "         --memory <MB>          Memory budget for transposing calls to SNP-major BED (default " << Caller::DEFAULT_MEMORY << ")" << endl;
+          cout << "         --cluster_cache <filename>  Cache of EGT clusters in manifest order; created if absent or out of date" << endl;
+          cout << "         --verbose              Show progress messages to STDERR" << endl;
+          exit(0);
+        }
+
+        if (command == "recluster") {
+          cout << "Usage:   " << argv[0] << " recluster [options]" << endl << endl;
+          cout << "Re-estimate EGT cluster positions from a normalized SIM file and the genotype calls in its GTC files" << endl<< endl;
+          cout << "Options: --infile <filename>    Name of SIM file to process or '-' for STDIN" << endl;
+          cout << "         --gtc_file <filename>  File containing list of GTC files, in the sample order of the SIM file" << endl;
+          cout << "         --outfile <filename>   Name of cluster table to create; may be given as --egt_file to other commands" << endl;
+          cout << "         --man_file <dirname>   Path to bpm.csv manifest file" << endl;
+          cout << "         --egt_file <dirname>   Path to EGT binary cluster file, or a cluster table, to update" << endl;
+          cout << "         --threads <n>          Number of samples to add in parallel (default 1)" << endl;
+          cout << "         --cluster_cache <filename>  Cache of EGT clusters in manifest order; created if absent or out of date" << endl;
           cout << "         --verbose              Show progress messages to STDERR" << endl;
           exit(0);
         }
@@ -92,6 +149,7 @@ void showUsage(int argc, char *argv[])
           cout << "         --man_file <dirname>    Directory to look for Manifest file in" << endl;
           cout << "         --start <index>        Which SNP to start processing at (default is to start at the beginning)" << endl;
           cout << "         --end <index>          Which SNP to end processing at (default is to continue until the end)" << endl;
+          cout << "         --region <chr:start-end> Process only the SNPs in this region, instead of --start and --end" << endl;
           cout << "         --verbose              Show progress messages to STDERR" << endl;
           exit(0);
 	}
@@ -129,6 +187,9 @@ void showUsage(int argc, char *argv[])
 	cout << "Command: view        Dump SIM file to screen" << endl;
 	cout << "         create      Create a SIM file from GTC files" << endl;
 	cout << "         fcr         Create a FCR file from GTC files" << endl;
+	cout << "         baflrr      Create BAF and LRR matrices from GTC files" << endl;
+	cout << "         call        Call genotypes from a SIM file and EGT clusters" << endl;
+	cout << "         recluster   Re-estimate EGT clusters from a SIM file and GTC calls" << endl;
 	cout << "         illuminus   Produce Illuminus output" << endl;
 	cout << "         genosnp     Produce GenoSNP output" << endl;
 	cout << "         qc          Produce QC metrics" << endl;
@@ -147,8 +208,17 @@ int main(int argc, char *argv[])
 	string xydiff = "";
 	bool verbose = false;
 	bool normalize = false;
+	bool fastMath = false;
+	bool binary = false;
+	int threads = 1;
+	long memory = BafLrrWriter::DEFAULT_MEMORY;
+	string cacheFile = "";
+	bool matrix = false;
+	double threshold = 0.15;
+	string gtcfile = "";
 	int start_pos = 0;
 	int end_pos = -1;
+	string region = "";
 	int option_index = -1;
 	int c;
 
@@ -171,8 +241,17 @@ int main(int argc, char *argv[])
 			if (option == "normalize") normalize = true;
 			if (option == "start") start_pos = atoi(optarg);
 			if (option == "end") end_pos = atoi(optarg);
+			if (option == "region") region = optarg;
 			if (option == "magnitude") magnitude = optarg;
 			if (option == "xydiff") xydiff = optarg;
+			if (option == "fast_math") fastMath = true;
+			if (option == "binary") binary = true;
+			if (option == "threads") threads = atoi(optarg);
+			if (option == "memory") memory = atol(optarg);
+			if (option == "cluster_cache") cacheFile = optarg;
+			if (option == "matrix") matrix = true;
+			if (option == "threshold") threshold = atof(optarg);
+			if (option == "gtc_file") gtcfile = optarg;
 		}
 	}
 
@@ -189,10 +268,22 @@ int main(int argc, char *argv[])
 	    commander->commandCreate(infile, outfile, normalize, 
 				     manfile, verbose);
 	  } else if (command == "fcr") {
-            commander->commandFCR(infile, outfile, manfile, egtfile, verbose);
+            commander->commandFCR(infile, outfile, manfile, egtfile, verbose,
+                                  fastMath, cacheFile);
+          } else if (command == "baflrr") {
+            commander->commandBafLrr(infile, outfile, manfile, egtfile, binary,
+                                     threads, memory, verbose, fastMath,
+                                     cacheFile);
+          } else if (command == "call") {
+            commander->commandCall(infile, outfile, manfile, egtfile, matrix,
+                                   threshold, threads, memory, verbose,
+                                   cacheFile);
+          } else if (command == "recluster") {
+            commander->commandRecluster(infile, gtcfile, outfile, manfile,
+                                        egtfile, threads, verbose, cacheFile);
           } else if (command == "illuminus") {
 	    commander->commandIlluminus(infile, outfile, manfile, 
-					start_pos, end_pos, verbose);
+					start_pos, end_pos, verbose, region);
 	  } else if (command == "genosnp") {
 	    commander->commandGenoSNP(infile, outfile, manfile, 
 				      start_pos, end_pos, verbose);
@@ -33,10 +33,20 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cxxtest/TestSuite.h>
+#include <sys/stat.h>
+#include <zlib.h>
 #include "commands.h"
 #include "Manifest.h"
+#include "ManifestCache.h"
+#include "NameIndex.h"
+#include "plink_binary.h"
+#include "Bgzf.h"
+#include "Tabix.h"
+#include "ClusterTable.h"
 #include "Egt.h"
 #include "Fcr.h"
+#include "FcrMath.h"
+#include "gtc_process.h"
 #include "unistd.h"
 #include "win2unix.h"
 
@@ -150,6 +160,459 @@ class TestBase :  public CxxTest::TestSuite
 };
 
 
+class BgzfTest : public TestBase
+{
+
+ public:
+
+  // the data of the BGZF member at the given compressed offset
+  string readMember(string path, uint64_t offset)
+  {
+    ifstream in(path.c_str(), ios::binary);
+    in.seekg(offset);
+    char header[18];
+    in.read(header, 18);
+    size_t size = ((unsigned char) header[16] | (unsigned char) header[17] << 8) + 1;
+    vector<char> member(size - 18);
+    in.read(&member[0], member.size());
+    string data(BgzfWriter::BLOCK_SIZE, '\0');
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    inflateInit2(&zs, -15);
+    zs.next_in = (Bytef *) &member[0];
+    zs.avail_in = member.size() - 8;
+    zs.next_out = (Bytef *) &data[0];
+    zs.avail_out = data.size();
+    inflate(&zs, Z_FINISH);
+    data.resize(zs.total_out);
+    inflateEnd(&zs);
+    return data;
+  }
+
+  void testBgzf(void)
+  {
+    string path = tempdir + "/data.gz";
+    string data;
+    for (int i = 0; i < 40000; i++) data += "line " + to_string(i) + "\n";
+    BgzfWriter *writer;
+    TS_ASSERT_THROWS_NOTHING(writer = new BgzfWriter(path, 2));
+    vector<uint64_t> positions;
+    for (size_t i = 0; i < data.size(); i += 1000) {
+      positions.push_back(writer->tell());
+      writer->write(data.substr(i, 1000));
+    }
+    TS_ASSERT_THROWS_NOTHING(writer->close());
+    TS_ASSERT(data.size() > 3 * BgzfWriter::BLOCK_SIZE);
+
+    // the whole file decompresses as gzip
+    gzFile in = gzopen(path.c_str(), "rb");
+    string read(data.size() + 1, '\0');
+    TS_ASSERT_EQUALS(gzread(in, &read[0], read.size()), data.size());
+    gzclose(in);
+    read.resize(data.size());
+    TS_ASSERT(read == data);
+
+    // virtual offsets find the data written at each position
+    for (size_t k = 0; k < positions.size(); k++) {
+      uint64_t offset = writer->virtual_offset(positions[k]);
+      string block = readMember(path, offset >> 16);
+      TS_ASSERT_EQUALS(block.substr(offset & 0xffff, 5), data.substr(k * 1000, 5));
+    }
+    // an empty member ends the file
+    struct stat st;
+    stat(path.c_str(), &st);
+    TS_ASSERT_EQUALS(writer->virtual_offset(writer->tell()) >> 16, st.st_size - 28);
+    delete writer;
+    TS_TRACE("BGZF file written");
+
+    // incompressible data still fits a block to each member
+    path = tempdir + "/random.gz";
+    data.clear();
+    srand(1);
+    for (int i = 0; i < 3 * BgzfWriter::BLOCK_SIZE; i++) data += (char) rand();
+    BgzfWriter random(path);
+    TS_ASSERT_THROWS_NOTHING(random.write(data));
+    TS_ASSERT_THROWS_NOTHING(random.close());
+    in = gzopen(path.c_str(), "rb");
+    read.assign(data.size() + 1, '\0');
+    TS_ASSERT_EQUALS(gzread(in, &read[0], read.size()), data.size());
+    gzclose(in);
+    read.resize(data.size());
+    TS_ASSERT(read == data);
+  }
+
+  void testTabix(void)
+  {
+    TS_ASSERT_EQUALS(TabixIndex::bin(0, 1), 4681);
+    TS_ASSERT_EQUALS(TabixIndex::bin(16384, 16385), 4682);
+    TS_ASSERT_EQUALS(TabixIndex::bin(16000, 17000), 585);
+    TS_ASSERT_EQUALS(TabixIndex::bin(0, 1 << 29), 0);
+
+    string path = tempdir + "/calls.vcf.gz";
+    BgzfWriter writer(path);
+    TabixIndex index;
+    writer.write("#header\n");
+    string sequences[2] = { "1", "X" };
+    for (int s = 0; s < 2; s++) {
+      for (long position = 1000; position < 100000; position += 1000) {
+        uint64_t start = writer.tell();
+        writer.write(sequences[s] + "\t" + to_string(position) + "\n");
+        index.add(sequences[s], position - 1, position, start, writer.tell());
+      }
+    }
+    // records must be in order
+    TS_ASSERT_THROWS_ANYTHING(index.add("1", 0, 1, writer.tell(), writer.tell()));
+    TS_ASSERT_THROWS_ANYTHING(index.add("X", 0, 1, writer.tell(), writer.tell()));
+    writer.close();
+    TS_ASSERT_THROWS_NOTHING(index.write(path + ".tbi", writer));
+
+    gzFile in = gzopen((path + ".tbi").c_str(), "rb");
+    char buffer[44];
+    TS_ASSERT_EQUALS(gzread(in, buffer, 44), 44);
+    gzclose(in);
+    TS_ASSERT_EQUALS(string(buffer, 4), string("TBI\1", 4));
+    int32_t fields[8];
+    memcpy(fields, buffer + 4, sizeof(fields));
+    TS_ASSERT_EQUALS(fields[0], 2);   // sequences
+    TS_ASSERT_EQUALS(fields[1], 2);   // VCF
+    TS_ASSERT_EQUALS(fields[5], '#');
+    TS_ASSERT_EQUALS(fields[7], 4);   // length of names
+    TS_ASSERT_EQUALS(string(buffer + 36, 4), string("1\0X\0", 4));
+    TS_TRACE("Tabix index written");
+
+    // a record at position 0, of an unplaced probe, is indexed as if at 1
+    TS_ASSERT_EQUALS(TabixIndex::bin(-1, 0), 4681);
+    TabixIndex unplaced;
+    TS_ASSERT_THROWS_NOTHING(unplaced.add("0", -1, 0, 0, 10));
+    TS_ASSERT_THROWS_NOTHING(unplaced.add("0", 0, 1, 10, 20));
+    TS_ASSERT_THROWS_NOTHING(unplaced.write(path + ".0.tbi", writer));
+  }
+
+};
+
+class G2vTest : public TestBase
+{
+
+ public:
+
+  // copy the example GTC files to the temporary directory, as sample s
+  // of tempdir/sample_<s>.gtc, and return their names
+  vector<string> copyExampleGtcs(void)
+  {
+    vector<string> paths;
+    for (int s = 0; s < 5; s++) {
+      string path = tempdir + "/sample_" + to_string(s) + ".gtc";
+      string cmd = "/bin/cp data/example_000" + to_string(s) + ".gtc " + path;
+      TS_ASSERT_EQUALS(system(cmd.c_str()), 0);
+      paths.push_back(path);
+    }
+    return paths;
+  }
+
+  // set the genotype code and GenCall score of the probe with the given
+  // index, counted from 0, in a GTC file
+  void setCall(string path, int index, char genotype, float score)
+  {
+    fstream gtc(path.c_str(), ios::in | ios::out | ios::binary);
+    int32_t entries = 0;
+    gtc.seekg(4);
+    gtc.read((char *) &entries, 4);
+    for (int i = 0; i < entries; i++) {
+      uint16_t id = 0;
+      uint32_t offset = 0;
+      gtc.seekg(8 + 6 * i);
+      gtc.read((char *) &id, 2);
+      gtc.read((char *) &offset, 4);
+      if (id == 1002) {
+        gtc.seekp(offset + 4 + index);
+        gtc.write(&genotype, 1);
+      }
+      if (id == 1004) {
+        gtc.seekp(offset + 4 + 4 * index);
+        gtc.write((char *) &score, 4);
+      }
+    }
+    TS_ASSERT(gtc.good());
+  }
+
+  // the header line of sample names, and the records, of a VCF file
+  vector<string> readVcf(string path)
+  {
+    vector<string> lines;
+    ifstream vcf(path.c_str());
+    string line;
+    while (getline(vcf, line)) {
+      if (line.compare(0, 2, "##") != 0) lines.push_back(line);
+    }
+    return lines;
+  }
+
+  void testG2vSamples(void)
+  {
+    TS_TRACE("Test of g2v with several samples");
+    vector<string> gtcs = copyExampleGtcs();
+    // every probe of the examples is called AB with a passing score; on
+    // snp0000001 sample 1 is AA and sample 2 BB; on snp0000002 sample 1
+    // fails and sample 2 is a no call; snp0000003 is AA in every sample,
+    // so has no alt; and snp0000004 fails in every sample, so has no record
+    setCall(gtcs[1], 0, 1, 0.9);
+    setCall(gtcs[2], 0, 3, 0.9);
+    setCall(gtcs[1], 1, 2, 0.1);
+    setCall(gtcs[2], 1, 0, 0.9);
+    for (int s = 0; s < 5; s++) {
+      setCall(gtcs[s], 2, 1, 0.9);
+      setCall(gtcs[s], 3, 2, 0.1);
+    }
+    vector<string> expected;
+    expected.push_back("1\t1000000\tsnp0000001\tG\tA\t.\tPASS\tNS=5;AC=1;AN=10\tGT\t0/1\t0/0\t1/1\t0/1\t0/1");
+    expected.push_back("10\t10000009\tsnp0000010\tG\tA\t.\tPASS\tNS=5;AC=1;AN=10\tGT\t0/1\t0/1\t0/1\t0/1\t0/1");
+    expected.push_back("2\t2000001\tsnp0000002\tG\tA\t.\tPASS\tNS=4;AC=1;AN=6\tGT\t0/1\t.\t.\t0/1\t0/1");
+    expected.push_back("3\t3000002\tsnp0000003\tG\t.\t.\tPASS\tNS=5;AC=0;AN=10\tGT\t0/0\t0/0\t0/0\t0/0\t0/0");
+    for (int chr = 5; chr <= 9; chr++) {
+      expected.push_back(to_string(chr) + "\t" + to_string(chr * 1000000 + chr - 1) +
+                         "\tsnp000000" + to_string(chr) +
+                         "\tG\tA\t.\tPASS\tNS=5;AC=1;AN=10\tGT\t0/1\t0/1\t0/1\t0/1\t0/1");
+    }
+
+    // a JSON sample sheet names the samples; a plain one takes the names
+    // in the GTC files
+    string jsonSheet = tempdir + "/samples.json";
+    string textSheet = tempdir + "/samples.txt";
+    ofstream json(jsonSheet.c_str());
+    ofstream text(textSheet.c_str());
+    json << "[";
+    for (int s = 0; s < 5; s++) {
+      json << (s ? ", " : "") << "{\"uri\": \"s" << s << "\", \"result\": \""
+           << gtcs[s] << "\"}";
+      text << gtcs[s] << endl;
+    }
+    json << "]" << endl;
+    json.close();
+    text.close();
+
+    string options[2] = { "-j 1 -s " + jsonSheet, "-j 3 -M 0 -s " + textSheet };
+    string names[2] = { "\ts0\ts1\ts2\ts3\ts4",
+                        "\texample_0000\texample_0001\texample_0002\texample_0003\texample_0004" };
+    for (int run = 0; run < 2; run++) {
+      string vcfFile = tempdir + "/samples_" + to_string(run) + ".vcf";
+      string cmd = "./g2v " + options[run] + " -m " + manfile + " -o " + vcfFile;
+      TS_ASSERT_EQUALS(system(cmd.c_str()), 0);
+      vector<string> lines = readVcf(vcfFile);
+      TS_ASSERT_EQUALS(lines.size(), expected.size() + 1);
+      if (lines.size() != expected.size() + 1) continue;
+      string header = "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+      TS_ASSERT_EQUALS(lines[0], header + names[run]);
+      for (size_t i = 0; i < expected.size(); i++) {
+        TS_ASSERT_EQUALS(lines[i + 1], expected[i]);
+      }
+    }
+    TS_TRACE("g2v records agree for one and three threads");
+  }
+
+  // a little-endian integer of the given number of bytes at data[pos],
+  // moving pos past it
+  int32_t takeInt(const string &data, size_t &pos, int bytes)
+  {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+      value |= (uint32_t) (unsigned char) data[pos++] << (8 * i);
+    }
+    if (bytes == 1) return (int8_t) value;
+    return value;
+  }
+
+  // a BCF typed value: a string, or a single int8
+  string takeString(const string &data, size_t &pos)
+  {
+    int descriptor = (unsigned char) data[pos++];
+    TS_ASSERT_EQUALS(descriptor & 0xf, 7);
+    size_t size = descriptor >> 4;
+    pos += size;
+    return data.substr(pos - size, size);
+  }
+
+  int takeTypedInt(const string &data, size_t &pos)
+  {
+    TS_ASSERT_EQUALS(data[pos++], 0x11);
+    return takeInt(data, pos, 1);
+  }
+
+  // the fields of a BCF record at data[pos], with the GT bytes of every
+  // sample, moving pos to the next record
+  struct BcfRecord {
+    int contig, pos, nAllele, nInfo, nFmt, nSample;
+    string id;
+    vector<string> alleles;
+    vector<int> filters, info;
+    string gt;
+  };
+
+  BcfRecord takeRecord(const string &data, size_t &pos)
+  {
+    BcfRecord record;
+    uint32_t shared = takeInt(data, pos, 4);
+    uint32_t indiv = takeInt(data, pos, 4);
+    size_t end = pos + shared + indiv;
+    record.contig = takeInt(data, pos, 4);
+    record.pos = takeInt(data, pos, 4);
+    TS_ASSERT_EQUALS(takeInt(data, pos, 4), 1);   // rlen
+    TS_ASSERT_EQUALS((uint32_t) takeInt(data, pos, 4), 0x7f800001);  // missing QUAL
+    uint32_t counts = takeInt(data, pos, 4);
+    record.nAllele = counts >> 16;
+    record.nInfo = counts & 0xffff;
+    counts = takeInt(data, pos, 4);
+    record.nFmt = counts >> 24;
+    record.nSample = counts & 0xffffff;
+    record.id = takeString(data, pos);
+    for (int a = 0; a < record.nAllele; a++) {
+      record.alleles.push_back(takeString(data, pos));
+    }
+    record.filters.push_back(takeTypedInt(data, pos));
+    for (int i = 0; i < record.nInfo; i++) {
+      record.info.push_back(takeTypedInt(data, pos));
+      record.info.push_back(takeTypedInt(data, pos));
+    }
+    TS_ASSERT_EQUALS(pos, end - indiv);
+    for (int f = 0; f < record.nFmt; f++) {
+      TS_ASSERT_EQUALS(takeTypedInt(data, pos), 5);   // GT in the dictionary
+      TS_ASSERT_EQUALS(data[pos++], 0x21);           // two int8 values
+      record.gt += data.substr(pos, 2 * record.nSample);
+      pos += 2 * record.nSample;
+    }
+    TS_ASSERT_EQUALS(pos, end);
+    pos = end;
+    return record;
+  }
+
+  void testG2vBcf(void)
+  {
+    TS_TRACE("Test of g2v BCF output");
+    vector<string> gtcs = copyExampleGtcs();
+    // as testG2vSamples: on snp0000001 samples 1 and 2 are AA and BB, and
+    // on snp0000002 sample 1 fails and sample 2 is a no call
+    setCall(gtcs[1], 0, 1, 0.9);
+    setCall(gtcs[2], 0, 3, 0.9);
+    setCall(gtcs[1], 1, 2, 0.1);
+    setCall(gtcs[2], 1, 0, 0.9);
+    string bcfFile = tempdir + "/samples.bcf";
+    string cmd = "./g2v -m " + manfile + " -o " + bcfFile;
+    for (int s = 0; s < 5; s++) cmd += " -g " + gtcs[s];
+    TS_ASSERT_EQUALS(system(cmd.c_str()), 0);
+
+    // BCF is BGZF-compressed
+    string data;
+    gzFile in = gzopen(bcfFile.c_str(), "rb");
+    char buffer[4096];
+    int bytes;
+    while ((bytes = gzread(in, buffer, sizeof(buffer))) > 0) data.append(buffer, bytes);
+    gzclose(in);
+    TS_ASSERT(data.size() > 9);
+    if (data.size() <= 9) return;
+    TS_ASSERT_EQUALS(data.substr(0, 5), string("BCF\2\2", 5));
+    size_t pos = 5;
+    uint32_t textLength = takeInt(data, pos, 4);
+    TS_ASSERT(pos + textLength < data.size());
+    if (pos + textLength >= data.size()) return;
+    string text = data.substr(pos, textLength);
+    TS_ASSERT_EQUALS(text.compare(0, 16, "##fileformat=VCF"), 0);
+    TS_ASSERT_EQUALS(text[textLength - 1], '\0');
+    TS_ASSERT_EQUALS(text[textLength - 2], '\n');
+    // PASS is first of the FILTER, INFO and FORMAT IDs, then NS, AC, AN
+    TS_ASSERT(text.find("##FILTER=<ID=PASS") < text.find("##INFO=<ID=NS"));
+    pos += textLength;
+
+    // contigs are sorted by name, so snp0000001 is on the first
+    BcfRecord record = takeRecord(data, pos);
+    TS_ASSERT_EQUALS(record.contig, 0);
+    TS_ASSERT_EQUALS(record.pos, 1000000 - 1);
+    TS_ASSERT_EQUALS(record.id, "snp0000001");
+    TS_ASSERT_EQUALS(record.nAllele, 2);
+    if (record.alleles.size() == 2) {
+      TS_ASSERT_EQUALS(record.alleles[0], "G");
+      TS_ASSERT_EQUALS(record.alleles[1], "A");
+    }
+    TS_ASSERT_EQUALS(record.filters[0], 0);   // PASS
+    int info[6] = { 1, 5, 2, 1, 3, 10 };      // NS=5;AC=1;AN=10
+    TS_ASSERT_EQUALS(record.info, vector<int>(info, info + 6));
+    TS_ASSERT_EQUALS(record.nFmt, 1);
+    TS_ASSERT_EQUALS(record.nSample, 5);
+    // AB is 0/1, AA 0/0 and BB 1/1, as (allele + 1) << 1
+    TS_ASSERT_EQUALS(record.gt, string("\2\4\2\2\4\4\2\4\2\4", 10));
+
+    // then snp0000010, on contig "10"; then snp0000002, on contig "2"
+    record = takeRecord(data, pos);
+    TS_ASSERT_EQUALS(record.contig, 1);
+    TS_ASSERT_EQUALS(record.id, "snp0000010");
+    record = takeRecord(data, pos);
+    TS_ASSERT_EQUALS(record.contig, 2);
+    TS_ASSERT_EQUALS(record.pos, 2000001 - 1);
+    TS_ASSERT_EQUALS(record.id, "snp0000002");
+    int infoMissing[6] = { 1, 4, 2, 1, 3, 6 };    // NS=4;AC=1;AN=6
+    TS_ASSERT_EQUALS(record.info, vector<int>(infoMissing, infoMissing + 6));
+    // a failed score and a no call are both a missing allele, padded
+    // with the end of the vector
+    TS_ASSERT_EQUALS(record.gt, string("\2\4\0\x81\0\x81\2\4\2\4", 10));
+    TS_TRACE("BCF header and records decoded");
+  }
+
+};
+
+class ClusterTableTest : public TestBase
+{
+ public:
+
+  void testClusterTable(void)
+  {
+    string egtfile = "data/humancoreexome-12v1-1_a.egt";
+    string manfile = "data/example_normalized.bpm.csv";
+    string cachefile = tempdir + "/clusters.bin";
+    TS_TRACE("Starting cluster table test");
+    Manifest *manifest = new Manifest();
+    manifest->open(manfile);
+    Egt *egt = new Egt();
+    egt->open(egtfile);
+    // expected EGT record for each manifest SNP: same name, else same index
+    map<string, long> egtIndex;
+    for (long i = egt->snpTotal - 1; i >= 0; i--) {
+      egtIndex[egt->snpNames[i]] = i;
+    }
+    long numSnps = manifest->snps.size();
+    long missing = 0;
+    vector<long> expected(numSnps);
+    for (long j = 0; j < numSnps; j++) {
+      map<string, long>::iterator it = egtIndex.find(manifest->snps[j].name);
+      if (it == egtIndex.end()) {
+        missing++;
+        expected[j] = j;
+      } else {
+        expected[j] = it->second;
+      }
+    }
+    // build, write to cache, then read from cache
+    for (int pass = 0; pass < 2; pass++) {
+      ClusterTable *clusters = new ClusterTable();
+      TS_ASSERT_THROWS_NOTHING(clusters->open(egtfile, manfile, manifest,
+                                              cachefile));
+      TS_ASSERT_EQUALS(clusters->snpTotal, numSnps);
+      TS_ASSERT_EQUALS(clusters->missing, missing);
+      float params[ClusterTable::PARAMS_PER_SNP];
+      float params_egt[ClusterTable::PARAMS_PER_SNP];
+      for (long j = 0; j < numSnps; j++) {
+        clusters->getClusters(j, params);
+        egt->getClusters(expected[j], params_egt);
+        TS_ASSERT_SAME_DATA(params, params_egt, sizeof(params));
+      }
+      clusters->close();
+      delete clusters;
+      assertFileSize(cachefile, ClusterTable::HEADER_BYTES +
+                     numSnps * ClusterTable::PARAMS_PER_SNP * sizeof(float));
+    }
+    TS_TRACE("Cluster table built and cached consistently with EGT");
+    delete egt;
+    delete manifest;
+  }
+};
+
 class EgtTest : public TestBase
 {
  public:
@@ -203,6 +666,47 @@ class EgtTest : public TestBase
     TS_TRACE("Check on contents of first EGT cluster record complete");
     TS_TRACE("Finished EGT test");
   }
+
+  void testEgtMapped(void)
+  {
+    string infile = "data/humancoreexome-12v1-1_a.egt";
+    TS_TRACE("Starting memory-mapped EGT test");
+    Egt *egt = new Egt();
+    Egt *mapped = new Egt();
+    egt->open(infile);
+    TS_ASSERT_THROWS_NOTHING(mapped->openMapped(infile));
+    TS_ASSERT_EQUALS(mapped->fileVersion, egt->fileVersion);
+    TS_ASSERT_EQUALS(mapped->mode, egt->mode);
+    TS_ASSERT_EQUALS(mapped->manifest, egt->manifest);
+    TS_ASSERT_EQUALS(mapped->snpTotal, egt->snpTotal);
+    float *clusters = new float[egt->PARAMS_PER_SNP];
+    float *clustersMapped = new float[egt->PARAMS_PER_SNP];
+    int *counts = new int[egt->GENOTYPES_PER_SNP];
+    int *countsMapped = new int[egt->GENOTYPES_PER_SNP];
+    int mismatches = 0;
+    for (long i = 0; i < egt->snpTotal; i++) {
+      egt->getClusters(i, clusters);
+      mapped->getClusters(i, clustersMapped);
+      for (int j = 0; j < egt->PARAMS_PER_SNP; j++) {
+        if (clusters[j] != clustersMapped[j]) mismatches++;
+      }
+      egt->getCounts(i, counts);
+      mapped->getCounts(i, countsMapped);
+      for (int j = 0; j < egt->GENOTYPES_PER_SNP; j++) {
+        if (counts[j] != countsMapped[j]) mismatches++;
+      }
+      if (egt->snpNames[i] != mapped->getSnpName(i)) mismatches++;
+    }
+    TS_ASSERT_EQUALS(mismatches, 0);
+    TS_TRACE("Mapped EGT is identical to EGT read from stream");
+    delete [] clusters;
+    delete [] clustersMapped;
+    delete [] counts;
+    delete [] countsMapped;
+    mapped->close();
+    delete mapped;
+    delete egt;
+  }
 };
 
 class FcrTest : public TestBase
@@ -233,6 +737,248 @@ class FcrTest : public TestBase
     delete fcrWriter;
   }
 };
+
+class FcrMathTest : public TestBase
+{
+  // randomized check of FcrMath against libm, at the precision of FCR output
+
+ public:
+
+  static const int trials = 1000000;
+
+  bool sameAtPrecision(double a, double b, const char *format)
+  {
+    char bufA[64];
+    char bufB[64];
+    snprintf(bufA, sizeof bufA, format, a);
+    snprintf(bufB, sizeof bufB, format, b);
+    return strcmp(bufA, bufB) == 0;
+  }
+
+  void testAtan2(void)
+  {
+    TS_TRACE("Comparing FcrMath::atan2 with libm");
+    double pi = 3.141593; // as in Fcr.cpp
+    double *x = new double[trials];
+    double *y = new double[trials];
+    double *fast = new double[trials];
+    srand(26);
+    for (int i = 0; i < trials; i++) {
+      // intensities over several orders of magnitude, in all quadrants
+      double scale = pow(10.0, 6.0 * rand() / RAND_MAX - 3.0);
+      x[i] = scale * rand() / RAND_MAX * (i % 3 ? 1 : -1);
+      y[i] = scale * rand() / RAND_MAX * (i % 5 ? 1 : -1);
+    }
+    FcrMath::atan2(trials, y, x, fast);
+    int mismatches = 0;
+    double maxError = 0.0;
+    for (int i = 0; i < trials; i++) {
+      double libm = atan2(y[i], x[i]);
+      maxError = max(maxError, fabs(libm - fast[i]));
+      if (!sameAtPrecision(libm/(pi/2), fast[i]/(pi/2), "%.3f")) mismatches++;
+      if (fast[i] != FcrMath::atan2(y[i], x[i])) mismatches++;
+    }
+    TS_ASSERT_EQUALS(mismatches, 0);
+    TS_ASSERT_LESS_THAN(maxError, 1e-14);
+    // special values must be exactly as from libm
+    double special[] = { 0.0, -0.0, 1.0, -1.0, INFINITY, -INFINITY, NAN };
+    int n = sizeof(special) / sizeof(double);
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; j < n; j++) {
+        double libm = atan2(special[i], special[j]);
+        double fast = FcrMath::atan2(special[i], special[j]);
+        TS_ASSERT(sameAtPrecision(libm, fast, "%.17g"));
+      }
+    }
+    delete [] x;
+    delete [] y;
+    delete [] fast;
+  }
+
+  void testLog2(void)
+  {
+    TS_TRACE("Comparing FcrMath::log2 with libm");
+    double *in = new double[trials];
+    double *fast = new double[trials];
+    srand(27);
+    for (int i = 0; i < trials; i++) {
+      // ratios of observed to expected R, from 2^-20 to 2^20
+      in[i] = pow(2.0, 40.0 * rand() / RAND_MAX - 20.0);
+    }
+    FcrMath::log2(trials, in, fast);
+    int mismatches = 0;
+    double maxError = 0.0;
+    for (int i = 0; i < trials; i++) {
+      double libm = log2(in[i]);
+      maxError = max(maxError, fabs(libm - fast[i]));
+      if (!sameAtPrecision(libm, fast[i], "%.4f")) mismatches++;
+      if (fast[i] != FcrMath::log2(in[i])) mismatches++;
+    }
+    TS_ASSERT_EQUALS(mismatches, 0);
+    TS_ASSERT_LESS_THAN(maxError, 1e-14);
+    double special[] = { 0.0, -0.0, 1.0, -1.0, 1e-310, INFINITY, -INFINITY, NAN };
+    int n = sizeof(special) / sizeof(double);
+    for (int i = 0; i < n; i++) {
+      TS_ASSERT(sameAtPrecision(log2(special[i]), FcrMath::log2(special[i]),
+                                "%.17g"));
+    }
+    delete [] in;
+    delete [] fast;
+  }
+};
+
+class GtcProcessTest : public TestBase
+{
+ public:
+
+  void testQc(void)
+  {
+    // the single-pass QC metrics equal those found one at a time
+    Manifest *manifest = new Manifest();
+    manifest->open(manfile);
+    Gtc *gtc = new Gtc();
+    for (int i = 0; i < 5; i++) {
+      gtc->open("data/example_000" + to_string(i) + ".gtc",
+                Gtc::XFORM | Gtc::INTENSITY | Gtc::SCORES);
+      GtcQc qc = getQc(0.15, gtc, manifest);
+      TS_ASSERT_EQUALS(qc.illuminaPassrate, getIlluminaPassrate(0.15, gtc, manifest));
+      TS_ASSERT_EQUALS(qc.passrate, gtc->passRate(0.15));
+      TS_ASSERT_EQUALS(qc.correctedPassrate, gtc->correctedPassRate(0.15));
+      TS_ASSERT_EQUALS(qc.meanIntensity, getMeanIntensity(gtc, manifest));
+    }
+
+    // scores on the cut-off, and with no call, as the GTC methods count them
+    gtc->scores[0] = 0.15f;
+    gtc->scores[1] = nextafterf(0.15f, 0);
+    gtc->scores[2] = 0;
+    GtcQc qc = getQc(0.15, gtc, manifest);
+    TS_ASSERT_EQUALS(qc.passrate, gtc->passRate(0.15));
+    TS_ASSERT_EQUALS(qc.correctedPassrate, gtc->correctedPassRate(0.15));
+    TS_ASSERT_EQUALS(qc.illuminaPassrate, getIlluminaPassrate(0.15, gtc, manifest));
+
+    manifest->snps.pop_back();
+    TS_ASSERT_THROWS(getQc(0.15, gtc, manifest), string);
+    delete gtc;
+    delete manifest;
+  }
+};
+
+class NameIndexTest : public TestBase
+{
+
+ public:
+
+  void testNameIndex(void)
+  {
+    vector<snpClass> snps(4);
+    snps[0].name = "rs1";
+    snps[1].name = "rs22";
+    snps[2].name = "rs333";
+    snps[3].name = "rs22";
+    NameIndex index;
+    TS_ASSERT_EQUALS(index.find(snps, "rs1"), -1);
+    index.build(snps);
+    TS_ASSERT_EQUALS(index.slots.size(), 8);
+    TS_ASSERT_EQUALS(index.find(snps, "rs1"), 0);
+    TS_ASSERT_EQUALS(index.find(snps, "rs22"), 3); // last of duplicates
+    TS_ASSERT_EQUALS(index.find(snps, "rs333"), 2);
+    TS_ASSERT_EQUALS(index.find(snps, "rs3"), -1);
+    TS_ASSERT_EQUALS(index.find(snps, ""), -1);
+    // reverse the SNPs
+    vector<uint32_t> moved(4);
+    for (int i = 0; i < 4; i++) moved[i] = 3 - i;
+    reverse(snps.begin(), snps.end());
+    index.renumber(moved);
+    TS_ASSERT_EQUALS(index.find(snps, "rs1"), 3);
+    TS_ASSERT_EQUALS(index.find(snps, "rs22"), 0);
+    TS_ASSERT_EQUALS(index.find(snps, "rs333"), 1);
+    TS_TRACE("Names found by index");
+
+    NameArena arena;
+    TS_ASSERT(arena.empty());
+    arena.add("rs1");
+    arena.add("");
+    arena.add(string("rs333"));
+    TS_ASSERT_EQUALS(arena.size(), 3);
+    TS_ASSERT_EQUALS(arena[0], "rs1");
+    TS_ASSERT_EQUALS(arena[1], "");
+    TS_ASSERT_EQUALS(arena[2], "rs333");
+    TS_ASSERT_EQUALS(arena.length(2), 5);
+    TS_ASSERT_EQUALS(strcmp(arena.data(2), "rs333"), 0);
+    arena.clear();
+    TS_ASSERT(arena.empty());
+    TS_TRACE("Names packed in arena");
+  }
+
+};
+
+class PlinkBinaryTest : public TestBase
+{
+
+ public:
+
+  void testTransposeCalls(void)
+  {
+    // 7 individuals by 10 SNPs, so neither fills its last byte
+    int numInd = 7, numSnps = 10;
+    int indBytes = (3 + numSnps) / 4, snpBytes = 3;
+    vector<char> byInd(numInd * indBytes, 0);
+    for (int i = 0; i < numInd; i++) {
+      for (int j = 0; j < numSnps; j++) {
+        byInd[i * indBytes + j / 4] |= ((i * 3 + j * 5) % 4) << (2 * (j % 4));
+      }
+    }
+    // rows one byte wider than the calls, as in a block of a wider matrix
+    vector<char> bySnp(numSnps * snpBytes, 0);
+    plink_binary::transpose_calls(&byInd[0], numInd, numSnps, &bySnp[0], snpBytes);
+    for (int j = 0; j < numSnps; j++) {
+      for (int i = 0; i < numInd; i++) {
+        TS_ASSERT_EQUALS((bySnp[j * snpBytes + i / 4] >> (2 * (i % 4))) & 3,
+                         (i * 3 + j * 5) % 4);
+      }
+      TS_ASSERT_EQUALS(bySnp[j * snpBytes + 2], 0);
+    }
+    TS_TRACE("Calls transposed to SNP-major order");
+
+    // write and read back a SNP-major BED file
+    string dataset = tempdir + "/packed";
+    plink_binary *pb = new plink_binary();
+    pb->open(dataset, 1);
+    for (int i = 0; i < numInd; i++) {
+      gftools::individual ind;
+      ind.name = "sample" + to_string(i);
+      pb->individuals.push_back(ind);
+    }
+    for (int j = 0; j < numSnps; j++) {
+      gftools::snp snp;
+      snp.name = "rs" + to_string(j);
+      snp.allele_a = "A";
+      snp.allele_b = "G";
+      pb->snps.push_back(snp);
+    }
+    vector<char> rows(numSnps * 2);
+    for (int j = 0; j < numSnps; j++) memcpy(&rows[j * 2], &bySnp[j * snpBytes], 2);
+    TS_ASSERT_THROWS_NOTHING(pb->write_packed_snps(&rows[0], numSnps));
+    pb->close();
+    delete pb;
+    assertFileSize(dataset + ".bed", 3 + numSnps * 2);
+    pb = new plink_binary(dataset);
+    TS_ASSERT_EQUALS(pb->individuals.size(), numInd);
+    int expected[4] = { 1, 0, 2, 3 }; // class codes of PLINK's two bit codes
+    for (int j = 0; j < numSnps; j++) {
+      vector<int> genotypes;
+      pb->read_snp(j, genotypes);
+      for (int i = 0; i < numInd; i++) {
+        TS_ASSERT_EQUALS(genotypes[i], expected[(i * 3 + j * 5) % 4]);
+      }
+    }
+    pb->close();
+    delete pb;
+    TS_TRACE("Packed SNPs written and read");
+  }
+
+};
+
 class ManifestTest : public TestBase
 {
  public:
@@ -258,6 +1004,414 @@ class ManifestTest : public TestBase
     TS_TRACE("Finished manifest test");
   }
 
+  void testManifestWide(void)
+  {
+    // wide format, with Windows line endings and a controls section
+    string infile = tempdir+"/wide.csv";
+    ofstream out(infile.c_str(), ios::binary);
+    out << "Illumina, Inc.\r\n[Assay]\r\n"
+        << "IlmnID,Name,IlmnStrand,SNP,Chr,MapInfo,SourceStrand,BeadSetID\r\n"
+        << "a-1,snp1,BOT,[T/C],Mt,1500,BOT,7\r\n"
+        << "a-2,snp2,TOP,[A/G],X,2500,TOP,8\r\n"
+        << "[Controls]\r\n1,2,3\r\n";
+    out.close();
+    Manifest *manifest = new Manifest();
+    TS_ASSERT_THROWS_NOTHING(manifest->open(infile, true));
+    TS_ASSERT_EQUALS(manifest->snps.size(), 2);
+    snpClass snp = manifest->snps[0];
+    TS_ASSERT_EQUALS(snp.index, 1);
+    TS_ASSERT_EQUALS(snp.name, "snp1");
+    TS_ASSERT_EQUALS(snp.chromosome, "MT");
+    TS_ASSERT_EQUALS(snp.position, 1500);
+    TS_ASSERT_EQUALS(snp.snp[0], 'A');
+    TS_ASSERT_EQUALS(snp.snp[1], 'G');
+    TS_ASSERT(snp.converted);
+    TS_ASSERT_EQUALS(snp.BeadSetID, 7);
+    snp = manifest->snps[1];
+    TS_ASSERT_EQUALS(snp.index, 2);
+    TS_ASSERT_EQUALS(snp.snp[0], 'A');
+    TS_ASSERT_EQUALS(snp.snp[1], 'G');
+    TS_ASSERT(!snp.converted);
+    TS_ASSERT_EQUALS(manifest->snp2idx((char *) "snp2"), 1);
+    delete manifest;
+    TS_TRACE("Read wide format manifest");
+  }
+
+  void testManifestSelect(void)
+  {
+    // SNPs and fields selected while parsing
+    string infile = tempdir+"/select.bpm.csv";
+    ofstream out(infile.c_str());
+    out << "Index,Name,Chromosome,Position,GenTrain Score,SNP,"
+        << "ILMN Strand,Customer Strand,NormID\n"
+        << "1,rs1,1,100,0.5,[A/G],TOP,TOP,3\n"
+        << "2,cnv2,1,200,0.5,[A/G],TOP,TOP,5\n"
+        << "3,rs3,2,150,0.5,[A/G],BOT,BOT,7\n"
+        << "4,rs4,2,250,0.5,[A/G],TOP,TOP,3\n"
+        << "5,rs5,Mt,300,0.5,[A/G],TOP,TOP,9\n";
+    out.close();
+    Manifest *all = new Manifest();
+    all->cachePath = "";
+    all->open(infile);
+    TS_ASSERT_EQUALS(all->snps.size(), 5);
+
+    Manifest *manifest = new Manifest();
+    manifest->select_chromosome("2");
+    manifest->select_chromosome("MT");
+    TS_ASSERT_THROWS_NOTHING(manifest->open(infile));
+    TS_ASSERT_EQUALS(manifest->snps.size(), 3);
+    TS_ASSERT_EQUALS(manifest->snps[0].name, "rs3");
+    TS_ASSERT_EQUALS(manifest->snps[0].index, 3);
+    TS_ASSERT_EQUALS(manifest->snps[2].chromosome, "MT");
+    TS_ASSERT_EQUALS(manifest->snp2idx((char *) "rs4"), 1);
+    TS_ASSERT_EQUALS(manifest->snp2idx((char *) "rs1"), -1);
+    // normalization IDs are of every line, as the XForm arrays are
+    TS_ASSERT_EQUALS(manifest->normIdMap, all->normIdMap);
+    delete manifest;
+    TS_TRACE("Selected chromosomes");
+
+    manifest = new Manifest();
+    manifest->exclude_cnvs();
+    manifest->select_region("1", 1, 250);
+    manifest->select_region("2", 200, 300);
+    TS_ASSERT_THROWS_NOTHING(manifest->open(infile));
+    TS_ASSERT_EQUALS(manifest->snps.size(), 2);
+    TS_ASSERT_EQUALS(manifest->snps[0].name, "rs1");
+    TS_ASSERT_EQUALS(manifest->snps[1].name, "rs4");
+    delete manifest;
+    TS_TRACE("Selected regions, excluding CNVs");
+
+    manifest = new Manifest();
+    vector<string> names = {"rs5", "rs1", "rs6"};
+    manifest->select_names(names);
+    manifest->select_fields(Manifest::NORMID_FIELD);
+    manifest->cachePath = ""; // a cached manifest has every field
+    TS_ASSERT_THROWS_NOTHING(manifest->open(infile));
+    TS_ASSERT_EQUALS(manifest->snps.size(), 2);
+    TS_ASSERT_EQUALS(manifest->snps[0].name, "rs1");
+    TS_ASSERT_EQUALS(manifest->snps[1].name, "rs5");
+    TS_ASSERT_EQUALS(manifest->snps[1].normId, 9);
+    TS_ASSERT_EQUALS(manifest->snps[1].position, 300);
+    TS_ASSERT_EQUALS(manifest->snps[1].snp[0], '?');
+    TS_ASSERT_EQUALS(manifest->snps[1].score, -1);
+    delete manifest;
+    TS_TRACE("Selected names and fields");
+
+    manifest = new Manifest();
+    manifest->select_fields(Manifest::ALLELE_FIELDS);
+    manifest->cachePath = "";
+    TS_ASSERT_THROWS_NOTHING(manifest->open(infile));
+    TS_ASSERT_EQUALS(manifest->snps[2].snp[0], 'T');
+    TS_ASSERT_EQUALS(manifest->snps[2].snp[1], 'C');
+    TS_ASSERT(manifest->snps[2].converted);
+    TS_ASSERT_EQUALS(manifest->snps[2].normId, -1);
+    TS_ASSERT_EQUALS(manifest->snps[2].score, -1);
+    delete manifest;
+    delete all;
+    TS_TRACE("Selected alleles");
+  }
+
+  void testProbeClasses(void)
+  {
+    // classes of probe by index, and counts of passing scores by class
+    string infile = tempdir+"/classes.bpm.csv";
+    ofstream out(infile.c_str());
+    out << "Index,Name,Chromosome,Position,GenTrain Score,SNP,"
+        << "ILMN Strand,Customer Strand,NormID\n"
+        << "1,rs1,1,100,0.5,[A/G],TOP,TOP,3\n"
+        << "3,cnv3,2,150,0.5,[N/A],TOP,TOP,7\n"
+        << "2,rs2_cnv,1,200,0.5,[D/I],TOP,TOP,5\n"
+        << "4,rs4,2,250,0.5,[A/G],TOP,TOP,3\n"
+        << "5,rs5,1,300,0.5,[I/D],TOP,TOP,9\n";
+    out.close();
+    Manifest *manifest = new Manifest();
+    manifest->select_fields(Manifest::ALLELE_FIELDS);
+    manifest->cachePath = "";
+    manifest->open(infile);
+    manifest->order_by_locus();
+    vector<uint8_t> classes = { 0, Manifest::CNV_PROBE | Manifest::INDEL_PROBE,
+                                Manifest::CNV_PROBE | Manifest::INTENSITY_ONLY_PROBE,
+                                0, Manifest::INDEL_PROBE };
+    TS_ASSERT_EQUALS(manifest->probeClasses, classes);
+    TS_ASSERT_EQUALS(manifest->probe_class(manifest->snps[0]), 0);
+    TS_ASSERT_EQUALS(manifest->chromosome_id("2"), 1);
+    TS_ASSERT_EQUALS(manifest->chromosome_id("X"), -1);
+    TS_ASSERT_EQUALS(manifest->probeChromosomes[2], 1);
+
+    // 0.15f is above 0.15, and the float below it below
+    vector<float> scores = { 0.15f, 0.9f, 0.0f, nextafterf(0.15f, 0), 0.5f, 0.8f };
+    long pass, total;
+    manifest->count_passing(scores, 0.15, 0, pass, total);
+    TS_ASSERT_EQUALS(pass, 4);
+    TS_ASSERT_EQUALS(total, 6);
+    manifest->count_passing(scores, 0.15, Manifest::CNV_PROBE, pass, total);
+    TS_ASSERT_EQUALS(pass, 3);
+    TS_ASSERT_EQUALS(total, 4);
+    manifest->count_passing(scores, 0.15, Manifest::CNV_PROBE | Manifest::UNSELECTED_PROBE,
+                            pass, total);
+    TS_ASSERT_EQUALS(pass, 2);
+    TS_ASSERT_EQUALS(total, 3);
+    manifest->count_passing(scores, 0.15, Manifest::INDEL_PROBE, pass, total,
+                            manifest->chromosome_id("1"));
+    TS_ASSERT_EQUALS(pass, 1);
+    TS_ASSERT_EQUALS(total, 1);
+    delete manifest;
+
+    // exclude_cnvs() drops names beginning with "cnv" only, so rs2_cnv
+    // is kept, though of the CNV class
+    manifest = new Manifest();
+    manifest->exclude_cnvs();
+    manifest->cachePath = "";
+    manifest->open(infile);
+    TS_ASSERT_EQUALS(manifest->snps.size(), 4);
+    for (size_t i = 0; i < manifest->snps.size(); i++) {
+      const snpClass &snp = manifest->snps[i];
+      TS_ASSERT_DIFFERS(snp.name.compare(0, 3, "cnv"), 0);
+      int cnv = snp.name == "rs2_cnv" ? Manifest::CNV_PROBE : 0;
+      TS_ASSERT_EQUALS(manifest->probe_class(snp) & Manifest::CNV_PROBE, cnv);
+    }
+    TS_ASSERT(Manifest::cnv_name("rs2_cnv", 7));
+    TS_ASSERT(!Manifest::cnv_name("rs2_cn", 6));
+    delete manifest;
+  }
+
+  void testManifestCache(void)
+  {
+    // a manifest read from the binary cache is the same as one parsed
+    string infile = "data/mock_1000.bpm.csv";
+    Manifest *parsed = new Manifest();
+    parsed->cachePath = "";
+    parsed->open(infile);
+    Manifest *written = new Manifest();
+    written->cachePath = tempdir;
+    TS_ASSERT_THROWS_NOTHING(written->open(infile));
+    Manifest *cached = new Manifest();
+    cached->cachePath = tempdir;
+    TS_ASSERT_THROWS_NOTHING(cached->open(infile));
+    TS_ASSERT_EQUALS(system(("ls "+tempdir+"/mock_1000.bpm.csv.*.mfc >/dev/null").c_str()), 0);
+    TS_ASSERT_EQUALS(cached->snps.size(), parsed->snps.size());
+    TS_ASSERT_EQUALS(cached->normIdMap, parsed->normIdMap);
+    for (unsigned int i = 0; i < parsed->snps.size(); i++) {
+      TS_ASSERT_EQUALS(cached->snps[i].toString(), parsed->snps[i].toString());
+      TS_ASSERT_EQUALS(cached->snps[i].index, parsed->snps[i].index);
+      TS_ASSERT_EQUALS(cached->snp2idx((char *) parsed->snps[i].name.c_str()), 
+                       parsed->snp2idx((char *) parsed->snps[i].name.c_str()));
+    }
+    TS_ASSERT_EQUALS(cached->snp2idx((char *) "no_such_snp"), -1);
+    TS_TRACE("Manifest read from cache");
+    // the saved locus order, and name index after reordering
+    parsed->order_by_locus();
+    cached->order_by_locus();
+    for (unsigned int i = 0; i < parsed->snps.size(); i++) {
+      TS_ASSERT_EQUALS(cached->snps[i].name, parsed->snps[i].name);
+      TS_ASSERT_EQUALS(cached->snp2idx((char *) cached->snps[i].name.c_str()), (int) i);
+    }
+    TS_TRACE("Manifest ordered by locus from cache");
+    delete parsed;
+    delete written;
+    delete cached;
+  }
+
+  void testManifestColumns(void)
+  {
+    // radix sort of the columnar view agrees with sorting the snpClass
+    // objects, for lexical and numeric chromosome order
+    string infile = "data/example.bpm.csv";
+    Manifest *manifest = new Manifest();
+    manifest->cachePath = "";
+    manifest->open(infile);
+    ManifestColumns columns(manifest);
+    TS_ASSERT_EQUALS(columns.chromosomeNames.size(), 10);
+    TS_ASSERT_EQUALS(columns.chromosomeNames[1], "10");
+    vector<snpClass> expected = manifest->snps;
+    sort(expected.begin(), expected.end());
+    vector<long> order;
+    columns.sort(order);
+    TS_ASSERT_EQUALS(order.size(), expected.size());
+    for (unsigned int k = 0; k < order.size(); k++) {
+      TS_ASSERT_EQUALS(manifest->snps[order[k]].name, expected[k].name);
+    }
+    TS_TRACE("Columnar sort in lexical order");
+    columns.sort(order, true, true);
+    for (unsigned int k = 0; k < order.size(); k++) {
+      TS_ASSERT_EQUALS(manifest->snps[order[k]].chromosome, to_string(k + 1));
+    }
+    manifest->order_by_locus(true);
+    for (unsigned int k = 0; k < order.size(); k++) {
+      TS_ASSERT_EQUALS(manifest->snps[k].chromosome, to_string(k + 1));
+    }
+    TS_TRACE("Columnar sort in numeric order");
+    delete manifest;
+  }
+
+  void testRegionIndex(void)
+  {
+    // regions map to ranges of the SNPs in locus order
+    string infile = tempdir+"/region.bpm.csv";
+    ofstream out(infile.c_str());
+    out << "Index,Name,Chromosome,Position,GenTrain Score,SNP,"
+        << "ILMN Strand,Customer Strand,NormID\n"
+        << "1,rs1,2,500,0.5,[A/G],TOP,TOP,1\n"
+        << "2,rs2,1,300,0.5,[A/G],TOP,TOP,1\n"
+        << "3,rs3,1,100,0.5,[A/G],TOP,TOP,1\n"
+        << "4,rs4,2,100,0.5,[A/G],TOP,TOP,1\n"
+        << "5,rs5,1,200,0.5,[A/G],TOP,TOP,1\n"
+        << "6,rs6,1,200,0.5,[A/G],TOP,TOP,1\n";
+    out.close();
+    Manifest *manifest = new Manifest();
+    manifest->cachePath = "";
+    manifest->open(infile);
+    TS_ASSERT_THROWS(RegionIndex unsorted(manifest), string);
+    manifest->order_by_locus();
+    RegionIndex regions(manifest);
+    TS_ASSERT_EQUALS(regions.chromosomeNames.size(), 2);
+    long first, last;
+    TS_ASSERT(regions.find("1", 150, 300, first, last));
+    TS_ASSERT_EQUALS(first, 1);
+    TS_ASSERT_EQUALS(last, 3);
+    TS_ASSERT(regions.find("2:100-100", first, last));
+    TS_ASSERT_EQUALS(first, 4);
+    TS_ASSERT_EQUALS(last, 4);
+    TS_ASSERT(regions.find("2", first, last));
+    TS_ASSERT_EQUALS(first, 4);
+    TS_ASSERT_EQUALS(last, 5);
+    TS_ASSERT(!regions.find("1:301-1,000", first, last));
+    TS_ASSERT_EQUALS(last, first - 1);
+    TS_ASSERT(!regions.find("X", 0, 1000, first, last));
+    TS_TRACE("Found SNPs in regions");
+
+    string chromosome;
+    long start, end;
+    RegionIndex::parse("MT:1,000", chromosome, start, end);
+    TS_ASSERT_EQUALS(chromosome, "MT");
+    TS_ASSERT_EQUALS(start, 1000);
+    TS_ASSERT_THROWS(RegionIndex::parse("1:200-100", chromosome, start, end), string);
+    TS_ASSERT_THROWS(RegionIndex::parse("1:x-100", chromosome, start, end), string);
+    TS_ASSERT_THROWS(RegionIndex::parse(":1-2", chromosome, start, end), string);
+    TS_TRACE("Parsed regions");
+    delete manifest;
+  }
+
+  void writeBpm(string csvfile, string bpmfile)
+  {
+    // write a binary .bpm manifest with the loci of a .bpm.csv, in
+    // reverse order to the names, with locus entries of versions 6 to 8
+    vector<vector<string> > rows;
+    ifstream in(csvfile.c_str());
+    string line;
+    getline(in, line);
+    while (getline(in, line)) {
+      vector<string> row;
+      stringstream fields(line);
+      string field;
+      while (getline(fields, field, ',')) row.push_back(field);
+      rows.push_back(row);
+    }
+    in.close();
+    string bpm = "BPM";
+    auto int32 = [&bpm](uint32_t v) {
+      for (int i = 0; i < 4; i++) bpm += (char) ((v >> (8 * i)) & 0xff);
+    };
+    auto str = [&bpm](string s) {
+      size_t n = s.size();
+      do {
+        bpm += (char) ((n & 0x7f) | (n > 0x7f ? 0x80 : 0));
+        n >>= 7;
+      } while (n);
+      bpm += s;
+    };
+    bpm += (char) 1;
+    int32(0x1000 | 4);
+    str("test manifest");
+    str(string(200, 'c')); // a length of two bytes
+    int32(rows.size());
+    for (size_t i = 0; i < rows.size(); i++) int32(i);
+    for (size_t i = 0; i < rows.size(); i++) str(rows[i][1]);
+    for (size_t i = 0; i < rows.size(); i++) bpm += (char) atoi(rows[i][8].c_str());
+    for (size_t k = rows.size(); k-- > 0; ) {
+      vector<string> &row = rows[k];
+      int version = 6 + k % 3;
+      int32(version);
+      str(row[1] + "-0_" + row[6].substr(0, 1) + "_F_" + to_string(k));
+      str(row[1]);
+      for (int i = 0; i < 3; i++) str("");
+      int32(k + 1);
+      for (int i = 0; i < 2; i++) str("");
+      str(row[5]);
+      str(row[2]);
+      str("diploid");
+      str("Homo sapiens");
+      str(row[3]);
+      str("");
+      str("");
+      int32(1000 + k);
+      int32(0);
+      for (int i = 0; i < 5; i++) str("ACGT");
+      str(row[7]);
+      str("ACGT");
+      bpm += string(3, '\0');
+      bpm += (char) 0; // assay type
+      if (version >= 7) bpm += string(16, '\0');
+      if (version >= 8) str("+");
+    }
+    ofstream out(bpmfile.c_str(), ios::binary);
+    out << bpm;
+    out.close();
+  }
+
+  void testManifestBpm(void)
+  {
+    // a binary .bpm gives the same SNPs as the .bpm.csv, less the
+    // GenTrain score which a .bpm does not have
+    string csvfiles[] = { "data/example.bpm.csv", "data/mock_1000.bpm.csv" };
+    for (int f = 0; f < 2; f++) {
+      string bpmfile = tempdir + "/test.bpm";
+      writeBpm(csvfiles[f], bpmfile);
+      Manifest *csv = new Manifest();
+      csv->cachePath = "";
+      csv->open(csvfiles[f]);
+      Manifest *bpm = new Manifest();
+      bpm->cachePath = "";
+      TS_ASSERT_THROWS_NOTHING(bpm->open(bpmfile));
+      TS_ASSERT_EQUALS(bpm->snps.size(), csv->snps.size());
+      for (size_t i = 0; i < bpm->snps.size() && i < csv->snps.size(); i++) {
+        snpClass &a = bpm->snps[i];
+        snpClass &b = csv->snps[i];
+        TS_ASSERT_EQUALS(a.index, (int) i + 1);
+        TS_ASSERT_EQUALS(a.name, b.name);
+        TS_ASSERT_EQUALS(a.chromosome, b.chromosome);
+        TS_ASSERT_EQUALS(a.position, b.position);
+        TS_ASSERT_EQUALS(a.snp[0], b.snp[0]);
+        TS_ASSERT_EQUALS(a.snp[1], b.snp[1]);
+        TS_ASSERT_EQUALS(a.iStrand, b.iStrand);
+        TS_ASSERT_EQUALS(a.cStrand, b.cStrand);
+        TS_ASSERT_EQUALS(a.normId, b.normId);
+        TS_ASSERT_EQUALS(a.converted, b.converted);
+        TS_ASSERT_EQUALS(bpm->snp2idx((char *) b.name.c_str()), (int) i);
+      }
+      TS_ASSERT_EQUALS(bpm->normIdMap, csv->normIdMap);
+      delete bpm;
+      bpm = new Manifest();
+      bpm->select_chromosome("1");
+      bpm->open(bpmfile);
+      size_t chr1 = 0;
+      for (size_t i = 0; i < csv->snps.size(); i++) chr1 += csv->snps[i].chromosome == "1";
+      TS_ASSERT_EQUALS(bpm->snps.size(), chr1);
+      delete bpm;
+      delete csv;
+    }
+    TS_TRACE("Read .bpm manifests");
+
+    string truncated = tempdir + "/truncated.bpm";
+    string cmd = "head -c 300 " + tempdir + "/test.bpm > " + truncated;
+    TS_ASSERT_EQUALS(system(cmd.c_str()), 0);
+    Manifest *manifest = new Manifest();
+    manifest->cachePath = "";
+    TS_ASSERT_THROWS(manifest->open(truncated), string);
+    delete manifest;
+    TS_TRACE("Truncated .bpm manifest rejected");
+  }
+
   void testManifestNormalize(void)
   {
     // compare normalized output with reference file
@@ -278,9 +1432,97 @@ class ManifestTest : public TestBase
     TS_TRACE("Normalized .csv file is identical to master");
 
     delete manifest;
+
+    // streaming, in one window or several at once
+    for (int threads = 1; threads <= 2; threads++) {
+      string streamfile = tempdir+"/mock_streamed.bpm.csv";
+      manifest = new Manifest();
+      TS_ASSERT_THROWS_NOTHING(manifest->normalize(infile, streamfile, false, threads));
+      assertFileSize(streamfile, size);
+      assertFilesIdentical(normfile, streamfile, size);
+      delete manifest;
+    }
+    TS_TRACE("Streamed normalized .csv file is identical to master");
   }
 
 };
+class ManifestCacheTest : public TestBase
+{
+ public:
+
+  void testManifestCache(void)
+  {
+    ManifestCache cache(2);
+    Manifest *example = cache.get("data/example.bpm.csv");
+    TS_ASSERT_EQUALS(example->snps.size(), 10);
+    TS_ASSERT_EQUALS(cache.get("./data/../data/example.bpm.csv"), example);
+    TS_ASSERT_EQUALS(cache.hits, 1);
+    TS_ASSERT_EQUALS(cache.misses, 1);
+    TS_TRACE("Manifest found by resolved path");
+
+    Manifest *selection = new Manifest();
+    selection->select_chromosome("1");
+    Manifest *chr1 = cache.open(selection, "data/example.bpm.csv");
+    TS_ASSERT_EQUALS(chr1->snps.size(), 1);
+    TS_ASSERT_DIFFERS(chr1, example);
+    selection = new Manifest();
+    selection->select_chromosome("1");
+    TS_ASSERT_EQUALS(cache.open(selection, "data/example.bpm.csv"), chr1);
+    TS_ASSERT_EQUALS(cache.misses, 2);
+    TS_TRACE("Manifest found by selection");
+
+    // capacity 2: the whole example manifest is least recently used
+    Manifest *mock = cache.get("data/mock.bpm.csv");
+    TS_ASSERT_EQUALS(mock->snps.size(), 24);
+    TS_ASSERT_EQUALS(cache.evictions, 1);
+    cache.get("data/example.bpm.csv");
+    TS_ASSERT_EQUALS(cache.misses, 4);
+    TS_TRACE("Least recently used manifest evicted");
+
+    ManifestCache small(4, 1);
+    small.get("data/example.bpm.csv");
+    Manifest *last = small.get("data/mock.bpm.csv");
+    TS_ASSERT_EQUALS(small.evictions, 1);
+    TS_ASSERT_EQUALS(small.get("data/mock.bpm.csv"), last);
+    TS_TRACE("Memory limit keeps the last manifest only");
+
+    // the manifest last returned to each thread is not evicted until
+    // that thread releases it
+    ManifestCache shared(1);
+    Manifest *pinned = shared.get("data/mock.bpm.csv");
+    long evictionsWhileHeld = -1;
+    size_t otherSize = 0;
+    thread reader([&]() {
+      Manifest *other = shared.get("data/example.bpm.csv");
+      evictionsWhileHeld = shared.evictions;
+      otherSize = other->snps.size();
+      shared.release();
+    });
+    reader.join();
+    TS_ASSERT_EQUALS(evictionsWhileHeld, 0);
+    TS_ASSERT_EQUALS(otherSize, 10);
+    TS_ASSERT_EQUALS(shared.evictions, 1);
+    TS_ASSERT_EQUALS(shared.get("data/mock.bpm.csv"), pinned);
+    TS_ASSERT_EQUALS(shared.misses, 2);
+    TS_TRACE("Manifest released by a thread evicted");
+
+    vector<thread> readers;
+    for (int t = 0; t < 4; t++) {
+      readers.push_back(thread([&]() {
+        for (int i = 0; i < 20; i++) {
+          shared.get(i % 2 ? "data/mock.bpm.csv" : "data/example.bpm.csv");
+        }
+        shared.release();
+      }));
+    }
+    for (size_t t = 0; t < readers.size(); t++) readers[t].join();
+    TS_ASSERT_EQUALS(shared.hits + shared.misses, 83);
+    TS_TRACE("Manifests shared by threads");
+  }
+
+};
+
+
 class SimTest : public TestBase {
 
  public:
@@ -344,6 +1586,213 @@ class SimtoolsTest : public TestBase
     TS_TRACE("FCR output file is equivalent to reference copy");
   }
 
+  void testBafLrr(void) {
+    TS_TRACE("Test of BAF/LRR matrix command");
+    Commander *commander = new Commander();
+    string infile = "data/example.json";
+    string prefix = tempdir+"/matrix";
+    string manfile = "data/example_normalized.bpm.csv";
+    string egtfile = "data/humancoreexome-12v1-1_a.egt";
+    string fcrfile = "data/fcr_test.txt";
+    bool binary = false;
+    int threads = 2;
+    long memory = 1;
+    TS_ASSERT_THROWS_NOTHING(commander->commandBafLrr(infile, prefix, manfile,
+                                                      egtfile, binary, threads,
+                                                      memory, verbose));
+    delete commander;
+    // reference BAF and LRR by SNP and sample, from the FCR
+    map<string, string> bafRef;
+    map<string, string> lrrRef;
+    ifstream fcr(fcrfile.c_str());
+    string line;
+    bool body = false;
+    while (getline(fcr, line)) {
+      if (line.compare(0, 8, "SNP Name") == 0) { body = true; continue; }
+      if (!body) continue;
+      vector<string> fields;
+      istringstream tokens(line);
+      string field;
+      while (getline(tokens, field, '\t')) fields.push_back(field);
+      bafRef[fields[0]+" "+fields[1]] = fields[11];
+      lrrRef[fields[0]+" "+fields[1]] = fields[12];
+    }
+    fcr.close();
+    // example manifest has one SNP on each of chromosomes 1 to 10
+    int values = 0;
+    for (int chr = 1; chr <= 10; chr++) {
+      for (int content = 0; content < 2; content++) {
+        string path = prefix + "." + to_string(chr) +
+          (content == BafLrrWriter::BAF ? ".baf.txt" : ".lrr.txt");
+        map<string, string> &ref = content == BafLrrWriter::BAF ? bafRef : lrrRef;
+        ifstream matrix(path.c_str());
+        TS_ASSERT(matrix.good());
+        vector<string> header;
+        getline(matrix, line);
+        istringstream headTokens(line);
+        string field;
+        while (getline(headTokens, field, '\t')) header.push_back(field);
+        TS_ASSERT_EQUALS(header.size(), 8);
+        while (getline(matrix, line)) {
+          vector<string> fields;
+          istringstream tokens(line);
+          while (getline(tokens, field, '\t')) fields.push_back(field);
+          TS_ASSERT_EQUALS(fields.size(), header.size());
+          TS_ASSERT_EQUALS(fields[1], to_string(chr));
+          for (unsigned int i = 3; i < fields.size(); i++) {
+            string key = fields[0]+" "+header[i];
+            TS_ASSERT_DELTA(atof(fields[i].c_str()), atof(ref[key].c_str()),
+                            1e-4);
+            values++;
+          }
+        }
+        matrix.close();
+      }
+    }
+    TS_ASSERT_EQUALS(values, 100);
+    TS_TRACE("BAF/LRR matrices are consistent with reference FCR");
+  }
+
+  void testBafLrrNoSamples(void) {
+    TS_TRACE("Test of BAF/LRR output with no GTC files");
+    Manifest *manifest = new Manifest();
+    BafLrrWriter *writer = new BafLrrWriter();
+    vector<string> infiles;
+    vector<string> sampleNames;
+    TS_ASSERT_THROWS(writer->write(NULL, manifest, tempdir+"/empty", infiles,
+                                   sampleNames), const char*);
+    delete writer;
+    delete manifest;
+  }
+
+  void testCall(void) {
+    TS_TRACE("Test of genotype call command");
+    Commander *commander = new Commander();
+    string infile = "data/example.json";
+    string simfile = tempdir+"/normalized.sim";
+    string manfile = "data/example_normalized.bpm.csv";
+    string egtfile = "data/humancoreexome-12v1-1_a.egt";
+    bool normalize = true;
+    TS_ASSERT_THROWS_NOTHING(commander->commandCreate(infile, simfile, normalize, manfile, verbose));
+    double threshold = 0.15;
+    int threads = 2;
+    long memory = Caller::DEFAULT_MEMORY;
+    bool matrix = false;
+    string bedfile = tempdir+"/calls";
+    TS_ASSERT_THROWS_NOTHING(commander->commandCall(simfile, bedfile, manfile,
+                                                    egtfile, matrix, threshold,
+                                                    threads, memory, verbose));
+    // 3 header bytes, then 10 probes of 5 samples at 4 calls per byte
+    assertFileSize(bedfile+".bed", 23);
+    TS_ASSERT_EQUALS(0, access((bedfile+".bim").c_str(), R_OK));
+    TS_ASSERT_EQUALS(0, access((bedfile+".fam").c_str(), R_OK));
+    // with no memory to spare, blocks of 4 samples go through a scratch file
+    string scratchfile = tempdir+"/calls_scratch";
+    TS_ASSERT_THROWS_NOTHING(commander->commandCall(simfile, scratchfile,
+                                                    manfile, egtfile, matrix,
+                                                    threshold, threads, 0,
+                                                    verbose));
+    assertFilesIdentical(bedfile+".bed", scratchfile+".bed", 23);
+    matrix = true;
+    string matrixfile = tempdir+"/calls.gt2";
+    TS_ASSERT_THROWS_NOTHING(commander->commandCall(simfile, matrixfile,
+                                                    manfile, egtfile, matrix,
+                                                    threshold, threads,
+                                                    memory, verbose));
+    delete commander;
+    // 12 header bytes, then 5 samples of name and packed calls
+    assertFileSize(matrixfile, 12 + 5 * (Sim::SAMPLE_NAME_SIZE + 3));
+    // packed calls agree with those in the SNP-major BED file
+    ifstream bed((bedfile+".bed").c_str(), ios::binary);
+    ifstream packed(matrixfile.c_str(), ios::binary);
+    char bedCalls[23];
+    char packedCalls[3];
+    bed.read(bedCalls, 23);
+    TS_ASSERT_EQUALS(bedCalls[2], 1);
+    for (int i = 0; i < 5; i++) {
+      packed.seekg(12 + i * (Sim::SAMPLE_NAME_SIZE + 3) + Sim::SAMPLE_NAME_SIZE);
+      packed.read(packedCalls, 3);
+      for (int j = 0; j < 10; j++) {
+        int code = (packedCalls[j/4] >> (2*(j%4))) & 3;
+        int plink = (bedCalls[3 + j*2 + i/4] >> (2*(i%4))) & 3;
+        int expected[4] = { 1, 0, 2, 3 }; // PLINK to GTC call codes
+        TS_ASSERT_EQUALS(code, expected[plink]);
+      }
+    }
+    TS_TRACE("Genotype calls written in PLINK and packed formats");
+  }
+
+  void testRecluster(void) {
+    TS_TRACE("Test of cluster re-estimation command");
+    Commander *commander = new Commander();
+    string infile = "data/example.json";
+    string simfile = tempdir+"/normalized.sim";
+    string manfile = "data/example_normalized.bpm.csv";
+    string egtfile = "data/humancoreexome-12v1-1_a.egt";
+    bool normalize = true;
+    TS_ASSERT_THROWS_NOTHING(commander->commandCreate(infile, simfile, normalize, manfile, verbose));
+    string tablefile = tempdir+"/recluster.clt";
+    int threads = 2;
+    TS_ASSERT_THROWS_NOTHING(commander->commandRecluster(simfile, infile,
+                                                         tablefile, manfile,
+                                                         egtfile, threads,
+                                                         verbose));
+    // header, then 12 params for each of 10 SNPs
+    assertFileSize(tablefile, ClusterTable::HEADER_BYTES + 10 * 12 * 4);
+    // every example sample is called AB; the AB cluster of each SNP is
+    // replaced by the sample mean and s.d., and others are unchanged
+    Manifest *manifest = new Manifest();
+    manifest->open(manfile);
+    ClusterTable *updated = new ClusterTable();
+    ClusterTable *original = new ClusterTable();
+    TS_ASSERT_THROWS_NOTHING(updated->open(tablefile, manfile, manifest));
+    TS_ASSERT_THROWS_NOTHING(original->open(egtfile, manfile, manifest));
+    float before[ClusterTable::PARAMS_PER_SNP];
+    float after[ClusterTable::PARAMS_PER_SNP];
+    original->getClusters(0, before);
+    updated->getClusters(0, after);
+    TS_ASSERT_EQUALS(before[0], after[0]);
+    TS_ASSERT_EQUALS(before[9], after[9]);
+    TS_ASSERT_DELTA(after[4], 11.0, 1e-5);
+    TS_ASSERT_DELTA(after[7], 0.07000, 1e-5);
+    TS_ASSERT_DELTA(after[10], 0.58575, 1e-5);
+    // the table may be used in place of the EGT file
+    string bedfile = tempdir+"/recalled";
+    TS_ASSERT_THROWS_NOTHING(commander->commandCall(simfile, bedfile, manfile,
+                                                    tablefile, false, 0.15,
+                                                    threads,
+                                                    Caller::DEFAULT_MEMORY,
+                                                    verbose));
+    assertFileSize(bedfile+".bed", 23);
+    updated->close();
+    original->close();
+    delete updated;
+    delete original;
+    delete manifest;
+    delete commander;
+    TS_TRACE("Cluster table re-estimated from SIM file and GTC calls");
+  }
+
+  void testFCRFastMath(void) {
+    TS_TRACE("Test of final call report (FCR) command with fast math");
+    Commander *commander = new Commander();
+    string infile = "data/example.json";
+    string outfile = tempdir+"/fcr_fast.txt";
+    string manfile = "data/example_normalized.bpm.csv";
+    string egtfile = "data/humancoreexome-12v1-1_a.egt";
+    string normfile = "data/fcr_test.txt";
+    bool fastMath = true;
+    TS_ASSERT_THROWS_NOTHING(commander->commandFCR(infile, outfile, manfile,
+                                                   egtfile, verbose, fastMath));
+    delete commander;
+    int size = 4657; // same as without fast math
+    assertFileSize(outfile, size);
+    FcrReader data_ref = FcrReader(normfile);
+    FcrReader data_test = FcrReader(outfile);
+    TS_ASSERT(data_ref.equivalent(data_test));
+    TS_TRACE("Fast math FCR output is equivalent to reference copy");
+  }
+
   void testGenoSNP(void) {
     // Tests of GenoSNP mode:
     // 1. Input from file, output all SNPs
@@ -421,6 +1870,11 @@ class SimtoolsTest : public TestBase
     string outfile3 = tempdir+"/illuminus03.iln";
     expected = "data/example_single.iln";
     TS_ASSERT_THROWS_NOTHING(commander->commandIlluminus(sim_raw, outfile3, manfile, start_pos, end_pos, verbose));
+
+    // a region with no probes is an error, not an empty output
+    string outfile4 = tempdir+"/illuminus04.iln";
+    TS_ASSERT_THROWS(commander->commandIlluminus(sim_raw, outfile4, manfile, 0, -1, verbose, "99"), string);
+    TS_ASSERT_THROWS(commander->commandIlluminus(sim_raw, outfile4, manfile, 0, -1, verbose, "1:5-4"), string);
     delete commander;
     assertFileSize(outfile3, size_single);
     assertFilesIdentical(outfile3, expected, size_single);